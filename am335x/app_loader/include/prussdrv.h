@@ -138,6 +138,12 @@ extern "C" {
 
     int prussdrv_pru_wait_event(unsigned int pru_evtout_num);
 
+    int prussdrv_pru_wait_event_timeout(unsigned int pru_evtout_num,
+                                        unsigned int ack_eventnum,
+                                        int timeout_ms);
+
+    int prussdrv_pru_event_fd(unsigned int pru_evtout_num);
+
     int prussdrv_pru_send_event(unsigned int eventnum);
 
     int prussdrv_pru_clear_event(unsigned int eventnum);
@@ -150,6 +156,9 @@ extern "C" {
 
     int prussdrv_exec_program(int prunum, char *filename);
 
+    int prussdrv_exec_code(int prunum, const unsigned int *code,
+                           int codelen);
+
     int prussdrv_start_irqthread(unsigned int pru_evtout_num, int priority,
                                  prussdrv_function_handler irqhandler);
 
@@ -50,6 +50,7 @@
 #include <prussdrv.h>
 #include "__prussdrv.h"
 #include <pthread.h>
+#include <poll.h>
 
 #define PRUSS_UIO_PRAM_PATH_LEN 128
 #define PRUSS_UIO_PARAM_VAL_LEN 20
@@ -428,6 +429,38 @@ int prussdrv_pru_wait_event(unsigned int pru_evtout_num)
 
 }
 
+int prussdrv_pru_wait_event_timeout(unsigned int pru_evtout_num,
+                                    unsigned int ack_eventnum,
+                                    int timeout_ms)
+{
+    int event_count, rc;
+    struct pollfd pfd;
+    unsigned int *pruintc_io = (unsigned int *) prussdrv.intc_base;
+
+    pfd.fd = prussdrv.fd[pru_evtout_num];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    rc = poll(&pfd, 1, timeout_ms);
+    if (rc <= 0)
+        return rc;
+
+    read(prussdrv.fd[pru_evtout_num], &event_count, sizeof(int));
+
+    // Clear the system event before re-enabling the host interrupt,
+    // otherwise the still pending event would fire it again.
+    prussdrv_pru_clear_event(ack_eventnum);
+    pruintc_io[PRU_INTC_HIEISR_REG >> 2] = pru_evtout_num+2;
+    return 1;
+}
+
+int prussdrv_pru_event_fd(unsigned int pru_evtout_num)
+{
+    if (pru_evtout_num >= NUM_PRU_HOSTIRQS)
+        return -1;
+    return prussdrv.fd[pru_evtout_num];
+}
+
 int prussdrv_pru_clear_event(unsigned int eventnum)
 {
     unsigned int *pruintc_io = (unsigned int *) prussdrv.intc_base;
@@ -636,6 +669,29 @@ int prussdrv_exec_program(int prunum, char *filename)
     return 0;
 }
 
+int prussdrv_exec_code(int prunum, const unsigned int *code, int codelen)
+{
+    unsigned int pru_ram_id;
+
+    if (prunum == 0)
+        pru_ram_id = PRUSS0_PRU0_IRAM;
+    else if (prunum == 1)
+        pru_ram_id = PRUSS0_PRU1_IRAM;
+    else
+        return -1;
+
+    if (codelen <= 0 || codelen > PRUSS_MAX_IRAM_SIZE)
+        return -1;
+
+    // Make sure PRU sub system is first disabled/reset
+    prussdrv_pru_disable(prunum);
+    prussdrv_pru_write_memory(pru_ram_id, 0,
+                              (unsigned int *) code, codelen);
+    prussdrv_pru_enable(prunum);
+
+    return 0;
+}
+
 int prussdrv_start_irqthread(unsigned int pru_evtout_num, int priority,
                              prussdrv_function_handler irqhandler)
 {
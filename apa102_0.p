@@ -0,0 +1,379 @@
+// \file
+ //* APA102 / SK9822 LED strip driver for the BeagleBone Black.
+ //*
+ //* Clock and data strips do not care about the bit timing, so rather
+ //* than the 800 KHz of the WS281x this clocks the bits out as fast as
+ //* the writes to the GPIO banks go.  All the strips on a bank share
+ //* one clock pin, marked "clock" in ws281x.pins, and their data pins
+ //* are driven in parallel like the WS281x.
+ //*
+ //* The command structure is the same as for ws281x_0.p, along with
+ //* the clock pins of banks A and B and the length of the end frame.
+ //* The timing period, if any, is a floor on the bit time for long
+ //* clock lines; the other timings are not used.
+ //
+ // each pixel is stored in 4 bytes, clocked out from the top byte:
+ // 0xE0 | the 5 bit global brightness, then blue, green and red.
+ //
+ // send a start frame of 32 zero bits on all pins
+ // while len > 0:
+	 // fetch the row into the row cache in PRU DRAM
+	 // for bit# = 32 down to 0:
+		 // read 16 registers of the cached row, build zero maps for banks A and B
+		 // read 8 more registers of the cached row, build the rest of the maps
+		 // bring the clock and the zero pins low
+		 // bring the one pins high
+		 // bring the clock high, which latches the bit
+	 // increment address by the row stride
+ // send the end frame of zero bits, half a clock per pixel
+ //
+ //*  _   _   _
+ //* | |_| |_| |_ clock
+ //*  ___ ___ ___
+ //* X___X___X___ data, changes while the clock is low
+ //*/
+
+
+.origin 0
+.entrypoint START
+
+#include "ws281x.hp"
+
+//===============================
+// GPIO Pin Mapping
+//
+// The same strips on the same pins as ws281x_0.p, from ws281x.pins.
+// The pins of the bank clocks come from the command structure.
+#include "ws281x_0_pins.hp"
+
+
+/** Register map */
+#define data_addr r0
+#define data_len r1
+#define a_zeros r2
+#define b_zeros r3
+#define seg_addr r4
+#define seg_left r5
+#define bit_num r6
+#define rows_left r7
+#define addr_reg r8
+#define temp_reg r9
+#define row_stride r26
+#define temp2_reg r27
+#define a_mask r28
+#define b_mask r29
+// r10 - r25 are used for temp storage and bitmap processing;
+// r18 - r19 hold the ones and r24 - r25 the clocks of banks A and B
+
+
+/** Wait for the cycle counter to reach one of the bit timings. */
+.macro WAITTIMING
+.mparam timing,lab
+    MOV r8, 0x22000 // control register
+    LBCO temp2_reg, CONST_PRUDRAM, timing, 4
+lab:
+	LBBO r9, r8, 0xC, 4 // read the cycle counter
+	QBGT lab, r9, temp2_reg
+.endm
+
+/** Reset the cycle counter */
+.macro RESET_COUNTER
+		// Disable the counter and clear it, then re-enable it
+		MOV addr_reg, 0x22000 // control register
+		LBBO r9, addr_reg, 0, 4
+		CLR r9, r9, 3 // disable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+
+		MOV temp2_reg, 0
+		SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+
+		SET r9, r9, 3 // enable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+.endm
+
+/** Reset the cycle counter and the stall counter for a new frame */
+.macro RESET_COUNTERS
+		MOV addr_reg, 0x22000 // control register
+		LBBO r9, addr_reg, 0, 4
+		CLR r9, r9, 3 // disable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+
+		MOV temp2_reg, 0
+		SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+		SBBO temp2_reg, addr_reg, 0x10, 4 // and the stall count
+
+		SET r9, r9, 3 // enable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+.endm
+
+/** Clock out one bit on banks A and B.
+ *
+ * Drop the clock along with the zero pins in a_zeros and b_zeros,
+ * raise the one pins in r18 and r19, then raise the clock in r24 and
+ * r25.  The writes to a bank reach it in order, so the data is set
+ * up before the rising edge that latches it.  Without a bit period
+ * in the timing this runs as fast as the OCP bus takes the writes.
+ */
+.macro CLOCK_BIT
+.mparam lab,wait_lab
+    LBCO temp2_reg, CONST_PRUDRAM, TIMING_PERIOD, 4
+    QBEQ lab, temp2_reg, 0
+    WAITTIMING TIMING_PERIOD, wait_lab
+    RESET_COUNTER
+lab:
+    MOV r20, GPIO_A | GPIO_CLEARDATAOUT
+    MOV r21, GPIO_B | GPIO_CLEARDATAOUT
+    MOV r22, GPIO_A | GPIO_SETDATAOUT
+    MOV r23, GPIO_B | GPIO_SETDATAOUT
+
+    SBBO a_zeros, r20, 0, 4
+#if GPIO_BANKS > 1
+    SBBO b_zeros, r21, 0, 4
+#endif
+    SBBO r18, r22, 0, 4
+#if GPIO_BANKS > 1
+    SBBO r19, r23, 0, 4
+#endif
+    SBBO r24, r22, 0, 4
+#if GPIO_BANKS > 1
+    SBBO r25, r23, 0, 4
+#endif
+.endm
+
+/** Clock out zero bits on the pins in a_mask and b_mask. */
+.macro CLOCK_ZEROS
+.mparam count,lab,bit_lab,wait_lab
+    MOV bit_num, count
+lab:
+    MOV r24, CLOCK_MASKS
+    LBBO r24, r24, 0, 8
+    OR a_zeros, a_mask, r24
+    OR b_zeros, b_mask, r25
+    MOV r18, 0
+    MOV r19, 0
+    CLOCK_BIT bit_lab, wait_lab
+    SUB bit_num, bit_num, 1
+    QBNE lab, bit_num, 0
+.endm
+
+START:
+    // Enable OCP master port
+    // clear the STANDBY_INIT bit in the SYSCFG register,
+    // otherwise the PRU will not be able to write outside the
+    // PRU memory space and to the BeagleBon's pins.
+    LBCO	r0, C4, 4, 4
+    CLR		r0, r0, 4
+    SBCO	r0, C4, 4, 4
+
+    // Configure the programmable pointer register for PRU0 by setting
+    // c28_pointer[15:0] field to 0x0120.  This will make C28 point to
+    // 0x00012000 (PRU shared RAM).
+    MOV		r0, 0x00000120
+    MOV		r1, CTPPR_0
+    ST32	r0, r1
+
+    // Configure the programmable pointer register for PRU0 by setting
+    // c31_pointer[15:0] field to 0x0010.  This will make C31 point to
+    // 0x80001000 (DDR memory).
+    MOV		r0, 0x00100000
+    MOV		r1, CTPPR_1
+    ST32	r0, r1
+
+    // Start the IEP timer, which both PRUs share for the frame
+    // telemetry.  Whichever PRU starts second rewrites the same
+    // configuration, which does not disturb the count.
+    MOV r0, IEP | IEP_GLOBAL_CFG
+    MOV r1, 0x11 // increment by 1 per cycle, count enable
+    SBBO r1, r0, 0, 4
+
+    // Write a 0x1 into the response field so that they know we have started
+    MOV r2, #0x1
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+    // Wait for the start condition from the main program to indicate
+    // that we have a rendered frame ready to clock out.  This also
+    // handles the exit case if an invalid value is written to the start
+    // start position.
+_LOOP:
+    // Bump the heartbeat that the host's watchdog checks; it keeps
+    // moving while idle here and once per row during a frame.
+    MOV r10, HEARTBEAT
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
+    // Load the pointer to the buffer from PRU DRAM into r0 and the
+    // number of rows to clock out this frame into r1.
+    // start command into r2
+    LBCO      data_addr, CONST_PRUDRAM, 0, 12
+
+    // Wait for a non-zero command
+    QBEQ _LOOP, r2, #0
+
+    // Reset the sleep timer and the stall count for the telemetry
+    RESET_COUNTERS
+
+    // Zero out the start command so that they know we have received it
+    MOV r3, 0
+    SBCO r3, CONST_PRUDRAM, 8, 4
+
+    // Command of 0xFF is the signal to exit
+    QBEQ EXIT, r2, #0xFF
+
+    // Time stamp the start of the frame
+    MOV r10, IEP | IEP_COUNT
+    LBBO r11, r10, 0, 4
+    MOV r10, TELEMETRY
+    SBBO r11, r10, 4, 4
+
+    // The segments are the same as for the WS281x.  Strips whose
+    // pixels were not asked for keep showing the previous frame.
+    MOV rows_left, data_len
+    LBCO seg_left, CONST_PRUDRAM, 16, 4
+    MOV seg_addr, SEGMENTS
+    QBEQ FRAME_DONE, seg_left, #0
+    QBEQ FRAME_DONE, rows_left, #0
+
+    // Start frame on the pins of the first segment, which has all of
+    // the active strips
+    LBCO a_mask, CONST_PRUDRAM, SEGMENTS+8, 8
+    CLOCK_ZEROS 32, start_frame, start_bit, start_bit_wait
+
+SEG_LOOP:
+    // Load the row stride, the row count (into temp2, which is only
+    // used while resetting the counter) and the active pin masks.
+    LBCO row_stride, CONST_PRUDRAM, seg_addr, 16
+    MOV data_len, temp2_reg
+    ADD seg_addr, seg_addr, 16
+
+    // Stop early in this segment if the frame is cut short
+    QBGE seg_rows_ok, data_len, rows_left
+    MOV data_len, rows_left
+seg_rows_ok:
+    SUB rows_left, rows_left, data_len
+
+WORD_LOOP:
+	// Fetch the row into the row cache in PRU DRAM, so that the DDR
+	// is read once per row rather than on every bit
+	MOV addr_reg, ROW_CACHE
+	LBBO r10, data_addr, 0, 16*4
+	SBBO r10, addr_reg, 0, 16*4
+	LBBO r10, data_addr, 16*4, 8*4
+	SBBO r10, addr_reg, 16*4, 8*4
+
+	// for bit in 32 to 0
+	MOV r10, PIXEL_BITS
+	LBBO bit_num, r10, 0, 4
+
+	BIT_LOOP:
+		SUB bit_num, bit_num, 1
+		/** Macro to generate the mask of which bits are zero,
+		 * as in ws281x_0.p.
+		 */
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_skip: ; \
+
+		// Load 16 registers of data from the row cache, starting at r10
+		MOV temp_reg, ROW_CACHE
+		LBBO r10, temp_reg, 0, 16*4
+		MOV a_zeros, 0
+		MOV b_zeros, 0
+		TEST_BITS_EARLY
+
+		// Load 8 more registers of data
+		LBBO r10, temp_reg, 16*4, 8*4
+		TEST_BITS_LATE
+
+		// Only the active pins are driven: the zeros go low with
+		// the clock and the rest of them high.
+		MOV r24, CLOCK_MASKS
+		LBBO r24, r24, 0, 8
+		AND a_zeros, a_zeros, a_mask
+		AND b_zeros, b_zeros, b_mask
+		XOR r18, a_zeros, a_mask
+		XOR r19, b_zeros, b_mask
+		OR a_zeros, a_zeros, r24
+		OR b_zeros, b_zeros, r25
+
+		CLOCK_BIT data_bit, data_bit_wait
+
+		QBNE BIT_LOOP, bit_num, 0
+
+	// The pixel has been clocked out
+	// Move to the next pixel on each row
+	ADD data_addr, data_addr, row_stride
+	MOV r10, HEARTBEAT
+	LBBO r11, r10, 0, 4
+	ADD r11, r11, 1
+	SBBO r11, r10, 0, 4
+	SUB data_len, data_len, 1
+	QBNE WORD_LOOP, data_len, #0
+
+	// Leave the data pins of the segment low, since the next
+	// segment may drive fewer of them.
+	MOV r10, GPIO_A | GPIO_CLEARDATAOUT
+	MOV r11, GPIO_B | GPIO_CLEARDATAOUT
+	SBBO a_mask, r10, 0, 4
+#if GPIO_BANKS > 1
+	SBBO b_mask, r11, 0, 4
+#endif
+
+	QBEQ END_FRAME, rows_left, #0
+	SUB seg_left, seg_left, 1
+	QBNE SEG_LOOP, seg_left, #0
+
+END_FRAME:
+    // Each strip delays the data by half a clock per pixel, so keep
+    // clocking with the data pins low to push the last pixels out.
+    MOV a_mask, 0
+    MOV b_mask, 0
+    MOV r10, END_CLOCKS
+    LBBO r10, r10, 0, 4
+    CLOCK_ZEROS r10, end_frame, end_bit, end_bit_wait
+
+FRAME_DONE:
+    // Finish the telemetry with the end time stamp and the cycles
+    // stalled on the DDR during the frame, then count the frame.
+    MOV r10, IEP | IEP_COUNT
+    LBBO r12, r10, 0, 4
+    MOV r10, 0x22000 // control register
+    LBBO r13, r10, 0x10, 4
+    MOV r10, TELEMETRY
+    SBBO r12, r10, 8, 8
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
+    // The strips show each pixel as it arrives, so there is no
+    // reset time to wait out.  Write out that we are done!
+    MOV r8, 0x22000 // control register
+    LBBO r2, r8, 0xC, 4
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+    // Wake up the ARM, which sleeps on this event rather than polling
+    // the response.  Both PRUs raise the same event so that the ARM
+    // only has to watch one uio device; it checks both responses.
+#ifdef AM33XX
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
+    // Go back to waiting for the next frame buffer
+    QBA _LOOP
+
+EXIT:
+    // Write a 0xFF into the response field so that they know we're done
+    MOV r2, #0xFF
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+#ifdef AM33XX
+    // Send notification to Host for program completion
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
+    HALT
@@ -25,10 +25,14 @@ main(
 	int port = 9999;
 	int num_pixels = 256;
 	int num_strips = LEDSCAPE_NUM_STRIPS;
+	int rgbw = 0;
+	int apa102 = 0;
+	unsigned brightness = 0;
+	const ledscape_timing_t * timing = NULL;
 
 	extern char *optarg;
 	int opt;
-	while ((opt = getopt(argc, argv, "p:c:d:")) != -1)
+	while ((opt = getopt(argc, argv, "p:c:d:s:WAB:T:")) != -1)
 	{
 		switch (opt)
 		{
@@ -38,6 +42,11 @@ main(
 		case 'c':
 			num_pixels = atoi(optarg);
 			break;
+		case 's':
+			num_strips = atoi(optarg);
+			if (num_strips < 1 || num_strips > LEDSCAPE_NUM_STRIPS)
+				die("-s must be 1 to %d strips\n", LEDSCAPE_NUM_STRIPS);
+			break;
 		case 'd': {
 			int width=0, height=0;
 
@@ -49,8 +58,24 @@ main(
 			}
 		}
 		break;
+		case 'W':
+			rgbw = 1;
+			break;
+		case 'A':
+			apa102 = 1;
+			break;
+		case 'B':
+			brightness = atoi(optarg);
+			if (brightness < 1 || brightness > 31)
+				die("-B must be 1 to 31\n");
+			break;
+		case 'T':
+			timing = ledscape_timing(optarg);
+			if (!timing)
+				die("-T %s is not a timing profile\n", optarg);
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-p <port>] [-s <strips>] [-c <led_count> | -d <width>x<height>] [-W(RGBW strips)] [-A(PA102 strips) [-B <brightness 1-31>]] [-T <timing profile>]\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -68,7 +93,16 @@ main(
 	if (bind(sock, (const struct sockaddr*) &addr, sizeof(addr)) < 0)
 		die("bind port %d failed: %s\n", port, strerror(errno));
 
-	ledscape_t * const leds = ledscape_init(num_pixels);
+	// Only clock out what changed since the last packet
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= num_pixels,
+		.num_strips	= num_strips,
+		.change_aware	= 1,
+		.rgbw		= rgbw,
+		.apa102		= apa102,
+		.brightness	= brightness,
+		.timing		= timing,
+	});
 
 	fprintf(stderr, "Started LEDscape UDP receiver on port %d for %d pixels\n", port, num_pixels);
 
@@ -89,16 +123,7 @@ main(
 		ledscape_frame_t * const frame
 			= ledscape_frame(leds, frame_num);
 
-		for(unsigned x=0 ; x < num_pixels ; x++)
-		{
-			for(unsigned strip = 0 ; strip < num_strips ; strip++)
-			{
-				const uint8_t r = buf[strip*num_pixels*3 + x*3 + 0];
-				const uint8_t g = buf[strip*num_pixels*3 + x*3 + 1];
-				const uint8_t b = buf[strip*num_pixels*3 + x*3 + 2];
-				ledscape_set_color(frame, strip, x, r, g, b);
-			}
-		}
+		ledscape_blit_strips(leds, frame, 0, buf, rc / 3);
 
 		ledscape_wait(leds);
 		ledscape_draw(leds, frame_num);
@@ -0,0 +1,167 @@
+/** \file
+ * Compare the per-pixel ledscape_set_color() path with the bulk
+ * blits for converting network RGB24 images into a frame, and an
+ * effect that reads back the frame to fade it.
+ *
+ * Runs on the BeagleBone so that the frames are in the real
+ * uncached DDR shared with the PRU, or with -S in cached shadow
+ * frames.  Nothing is drawn unless -D times ledscape_draw(), which
+ * with -S includes copying the frame out to the DDR.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "ledscape.h"
+#include "util.h"
+
+
+static uint64_t
+bench_set_color(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const uint8_t * const rgb,
+	const unsigned num_strips,
+	const unsigned num_pixels
+)
+{
+	const uint64_t start = monotonic_ns();
+
+	for (unsigned strip = 0 ; strip < num_strips ; strip++)
+	{
+		for (unsigned x = 0 ; x < num_pixels ; x++)
+		{
+			const uint8_t * const in = &rgb[3 * (strip * num_pixels + x)];
+			ledscape_set_color(leds, frame, strip, x, in[0], in[1], in[2]);
+		}
+	}
+
+	return monotonic_ns() - start;
+}
+
+
+/** Halve every pixel, as fire.c and other effects that decay the
+ * previous frame do; a read and a write of each word of the frame.
+ */
+static uint64_t
+bench_fade(
+	ledscape_frame_t * const frame,
+	const size_t num_pixels
+)
+{
+	const uint64_t start = monotonic_ns();
+	uint32_t * const p = (uint32_t*) frame;
+
+	for (size_t i = 0 ; i < num_pixels ; i++)
+		p[i] = (p[i] >> 1) & 0x7F7F7F7F;
+
+	return monotonic_ns() - start;
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	unsigned num_pixels = 512;
+	unsigned num_strips = LEDSCAPE_NUM_STRIPS;
+	unsigned loops = 100;
+	int shadow = 0;
+	int draw = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:s:n:SD")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			num_pixels = atoi(optarg);
+			break;
+		case 's':
+			num_strips = atoi(optarg);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'S':
+			shadow = 1;
+			break;
+		case 'D':
+			draw = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c <led_count>] [-s <strips>] [-n <loops>] [-S(hadow frames)] [-D(raw)]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= num_pixels,
+		.num_strips	= num_strips,
+		.shadow		= shadow,
+	});
+	ledscape_frame_t * const frame = ledscape_frame(leds, 0);
+
+	const size_t num_rgb = num_pixels * num_strips;
+	uint8_t * const rgb = malloc(3 * num_rgb);
+	if (!rgb)
+		die("malloc failed\n");
+	for (size_t i = 0 ; i < 3 * num_rgb ; i++)
+		rgb[i] = i * 7;
+
+	uint64_t set_color_ns = 0;
+	uint64_t strips_ns = 0;
+	uint64_t rows_ns = 0;
+	uint64_t fade_ns = 0;
+	uint64_t draw_ns = 0;
+
+	for (unsigned i = 0 ; i < loops ; i++)
+	{
+		set_color_ns += bench_set_color(leds, frame, rgb, num_strips, num_pixels);
+
+		uint64_t start = monotonic_ns();
+		ledscape_blit_strips(leds, frame, 0, rgb, num_rgb);
+		strips_ns += monotonic_ns() - start;
+
+		start = monotonic_ns();
+		ledscape_blit_rows(leds, frame, rgb, num_pixels);
+		rows_ns += monotonic_ns() - start;
+
+		fade_ns += bench_fade(frame, num_rgb);
+
+		if (draw)
+		{
+			ledscape_wait(leds);
+			start = monotonic_ns();
+			ledscape_draw(leds, 0);
+			draw_ns += monotonic_ns() - start;
+		}
+	}
+
+	printf("%u strips x %u pixels, %u loops%s%s\n",
+		num_strips,
+		num_pixels,
+		loops,
+#ifdef __ARM_NEON__
+		", NEON",
+#else
+		", scalar",
+#endif
+		shadow ? ", shadow frames" : ""
+	);
+	printf("set_color    %8"PRIu64" us/frame\n", set_color_ns / loops / 1000);
+	printf("blit_strips  %8"PRIu64" us/frame\n", strips_ns / loops / 1000);
+	printf("blit_rows    %8"PRIu64" us/frame\n", rows_ns / loops / 1000);
+	printf("fade         %8"PRIu64" us/frame\n", fade_ns / loops / 1000);
+	if (draw)
+		printf("draw         %8"PRIu64" us/frame\n", draw_ns / loops / 1000);
+
+	ledscape_close(leds);
+	free(rgb);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,355 @@
+/** \file
+ * Bulk conversion of RGB24 images into LEDscape frames.
+ *
+ * The receivers get whole images in either strip-major order
+ * (each strip's pixels adjacent, as udp-rx and opc-rx do) or
+ * pixel-major order (the same row order as the frame).  Converting
+ * them a pixel at a time with ledscape_set_color() means one
+ * function call and one scattered 4-byte write into uncached DDR
+ * per pixel.  These convert whole rows, and on NEON transpose blocks
+ * of 4 strips by 16 pixels so that every store writes 16 bytes.
+ *
+ * Strips with a color correction go through their lookup tables in
+ * the same pass: the corrected pixels are staged in a small buffer
+ * that stays in the cache, so the frame is still written only once.
+ * RGBW rigs have their white extracted in the same pass as well,
+ * and APA102 rigs their brightness added.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "ledscape.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+
+static inline void
+put_rgb(
+	ledscape_pixel_t * const p,
+	const uint8_t * const in,
+	const ledscape_format_t format,
+	const uint8_t brightness
+)
+{
+	// BRGA, little endian
+	const uint32_t word = in[2] << 0 | in[0] << 8 | in[1] << 16;
+	*(uint32_t*)(void*) p = ledscape_pack(format, brightness, word);
+}
+
+
+static inline void
+put_pixel(
+	ledscape_pixel_t * const p,
+	const uint8_t * const in,
+	const ledscape_lut_t * const lut,
+	const ledscape_format_t format,
+	const uint8_t brightness
+)
+{
+	if (!lut)
+	{
+		put_rgb(p, in, format, brightness);
+		return;
+	}
+
+	const uint32_t word = 0
+		| lut->lut[0][in[lut->src[0]]] << 0
+		| lut->lut[1][in[lut->src[1]]] << 8
+		| lut->lut[2][in[lut->src[2]]] << 16;
+	*(uint32_t*)(void*) p = ledscape_pack(format, brightness, word);
+}
+
+
+#ifdef __ARM_NEON__
+/** Run pixels through a strip's tables into an RGB staging buffer.
+ *
+ * The result is ordered so that the plain RGB to BRGA swizzle puts
+ * every corrected byte where the lookup table says it belongs.
+ */
+static inline void
+correct_rgb(
+	uint8_t * out,
+	const uint8_t * in,
+	const ledscape_lut_t * const lut,
+	unsigned n
+)
+{
+	while (n--)
+	{
+		out[2] = lut->lut[0][in[lut->src[0]]];
+		out[0] = lut->lut[1][in[lut->src[1]]];
+		out[1] = lut->lut[2][in[lut->src[2]]];
+		out += 3;
+		in += 3;
+	}
+}
+#endif
+
+
+#ifdef __ARM_NEON__
+/** Byte planes of 16 RGB pixels in frame order; see ledscape_pack(). */
+static inline uint8x16x4_t
+frame_planes(
+	const uint8x16x3_t rgb,
+	const ledscape_format_t format,
+	const uint8_t brightness
+)
+{
+	if (format == LEDSCAPE_FORMAT_APA102)
+	{
+		const uint8x16x4_t rgba = {{
+			rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(0xE0 | brightness)
+		}};
+		return rgba;
+	}
+
+	if (format != LEDSCAPE_FORMAT_RGBW)
+	{
+		const uint8x16x4_t brga = {{
+			rgb.val[2], rgb.val[0], rgb.val[1], vdupq_n_u8(0)
+		}};
+		return brga;
+	}
+
+	const uint8x16_t w = vminq_u8(vminq_u8(rgb.val[0], rgb.val[1]), rgb.val[2]);
+	const uint8x16x4_t wbrg = {{
+		w,
+		vsubq_u8(rgb.val[2], w),
+		vsubq_u8(rgb.val[0], w),
+		vsubq_u8(rgb.val[1], w),
+	}};
+	return wbrg;
+}
+
+
+/** Expand 16 RGB pixels into four vectors of four frame pixels. */
+static inline void
+brga_quads(
+	const uint8x16x3_t rgb,
+	const ledscape_format_t format,
+	const uint8_t brightness,
+	uint32x4_t q[4]
+)
+{
+	const uint8x16x4_t planes = frame_planes(rgb, format, brightness);
+	const uint8x16x2_t br = vzipq_u8(planes.val[0], planes.val[1]);
+	const uint8x16x2_t ga = vzipq_u8(planes.val[2], planes.val[3]);
+
+	const uint16x8x2_t lo = vzipq_u16(
+		vreinterpretq_u16_u8(br.val[0]),
+		vreinterpretq_u16_u8(ga.val[0])
+	);
+	const uint16x8x2_t hi = vzipq_u16(
+		vreinterpretq_u16_u8(br.val[1]),
+		vreinterpretq_u16_u8(ga.val[1])
+	);
+
+	q[0] = vreinterpretq_u32_u16(lo.val[0]);
+	q[1] = vreinterpretq_u32_u16(lo.val[1]);
+	q[2] = vreinterpretq_u32_u16(hi.val[0]);
+	q[3] = vreinterpretq_u32_u16(hi.val[1]);
+}
+
+
+/** Transpose four adjacent strips into the frame, 16 pixels at a time.
+ *
+ * \returns the number of pixels done; the caller finishes the rest.
+ */
+static unsigned
+blit_4_strips(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const unsigned strip,
+	const uint8_t * const in,
+	const unsigned in_stride,
+	const unsigned len,
+	const ledscape_lut_t * const * const lut,
+	const ledscape_format_t format,
+	const uint8_t brightness
+)
+{
+	unsigned x;
+
+	for (x = 0 ; x + 16 <= len ; x += 16)
+	{
+		ledscape_pixel_t * rows[16];
+		for (unsigned i = 0 ; i < 16 ; i++)
+			rows[i] = ledscape_row(leds, frame, x + i);
+
+		uint8_t staged[4][16 * 3];
+		uint32x4_t q[4][4];
+		for (unsigned k = 0 ; k < 4 ; k++)
+		{
+			const uint8_t * src = in + 3 * (k * in_stride + x);
+			if (lut[k])
+			{
+				correct_rgb(staged[k], src, lut[k], 16);
+				src = staged[k];
+			}
+
+			brga_quads(vld3q_u8(src), format, brightness, q[k]);
+		}
+
+		for (unsigned i = 0 ; i < 4 ; i++)
+		{
+			// 4x4 transpose of strips by pixels
+			const uint32x4x2_t ab = vtrnq_u32(q[0][i], q[1][i]);
+			const uint32x4x2_t cd = vtrnq_u32(q[2][i], q[3][i]);
+
+			ledscape_pixel_t * const * const r = &rows[4 * i];
+			vst1q_u32((uint32_t*)(void*)(r[0] + strip),
+				vcombine_u32(vget_low_u32(ab.val[0]), vget_low_u32(cd.val[0])));
+			vst1q_u32((uint32_t*)(void*)(r[1] + strip),
+				vcombine_u32(vget_low_u32(ab.val[1]), vget_low_u32(cd.val[1])));
+			vst1q_u32((uint32_t*)(void*)(r[2] + strip),
+				vcombine_u32(vget_high_u32(ab.val[0]), vget_high_u32(cd.val[0])));
+			vst1q_u32((uint32_t*)(void*)(r[3] + strip),
+				vcombine_u32(vget_high_u32(ab.val[1]), vget_high_u32(cd.val[1])));
+		}
+	}
+
+	return x;
+}
+#endif
+
+
+/** Copy strip-major RGB24 data into a frame.
+ *
+ * in holds num_pixels pixels for consecutive strips starting at
+ * strip, each ledscape_num_pixels() long; a short last
+ * strip is only partially filled.  Pixels past the end of a strip
+ * that is configured shorter are skipped.
+ */
+void
+ledscape_blit_strips(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	unsigned strip,
+	const uint8_t * in,
+	size_t num_pixels
+)
+{
+	const unsigned num_strips = ledscape_num_strips(leds);
+	const unsigned width = ledscape_num_pixels(leds);
+	const ledscape_format_t format = ledscape_format(leds);
+	const uint8_t brightness = ledscape_brightness(leds);
+	if (width == 0)
+		return;
+
+#ifdef __ARM_NEON__
+	while (num_pixels >= 4 * width && strip + 4 <= num_strips)
+	{
+		unsigned len[4];
+		const ledscape_lut_t * lut[4];
+		unsigned min_len = width;
+		for (unsigned k = 0 ; k < 4 ; k++)
+		{
+			len[k] = ledscape_strip_pixels(leds, strip + k);
+			lut[k] = ledscape_strip_lut(leds, strip + k);
+			if (len[k] < min_len)
+				min_len = len[k];
+		}
+
+		const unsigned done = blit_4_strips(leds, frame, strip, in, width, min_len, lut, format, brightness);
+
+		for (unsigned k = 0 ; k < 4 ; k++)
+			for (unsigned x = done ; x < len[k] ; x++)
+				put_pixel(ledscape_row(leds, frame, x) + strip + k, in + 3 * (k * width + x), lut[k], format, brightness);
+
+		strip += 4;
+		in += 3 * 4 * width;
+		num_pixels -= 4 * width;
+	}
+#endif
+
+	while (num_pixels && strip < num_strips)
+	{
+		const unsigned n = num_pixels < width ? num_pixels : width;
+		const ledscape_lut_t * const lut = ledscape_strip_lut(leds, strip);
+		unsigned len = ledscape_strip_pixels(leds, strip);
+		if (len > n)
+			len = n;
+
+		for (unsigned x = 0 ; x < len ; x++)
+			put_pixel(ledscape_row(leds, frame, x) + strip, in + 3 * x, lut, format, brightness);
+
+		strip++;
+		in += 3 * n;
+		num_pixels -= n;
+	}
+}
+
+
+/** Copy pixel-major RGB24 data into a frame.
+ *
+ * in holds num_rows rows of ledscape_num_strips() pixels each, in
+ * the same order as the frame itself.  Pixels past the end of a
+ * shorter strip are skipped.
+ */
+void
+ledscape_blit_rows(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const uint8_t * in,
+	unsigned num_rows
+)
+{
+	const unsigned num_strips = ledscape_num_strips(leds);
+	const unsigned num_pixels = ledscape_num_pixels(leds);
+	const ledscape_format_t format = ledscape_format(leds);
+	const uint8_t brightness = ledscape_brightness(leds);
+	if (num_rows > num_pixels)
+		num_rows = num_pixels;
+
+	unsigned len[LEDSCAPE_NUM_STRIPS];
+	const ledscape_lut_t * lut[LEDSCAPE_NUM_STRIPS];
+	int corrected = 0;
+	for (unsigned s = 0 ; s < num_strips ; s++)
+	{
+		len[s] = ledscape_strip_pixels(leds, s);
+		lut[s] = ledscape_strip_lut(leds, s);
+		if (lut[s])
+			corrected = 1;
+	}
+
+	for (unsigned p = 0 ; p < num_rows ; p++, in += 3 * num_strips)
+	{
+		ledscape_pixel_t * const out = ledscape_row(leds, frame, p);
+
+		// The row is as wide as its highest active strip; the
+		// slots of shorter strips below that are written but
+		// never clocked out.
+		unsigned width = 0;
+		for (unsigned s = 0 ; s < num_strips ; s++)
+			if (len[s] > p)
+				width = s + 1;
+
+		unsigned s = 0;
+#ifdef __ARM_NEON__
+		const uint8_t * src = in;
+		uint8_t staged[LEDSCAPE_NUM_STRIPS * 3];
+		if (corrected)
+		{
+			for (unsigned i = 0 ; i < width ; i++)
+			{
+				if (lut[i])
+					correct_rgb(&staged[3 * i], &in[3 * i], lut[i], 1);
+				else
+					memcpy(&staged[3 * i], &in[3 * i], 3);
+			}
+			src = staged;
+		}
+
+		for ( ; s + 16 <= width ; s += 16)
+			vst4q_u8((uint8_t*)(out + s), frame_planes(vld3q_u8(src + 3 * s), format, brightness));
+#endif
+		if (corrected)
+			for ( ; s < width ; s++)
+				put_pixel(out + s, in + 3 * s, lut[s], format, brightness);
+		else
+			for ( ; s < width ; s++)
+				put_rgb(out + s, in + 3 * s, format, brightness);
+	}
+}
@@ -0,0 +1,297 @@
+/** \file
+ * Temporal dithering of 16 bit per channel images.
+ *
+ * The strips only take 8 bits per channel, which makes slow fades
+ * at low brightness visibly step.  The PRU clocks frames out far
+ * faster than the eye can follow, so each frame is rounded down and
+ * the remainder carried into the next one for the same pixel; over a
+ * few frames the average is the full 16 bit value.
+ *
+ * The targets and remainders are kept as separate planes per channel
+ * in frame order, so that rendering walks them linearly and the NEON
+ * path handles eight strips per instruction.  A full 48 strip by 512
+ * pixel rig needs 216 KB of state.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "ledscape.h"
+#include "util.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+
+struct ledscape_dither
+{
+	ledscape_t * leds;
+	unsigned num_strips;
+	unsigned num_pixels;
+
+	// Indexed by pixel * num_strips + strip
+	uint16_t * value[3]; // r, g, b targets
+	uint8_t * residual[3]; // remainders carried to the next frame
+};
+
+
+/** Frame byte order of uncorrected strips: b, r, g. */
+static const uint8_t grb_src[3] = { 2, 0, 1 };
+
+
+ledscape_dither_t *
+ledscape_dither_init(
+	ledscape_t * const leds
+)
+{
+	ledscape_dither_t * const dither = calloc(1, sizeof(*dither));
+	if (!dither)
+		die("calloc failed: %s\n", strerror(errno));
+
+	const unsigned num_strips = ledscape_num_strips(leds);
+	const unsigned num_pixels = ledscape_num_pixels(leds);
+	const size_t n = (size_t) num_strips * num_pixels;
+
+	*dither = (ledscape_dither_t) {
+		.leds		= leds,
+		.num_strips	= num_strips,
+		.num_pixels	= num_pixels,
+	};
+
+	for (unsigned c = 0 ; c < 3 ; c++)
+	{
+		dither->value[c] = calloc(n, sizeof(*dither->value[c]));
+		dither->residual[c] = malloc(n);
+		if (!dither->value[c] || !dither->residual[c])
+			die("calloc failed: %s\n", strerror(errno));
+
+		// Start every pixel at a different phase so that a
+		// uniform level does not toggle all of them on the
+		// same frames.
+		for (size_t i = 0 ; i < n ; i++)
+			dither->residual[c][i] = (i * 151 + c * 85) & 0xFF;
+	}
+
+	return dither;
+}
+
+
+void
+ledscape_dither_close(
+	ledscape_dither_t * const dither
+)
+{
+	for (unsigned c = 0 ; c < 3 ; c++)
+	{
+		free(dither->value[c]);
+		free(dither->residual[c]);
+	}
+
+	free(dither);
+}
+
+
+/** Apply a strip's gamma and gain to a 16 bit channel, between the
+ * points of its curve.
+ */
+static inline uint16_t
+dither_correct(
+	const uint16_t * const curve,
+	const uint16_t value
+)
+{
+	const unsigned i = value >> 8;
+	const int32_t step = (int32_t) curve[i + 1] - curve[i];
+	return curve[i] + (step * (int32_t) (value & 0xFF)) / 256;
+}
+
+
+/** Set the 16 bit target of one pixel.
+ *
+ * The strip's color correction, if any, is applied here at 16 bits,
+ * so that the dithered pixels match what ledscape_set_color() makes
+ * of the same color.
+ */
+void
+ledscape_dither_set(
+	ledscape_dither_t * const dither,
+	const unsigned strip,
+	const unsigned pixel,
+	const uint16_t r,
+	const uint16_t g,
+	const uint16_t b
+)
+{
+	if (strip >= dither->num_strips || pixel >= dither->num_pixels)
+		return;
+
+	const size_t i = (size_t) pixel * dither->num_strips + strip;
+	const ledscape_lut_t * const lut = ledscape_strip_lut(dither->leds, strip);
+	dither->value[0][i] = lut ? dither_correct(lut->curve[0], r) : r;
+	dither->value[1][i] = lut ? dither_correct(lut->curve[1], g) : g;
+	dither->value[2][i] = lut ? dither_correct(lut->curve[2], b) : b;
+}
+
+
+/** Load pixel-major RGB48 data, in the same order as ledscape_blit_rows().
+ *
+ * in holds num_rows rows of ledscape_num_strips() pixels, each
+ * three native endian 16 bit values r, g, b.  Color correction is
+ * applied as by ledscape_dither_set().
+ */
+void
+ledscape_dither_rows(
+	ledscape_dither_t * const dither,
+	const uint16_t * in,
+	unsigned num_rows
+)
+{
+	if (num_rows > dither->num_pixels)
+		num_rows = dither->num_pixels;
+
+	const unsigned num_strips = dither->num_strips;
+	const ledscape_lut_t * lut[LEDSCAPE_NUM_STRIPS];
+	for (unsigned s = 0 ; s < num_strips ; s++)
+		lut[s] = ledscape_strip_lut(dither->leds, s);
+
+	size_t i = 0;
+	for (unsigned row = 0 ; row < num_rows ; row++)
+	{
+		for (unsigned s = 0 ; s < num_strips ; s++, i++, in += 3)
+		{
+			if (!lut[s])
+			{
+				dither->value[0][i] = in[0];
+				dither->value[1][i] = in[1];
+				dither->value[2][i] = in[2];
+				continue;
+			}
+
+			for (unsigned c = 0 ; c < 3 ; c++)
+				dither->value[c][i] = dither_correct(lut[s]->curve[c], in[c]);
+		}
+	}
+}
+
+
+static inline uint8_t
+dither_channel(
+	const uint16_t value,
+	uint8_t * const residual
+)
+{
+	// Saturate so that full scale plus a remainder stays at 255
+	uint32_t sum = value + *residual;
+	if (sum > 0xFFFF)
+		sum = 0xFFFF;
+
+	*residual = sum & 0xFF;
+	return sum >> 8;
+}
+
+
+/** Round the targets into a frame and carry the remainders.
+ *
+ * Call once per frame that is drawn, typically from a pacer render
+ * callback with an fps of 0, so that the dither runs at the full
+ * PRU frame rate.  The targets were color corrected when they were
+ * set, so only the color order of corrected strips is left to apply.
+ */
+void
+ledscape_dither_render(
+	ledscape_dither_t * const dither,
+	ledscape_frame_t * const frame
+)
+{
+	ledscape_t * const leds = dither->leds;
+	const unsigned num_strips = dither->num_strips;
+	const ledscape_format_t format = ledscape_format(leds);
+	const uint8_t brightness = ledscape_brightness(leds);
+
+	unsigned len[LEDSCAPE_NUM_STRIPS];
+	const uint8_t * src[LEDSCAPE_NUM_STRIPS];
+#ifdef __ARM_NEON__
+	int reordered = 0;
+#endif
+	for (unsigned s = 0 ; s < num_strips ; s++)
+	{
+		const ledscape_lut_t * const lut = ledscape_strip_lut(leds, s);
+		len[s] = ledscape_strip_pixels(leds, s);
+		src[s] = lut ? lut->src : grb_src;
+#ifdef __ARM_NEON__
+		if (memcmp(src[s], grb_src, 3) != 0)
+			reordered = 1;
+#endif
+	}
+
+	for (unsigned p = 0 ; p < dither->num_pixels ; p++)
+	{
+		ledscape_pixel_t * const out = ledscape_row(leds, frame, p);
+		const size_t base = (size_t) p * num_strips;
+
+		unsigned width = 0;
+		for (unsigned s = 0 ; s < num_strips ; s++)
+			if (len[s] > p)
+				width = s + 1;
+
+		unsigned s = 0;
+#ifdef __ARM_NEON__
+		for ( ; !reordered && s + 8 <= width ; s += 8)
+		{
+			uint8x8_t c8[3];
+			for (unsigned c = 0 ; c < 3 ; c++)
+			{
+				uint8_t * const res = &dither->residual[c][base + s];
+				const uint16x8_t sum = vqaddq_u16(
+					vld1q_u16(&dither->value[c][base + s]),
+					vmovl_u8(vld1_u8(res))
+				);
+
+				vst1_u8(res, vmovn_u16(sum));
+				c8[c] = vshrn_n_u16(sum, 8);
+			}
+
+			if (format == LEDSCAPE_FORMAT_APA102)
+			{
+				const uint8x8x4_t rgba = {{
+					c8[0], c8[1], c8[2], vdup_n_u8(0xE0 | brightness)
+				}};
+				vst4_u8((uint8_t*)(out + s), rgba);
+				continue;
+			}
+
+			if (format == LEDSCAPE_FORMAT_RGBW)
+			{
+				const uint8x8_t w = vmin_u8(vmin_u8(c8[0], c8[1]), c8[2]);
+				const uint8x8x4_t wbrg = {{
+					w,
+					vsub_u8(c8[2], w),
+					vsub_u8(c8[0], w),
+					vsub_u8(c8[1], w),
+				}};
+				vst4_u8((uint8_t*)(out + s), wbrg);
+				continue;
+			}
+
+			const uint8x8x4_t brga = {{
+				c8[2], c8[0], c8[1], vdup_n_u8(0)
+			}};
+			vst4_u8((uint8_t*)(out + s), brga);
+		}
+#endif
+		for ( ; s < width ; s++)
+		{
+			const size_t i = base + s;
+			uint8_t rgb[3];
+			for (unsigned c = 0 ; c < 3 ; c++)
+				rgb[c] = dither_channel(dither->value[c][i], &dither->residual[c][i]);
+
+			const uint32_t word = 0
+				| rgb[src[s][0]] << 0
+				| rgb[src[s][1]] << 8
+				| rgb[src[s][2]] << 16;
+			*(uint32_t*)(void*)(out + s) = ledscape_pack(format, brightness, word);
+		}
+	}
+}
@@ -1,48 +1,37 @@
 // \file
- //* WS281x LED strip driver for the BeagleBone Black.
+ //* DMX512 universe driver for the BeagleBone Black.
  //*
- //* Drives up to 32 strips using the PRU hardware.  The ARM writes
- //* rendered frames into shared DDR memory and sets a flag to indicate
- //* how many pixels wide the image is.  The PRU then bit bangs the signal
- //* out the 32 GPIO pins and sets a done flag.
+ //* Sends one DMX512 universe on each strip pin of the PRU, through an
+ //* RS-485 transceiver per pin.  The command structure, the segments
+ //* and the pins are the same as for ws281x_0.p; each pixel row holds
+ //* four slots of every universe, one per byte, so the frame is a
+ //* channel-major DMX buffer that the PRU reads directly.
  //*
  //* To stop, the ARM can write a 0xFF to the command, which will
  //* cause the PRU code to exit.
  //*
- //* At 800 KHz:
- //*  0 is 0.25 usec high, 1 usec low
- //*  1 is 0.60 usec high, 0.65 usec low
- //*  Reset is 50 usec
- //
- // Pins are not contiguous.
- // 16 pins on GPIO0: 2 3 4 5 7 12 13 14 15 20 22 23 26 27 30 31
- // 10 pins on GPIO1: 12 13 14 15 16 17 18 19 28 29
- //  5 pins on GPIO2: 1 2 3 4 5
- //  8 pins on GPIO3: 14 15 16 17 18 19 20 21
- //
- // each pixel is stored in 4 bytes in the order GRBA (4th byte is ignored)
+ //* At 250 kbaud each bit takes 4 usec.  A packet is:
+ //*  break, low for 92 usec
+ //*  mark after break, high for 12 usec
+ //*  the start code 0: a start bit and 8 zero bits, then 2 stop bits
+ //*  the slots: a start bit, 8 data bits LSB first, then 2 stop bits
+ //* after which the line idles high.  With all 512 slots that is
+ //* 22.7 msec, for the full refresh rate of 44 Hz.
  //
  // while len > 0:
-	 // for bit# = 24 down to 0:
-		 // delay 600 ns
-		 // read 16 registers of data, build zero map for gpio0
-		 // read 10 registers of data, build zero map for gpio1
-		 // read  5 registers of data, build zero map for gpio3
-		 //
-		 // Send start pulse on all pins on gpio0, gpio1 and gpio3
-		 // delay 250 ns
-		 // bring zero pins low
-		 // delay 300 ns
-		 // bring all pins low
-	 // increment address by 32
-
- //*
- //* So to clock this out:
- //*  ____
- //* |  | |______|
- //* 0  250 600  1250 offset
- //*    250 350   650 delta
- //* 
+	 // fetch the row into the row cache in PRU DRAM
+	 // for bit# = 0 to 32:
+		 // at the start of each byte, bring the pins low for the start bit
+		 // read 16 registers of the cached row, build zero maps for banks A and B
+		 // read 8 more registers of the cached row, build the rest of the maps
+		 // at the bit time, bring the zero pins low and the one pins high
+		 // at the end of each byte, bring the pins high for the stop bits
+	 // increment address by the row stride
+ //
+ //*                        ||------------- BYTE ------------||
+ //*  BREAK   | MAB | START CODE | START | BIT0 | .... | BIT7 | STOP |
+ //* ________‾‾‾‾‾‾______________________=====================‾‾‾‾‾‾
+ //*    92       12    36    8       4      4      4      4      8
  //*/
 
 
@@ -51,134 +40,84 @@
 
 #include "ws281x.hp"
 
-#define NOP       mov r0, r0
-
 //===============================
 // GPIO Pin Mapping
-
-// Pins in GPIO0
-#define gpio0_bit0 2
-#define gpio0_bit1 3
-//#define gpio0_bit2 4 // BROKEN
-//#define gpio0_bit3 5 // BROKEN
-#define gpio0_bit2 7
-#define gpio0_bit3 8
-#define gpio0_bit4 9
-#define gpio0_bit5 10
-#define gpio0_bit6 11
-#define gpio0_bit7 14
-#define gpio0_bit8 20
-#define gpio0_bit9 22
-#define gpio0_bit10 23
-#define gpio0_bit11 26
-#define gpio0_bit12 27
-#define gpio0_bit13 30
-#define gpio0_bit14 31
-
-// Pins in GPIO1
-#define gpio1_bit0 12
-#define gpio1_bit1 13
-#define gpio1_bit2 14
-#define gpio1_bit3 15
-#define gpio1_bit4 16
-#define gpio1_bit5 17
-#define gpio1_bit6 18
-#define gpio1_bit7 19
-#define gpio1_bit8 28
-#define gpio1_bit9 29
-
-#define GPIO0_LED_MASK (0\
-|(1<<gpio0_bit0)\
-|(1<<gpio0_bit1)\
-|(1<<gpio0_bit2)\
-|(1<<gpio0_bit3)\
-|(1<<gpio0_bit4)\
-|(1<<gpio0_bit5)\
-|(1<<gpio0_bit6)\
-|(1<<gpio0_bit7)\
-|(1<<gpio0_bit8)\
-|(1<<gpio0_bit9)\
-|(1<<gpio0_bit10)\
-|(1<<gpio0_bit11)\
-|(1<<gpio0_bit12)\
-|(1<<gpio0_bit13)\
-|(1<<gpio0_bit14)\
-)
-
-#define GPIO1_LED_MASK (0\
-|(1<<gpio1_bit0)\
-|(1<<gpio1_bit1)\
-|(1<<gpio1_bit2)\
-|(1<<gpio1_bit3)\
-|(1<<gpio1_bit4)\
-|(1<<gpio1_bit5)\
-|(1<<gpio1_bit6)\
-|(1<<gpio1_bit7)\
-|(1<<gpio1_bit8)\
-)
-//|(1<<gpio1_bit9)\
+//
+// The same strips on the same pins as ws281x_0.p, from ws281x.pins.
+#include "ws281x_0_pins.hp"
 
 
+// Times in cycles of the 200 MHz IEP timer
+#define BIT_CYCLES 800 // 4 usec
+#define BREAK_CYCLES 18400 // 92 usec
+#define MAB_CYCLES 2400 // 12 usec
 
 
 /** Register map */
 #define data_addr r0
 #define data_len r1
-#define gpio0_zeros r2
-#define gpio1_zeros r3
-#define gpio2_zeros r4
-#define gpio3_zeros r5
+#define a_zeros r2
+#define b_zeros r3
+#define seg_addr r4
+#define seg_left r5
 #define bit_num r6
-#define sleep_counter r7
+#define deadline r7 // IEP count of the next edge
 #define addr_reg r8
 #define temp_reg r9
+#define row_stride r26
 #define temp2_reg r27
-// r10 - r26 are used for temp storage and bitmap processing
+#define a_mask r28
+#define b_mask r29
+// r10 - r25 are used for temp storage and bitmap processing
 
 
-/** Sleep a given number of nanoseconds with 10 ns resolution.
+/** Wait for the IEP timer to reach the deadline.
  *
- * This busy waits for a given number of cycles.  Not for use
- * with things that must happen on a tight schedule.
+ * The timer runs freely, so the edges are timed from the start of
+ * the packet without drifting, whatever the DDR reads cost.
  */
-.macro SLEEPNS
-.mparam ns,inst,lab
-	MOV sleep_counter, (ns/10)-1-inst
+.macro WAIT_DEADLINE
+.mparam lab
+    MOV r8, IEP | IEP_COUNT
 lab:
-    SUB sleep_counter, sleep_counter, 1
-    QBNE lab, sleep_counter, 0
+    LBBO r9, r8, 0, 4
+    SUB r9, r9, deadline
+    QBBS lab, r9, 31 // still before the deadline
 .endm
 
-
-/** Wait for the cycle counter to reach a given value */
-.macro WAITNS
-.mparam ns,lab
-    MOV r8, 0x22000 // control register
-lab:
-	LBBO r9, r8, 0xC, 4 // read the cycle counter
-//	SUB r9, r9, sleep_counter 
-	MOV r8, ns/5
-	QBGT lab, r9, r8
+/** Move the deadline on by a number of cycles */
+.macro ADD_DEADLINE
+.mparam cycles
+    MOV r9, cycles
+    ADD deadline, deadline, r9
 .endm
 
-/** Reset the cycle counter */
-.macro RESET_COUNTER
-	// Disable the counter and clear it, then re-enable it
-	MOV addr_reg, 0x22000 // control register
-
-	LBBO r9, addr_reg, 0, 4
-	CLR r9, r9, 3 // disable counter bit
-	SBBO r9, addr_reg, 0, 4 // write it back
+/** Bring all the active pins low or high at the deadline, for a time */
+.macro LINE
+.mparam op,cycles,lab
+    MOV r20, GPIO_A | op
+    MOV r21, GPIO_B | op
+    WAIT_DEADLINE lab
+    SBBO a_mask, r20, 0, 4
+#if GPIO_BANKS > 1
+    SBBO b_mask, r21, 0, 4
+#endif
+    ADD_DEADLINE cycles
+.endm
 
-	MOV temp2_reg, 0
-	SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+/** Reset the cycle counter and the stall counter for a new frame */
+.macro RESET_COUNTERS
+		MOV addr_reg, 0x22000 // control register
+		LBBO r9, addr_reg, 0, 4
+		CLR r9, r9, 3 // disable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
 
-	SET r9, r9, 3 // enable counter bit
-	SBBO r9, addr_reg, 0, 4 // write it back
+		MOV temp2_reg, 0
+		SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+		SBBO temp2_reg, addr_reg, 0x10, 4 // and the stall count
 
-	// Read the current counter value
-	// Should be zero.
-	LBBO sleep_counter, addr_reg, 0xC, 4
+		SET r9, r9, 3 // enable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
 .endm
 
 START:
@@ -204,209 +143,187 @@ START:
     MOV		r1, CTPPR_1
     ST32	r0, r1
 
+    // Start the IEP timer, which both PRUs share for the frame
+    // telemetry and which times the DMX bits.  Whichever PRU starts
+    // second rewrites the same configuration, which does not disturb
+    // the count.
+    MOV r0, IEP | IEP_GLOBAL_CFG
+    MOV r1, 0x11 // increment by 1 per cycle, count enable
+    SBBO r1, r0, 0, 4
+
     // Write a 0x1 into the response field so that they know we have started
     MOV r2, #0x1
     SBCO r2, CONST_PRUDRAM, 12, 4
 
-
-	MOV r20, 0xFFFFFFFF
-
     // Wait for the start condition from the main program to indicate
     // that we have a rendered frame ready to clock out.  This also
     // handles the exit case if an invalid value is written to the start
     // start position.
 _LOOP:
+    // Bump the heartbeat that the host's watchdog checks; it keeps
+    // moving while idle here and once per row during a frame.
+    MOV r10, HEARTBEAT
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
     // Load the pointer to the buffer from PRU DRAM into r0 and the
-    // length (in bytes-bit words) into r1.
-    // start command into r2
+    // start command into r2.  The row count is ignored: receivers
+    // expect whole packets, so every row of the segments is sent.
     LBCO      data_addr, CONST_PRUDRAM, 0, 12
 
     // Wait for a non-zero command
     QBEQ _LOOP, r2, #0
 
-    // Reset the sleep timer
-    RESET_COUNTER
+    // Reset the stall count for the telemetry
+    RESET_COUNTERS
 
     // Zero out the start command so that they know we have received it
-    // This allows maximum speed frame drawing since they know that they
-    // can now swap the frame buffer pointer and write a new start command.
     MOV r3, 0
     SBCO r3, CONST_PRUDRAM, 8, 4
 
     // Command of 0xFF is the signal to exit
     QBEQ EXIT, r2, #0xFF
 
-    ////////////////
-    // PREAMBLE
-	
-	// LOW for 220us
-	MOV r22, GPIO0 | GPIO_CLEARDATAOUT
-	MOV r23, GPIO1 | GPIO_CLEARDATAOUT
-	SBBO r20, r22, 0, 4
-	SBBO r21, r23, 0, 4
-	SLEEPNS 220000, 4, wait_preamble_low
-
-	// HIGH for 113us
-	MOV r22, GPIO0 | GPIO_SETDATAOUT
-	MOV r23, GPIO1 | GPIO_SETDATAOUT
-	SBBO r20, r22, 0, 4
-	SBBO r21, r23, 0, 4
-	SLEEPNS 113000, 4, wait_preamble_high1
-
-	///////////////
-	// ZERO FRAME
-
-	// LOW 36us
-	MOV r22, GPIO0 | GPIO_CLEARDATAOUT
-	MOV r23, GPIO1 | GPIO_CLEARDATAOUT
-	SBBO r20, r22, 0, 4
-	SBBO r21, r23, 0, 4
-	SLEEPNS 32000, 4, wait_zeroframe_low //4us happens in the beginning of the loop
-
-	// HIGH for 8us is handled by the first byte
-	RESET_COUNTER
-
-WORD_LOOP: // bit_num=0; do { bit_num++; send_bit(); } while (bit_num < 24)
+    // Time stamp the start of the frame, which is also the time base
+    // of the packet
+    MOV r10, IEP | IEP_COUNT
+    LBBO deadline, r10, 0, 4
+    MOV r10, TELEMETRY
+    SBBO deadline, r10, 4, 4
+
+    LBCO seg_left, CONST_PRUDRAM, 16, 4
+    MOV seg_addr, SEGMENTS
+    QBEQ FRAME_DONE, seg_left, #0
+
+    // Break, mark after break and the start code on the pins of the
+    // first segment, which has all of the universes
+    LBCO a_mask, CONST_PRUDRAM, SEGMENTS+8, 8
+    LINE GPIO_CLEARDATAOUT, BREAK_CYCLES, break_wait
+    LINE GPIO_SETDATAOUT, MAB_CYCLES, mab_wait
+    LINE GPIO_CLEARDATAOUT, 9*BIT_CYCLES, start_code_wait
+    LINE GPIO_SETDATAOUT, 2*BIT_CYCLES, start_code_stop_wait
+
+SEG_LOOP:
+    // Load the row stride, the row count (into temp2) and the active
+    // pin masks.
+    LBCO row_stride, CONST_PRUDRAM, seg_addr, 16
+    MOV data_len, temp2_reg
+    ADD seg_addr, seg_addr, 16
+
+WORD_LOOP:
+	// Fetch the row into the row cache in PRU DRAM, so that the DDR
+	// is read once per row rather than on every bit
+	MOV addr_reg, ROW_CACHE
+	LBBO r10, data_addr, 0, 16*4
+	SBBO r10, addr_reg, 0, 16*4
+	LBBO r10, data_addr, 16*4, 8*4
+	SBBO r10, addr_reg, 16*4, 8*4
+
+	// for bit in 0 to 32, the four slots of the row LSB first
 	MOV bit_num, 0
 
 	BIT_LOOP:
-		/** Macro to generate the mask of which bits are zero.
-		 * For each of these registers, set the
-		 * corresponding bit in the gpio0_zeros register if
-		 * the current bit is set in the strided register.
-		 */
-		#define TEST_BIT(regN,gpioN,bitN) \
-			QBBS gpioN##_##regN##_skip, regN, bit_num; \
-			SET gpioN##_zeros, gpioN##_zeros, gpioN##_##bitN ; \
-			gpioN##_##regN##_skip: ; \
-
-		//////////////////////////
-		// LOAD/BUILD DATA MASK
-		// Load 16 registers of data, starting at r10
-		LBBO r10, r0, 0, 16*4
-		MOV gpio0_zeros, 0
-
-		TEST_BIT(r10, gpio0, bit0)
-		TEST_BIT(r11, gpio0, bit1)
-		TEST_BIT(r12, gpio0, bit2)
-		TEST_BIT(r13, gpio0, bit3)
-		TEST_BIT(r14, gpio0, bit4)
-		TEST_BIT(r15, gpio0, bit5)
-		TEST_BIT(r16, gpio0, bit6)
-		TEST_BIT(r17, gpio0, bit7)
-		TEST_BIT(r18, gpio0, bit8)
-		TEST_BIT(r19, gpio0, bit9)
-		TEST_BIT(r20, gpio0, bit10)
-		TEST_BIT(r21, gpio0, bit11)
-		TEST_BIT(r22, gpio0, bit12)
-		TEST_BIT(r23, gpio0, bit13)
-		TEST_BIT(r24, gpio0, bit14)
-
-		MOV gpio1_zeros, 0
-		TEST_BIT(r25, gpio1, bit0)
-
-		// Load 8 more registers of data
-		LBBO r10, r0, 16*4, 8*4
-
-		TEST_BIT(r10, gpio1, bit1)
-		TEST_BIT(r11, gpio1, bit2)
-		TEST_BIT(r12, gpio1, bit3)
-		TEST_BIT(r13, gpio1, bit4)
-		TEST_BIT(r14, gpio1, bit5)
-		TEST_BIT(r15, gpio1, bit6)
-		TEST_BIT(r16, gpio1, bit7)
-		TEST_BIT(r17, gpio1, bit8)
-		// DATA MASK CREATED
-		//////////////////////////
-
-		// Load the address(es) of the GPIO devices
-		MOV r20, GPIO0_LED_MASK
-		MOV r21, GPIO1_LED_MASK
-
-		//WAITNS 4000, wait_lastframe_end // Wait for last bit to finish
-		SLEEPNS 2760, 0, wait_lastframe_end
-
-		//////////////////////////
-		// POTENTIAL STOP BIT
-		// Stop bits happen after bits 0, 8, 16
+		// Start bit at the start of each slot
 		AND r22, bit_num, 7
-		QBNE skip_stop_bits, r22, 0
-			// HIGH (all)
-			MOV r22, GPIO0 | GPIO_SETDATAOUT
-			MOV r23, GPIO1 | GPIO_SETDATAOUT
-			SBBO r20, r22, 0, 4
-			SBBO r21, r23, 0, 4
-
-			// Wait for 8us
-			SLEEPNS 8000, 4, wait_stop_bit
-
-			// LOW (all) leading 0
-			MOV r22, GPIO0 | GPIO_CLEARDATAOUT
-			MOV r23, GPIO1 | GPIO_CLEARDATAOUT
-			SBBO r20, r22, 0, 4
-			SBBO r21, r23, 0, 4
-
-			// Wait for 4us
-			SLEEPNS 3600, 4, wait_stop_zero
-
-			RESET_COUNTER
-
-		skip_stop_bits:
-
-		// FRAME END
-		//////////////////////////
+		QBNE data_bit, r22, 0
+		LINE GPIO_CLEARDATAOUT, BIT_CYCLES, start_bit_wait
 
+	data_bit:
+		/** Macro to generate the mask of which bits are zero,
+		 * as in ws281x_0.p.
+		 */
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_skip: ; \
+
+		// Load 16 registers of data from the row cache, starting at r10
+		MOV temp_reg, ROW_CACHE
+		LBBO r10, temp_reg, 0, 16*4
+		MOV a_zeros, 0
+		MOV b_zeros, 0
+		TEST_BITS_EARLY
 
-		//////////////////////////
-		// FRAME START
+		// Load 8 more registers of data
+		LBBO r10, temp_reg, 16*4, 8*4
+		TEST_BITS_LATE
+
+		// Only the active pins are driven
+		AND a_zeros, a_zeros, a_mask
+		AND b_zeros, b_zeros, b_mask
+		XOR r18, a_zeros, a_mask
+		XOR r19, b_zeros, b_mask
+
+		MOV r20, GPIO_A | GPIO_CLEARDATAOUT
+		MOV r21, GPIO_B | GPIO_CLEARDATAOUT
+		MOV r22, GPIO_A | GPIO_SETDATAOUT
+		MOV r23, GPIO_B | GPIO_SETDATAOUT
+
+		WAIT_DEADLINE data_bit_wait
+		SBBO a_zeros, r20, 0, 4
+#if GPIO_BANKS > 1
+		SBBO b_zeros, r21, 0, 4
+#endif
+		SBBO r18, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r19, r23, 0, 4
+#endif
+		ADD_DEADLINE BIT_CYCLES
 
+		// Stop bits at the end of each slot
 		ADD bit_num, bit_num, 1
-
-		// Start of the next timing frame
-		RESET_COUNTER
-
-		// LOW (0s only): 
-		MOV r22, GPIO0 | GPIO_CLEARDATAOUT
-		MOV r23, GPIO1 | GPIO_CLEARDATAOUT
-		SBBO gpio0_zeros, r22, 0, 4
-		SBBO gpio1_zeros, r23, 0, 4
-
-		NOT gpio0_zeros, gpio0_zeros
-		NOT gpio1_zeros, gpio1_zeros
-
-		// HIGH (1s only): 
-		MOV r22, GPIO0 | GPIO_SETDATAOUT
-		MOV r23, GPIO1 | GPIO_SETDATAOUT
-		SBBO gpio0_zeros, r22, 0, 4
-		SBBO gpio1_zeros, r23, 0, 4
-
-		// The bits finish in the next iteration
-		QBNE BIT_LOOP, bit_num, 24
-
-	// Move to the next pixel on each row
-	ADD data_addr, data_addr, 48 * 4
+		AND r22, bit_num, 7
+		QBNE BIT_LOOP, r22, 0
+		LINE GPIO_SETDATAOUT, 2*BIT_CYCLES, stop_bits_wait
+
+		QBNE BIT_LOOP, bit_num, 32
+
+	// The four slots have been sent
+	// Move to the next row
+	ADD data_addr, data_addr, row_stride
+	MOV r10, HEARTBEAT
+	LBBO r11, r10, 0, 4
+	ADD r11, r11, 1
+	SBBO r11, r10, 0, 4
 	SUB data_len, data_len, 1
 	QBNE WORD_LOOP, data_len, #0
 
-	// Write the trailing high (and leave the line high)
-	MOV r20, GPIO0_LED_MASK
-	MOV r21, GPIO1_LED_MASK
-
-	// HIGH for about 2ms
-	MOV r22, GPIO0 | GPIO_SETDATAOUT
-	MOV r23, GPIO1 | GPIO_SETDATAOUT
-	SBBO r20, r22, 0, 4
-	SBBO r21, r23, 0, 4
-	SLEEPNS 2104800, 4, wait_end_high
+	// The pins of universes that end here idle high after their
+	// stop bits
+	SUB seg_left, seg_left, 1
+	QBNE SEG_LOOP, seg_left, #0
+
+	// Let the last stop bits run out
+	WAIT_DEADLINE last_stop_wait
+
+FRAME_DONE:
+    // Finish the telemetry with the end time stamp and the cycles
+    // stalled on the DDR during the frame, then count the frame.
+    MOV r10, IEP | IEP_COUNT
+    LBBO r12, r10, 0, 4
+    MOV r10, 0x22000 // control register
+    LBBO r13, r10, 0x10, 4
+    MOV r10, TELEMETRY
+    SBBO r12, r10, 8, 8
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
 
     // Write out that we are done!
-    // Store a non-zero response in the buffer so that they know that we are done
-    // aso a quick hack, we write the counter so that we know how
-    // long it took to write out.
     MOV r8, 0x22000 // control register
     LBBO r2, r8, 0xC, 4
     SBCO r2, CONST_PRUDRAM, 12, 4
 
+    // Wake up the ARM, which sleeps on this event rather than polling
+    // the response.  Both PRUs raise the same event so that the ARM
+    // only has to watch one uio device; it checks both responses.
+#ifdef AM33XX
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
     // Go back to waiting for the next frame buffer
     QBA _LOOP
 
@@ -0,0 +1,342 @@
+// \file
+ //* DMX512 universe driver for the BeagleBone Black.
+ //*
+ //* Sends one DMX512 universe on each strip pin of the PRU, through an
+ //* RS-485 transceiver per pin.  The command structure, the segments
+ //* and the pins are the same as for ws281x_1.p; each pixel row holds
+ //* four slots of every universe, one per byte, so the frame is a
+ //* channel-major DMX buffer that the PRU reads directly.
+ //*
+ //* To stop, the ARM can write a 0xFF to the command, which will
+ //* cause the PRU code to exit.
+ //*
+ //* At 250 kbaud each bit takes 4 usec.  A packet is:
+ //*  break, low for 92 usec
+ //*  mark after break, high for 12 usec
+ //*  the start code 0: a start bit and 8 zero bits, then 2 stop bits
+ //*  the slots: a start bit, 8 data bits LSB first, then 2 stop bits
+ //* after which the line idles high.  With all 512 slots that is
+ //* 22.7 msec, for the full refresh rate of 44 Hz.
+ //
+ // while len > 0:
+	 // fetch the row into the row cache in PRU DRAM
+	 // for bit# = 0 to 32:
+		 // at the start of each byte, bring the pins low for the start bit
+		 // read 16 registers of the cached row, build zero maps for banks A and B
+		 // read 8 more registers of the cached row, build the rest of the maps
+		 // at the bit time, bring the zero pins low and the one pins high
+		 // at the end of each byte, bring the pins high for the stop bits
+	 // increment address by the row stride
+ //
+ //*                        ||------------- BYTE ------------||
+ //*  BREAK   | MAB | START CODE | START | BIT0 | .... | BIT7 | STOP |
+ //* ________‾‾‾‾‾‾______________________=====================‾‾‾‾‾‾
+ //*    92       12    36    8       4      4      4      4      8
+ //*/
+
+
+.origin 0
+.entrypoint START
+
+#include "ws281x.hp"
+
+//===============================
+// GPIO Pin Mapping
+//
+// The same strips on the same pins as ws281x_1.p, from ws281x.pins.
+#include "ws281x_1_pins.hp"
+
+
+// Times in cycles of the 200 MHz IEP timer
+#define BIT_CYCLES 800 // 4 usec
+#define BREAK_CYCLES 18400 // 92 usec
+#define MAB_CYCLES 2400 // 12 usec
+
+
+/** Register map */
+#define data_addr r0
+#define data_len r1
+#define a_zeros r2
+#define b_zeros r3
+#define seg_addr r4
+#define seg_left r5
+#define bit_num r6
+#define deadline r7 // IEP count of the next edge
+#define addr_reg r8
+#define temp_reg r9
+#define row_stride r26
+#define temp2_reg r27
+#define a_mask r28
+#define b_mask r29
+// r10 - r25 are used for temp storage and bitmap processing
+
+
+/** Wait for the IEP timer to reach the deadline.
+ *
+ * The timer runs freely, so the edges are timed from the start of
+ * the packet without drifting, whatever the DDR reads cost.
+ */
+.macro WAIT_DEADLINE
+.mparam lab
+    MOV r8, IEP | IEP_COUNT
+lab:
+    LBBO r9, r8, 0, 4
+    SUB r9, r9, deadline
+    QBBS lab, r9, 31 // still before the deadline
+.endm
+
+/** Move the deadline on by a number of cycles */
+.macro ADD_DEADLINE
+.mparam cycles
+    MOV r9, cycles
+    ADD deadline, deadline, r9
+.endm
+
+/** Bring all the active pins low or high at the deadline, for a time */
+.macro LINE
+.mparam op,cycles,lab
+    MOV r20, GPIO_A | op
+    MOV r21, GPIO_B | op
+    WAIT_DEADLINE lab
+    SBBO a_mask, r20, 0, 4
+#if GPIO_BANKS > 1
+    SBBO b_mask, r21, 0, 4
+#endif
+    ADD_DEADLINE cycles
+.endm
+
+/** Reset the cycle counter and the stall counter for a new frame */
+.macro RESET_COUNTERS
+		MOV addr_reg, 0x24000 // control register
+		LBBO r9, addr_reg, 0, 4
+		CLR r9, r9, 3 // disable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+
+		MOV temp2_reg, 0
+		SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+		SBBO temp2_reg, addr_reg, 0x10, 4 // and the stall count
+
+		SET r9, r9, 3 // enable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+.endm
+
+START:
+    // Enable OCP master port
+    // clear the STANDBY_INIT bit in the SYSCFG register,
+    // otherwise the PRU will not be able to write outside the
+    // PRU memory space and to the BeagleBon's pins.
+    LBCO	r0, C4, 4, 4
+    CLR		r0, r0, 4
+    SBCO	r0, C4, 4, 4
+
+    // Configure the programmable pointer register for PRU0 by setting
+    // c28_pointer[15:0] field to 0x0120.  This will make C28 point to
+    // 0x00012000 (PRU shared RAM).
+    MOV		r0, 0x00000120
+    MOV		r1, CTPPR_0
+    ST32	r0, r1
+
+    // Configure the programmable pointer register for PRU0 by setting
+    // c31_pointer[15:0] field to 0x0010.  This will make C31 point to
+    // 0x80001000 (DDR memory).
+    MOV		r0, 0x00100000
+    MOV		r1, CTPPR_1
+    ST32	r0, r1
+
+    // Start the IEP timer, which both PRUs share for the frame
+    // telemetry and which times the DMX bits.  Whichever PRU starts
+    // second rewrites the same configuration, which does not disturb
+    // the count.
+    MOV r0, IEP | IEP_GLOBAL_CFG
+    MOV r1, 0x11 // increment by 1 per cycle, count enable
+    SBBO r1, r0, 0, 4
+
+    // Write a 0x1 into the response field so that they know we have started
+    MOV r2, #0x1
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+    // Wait for the start condition from the main program to indicate
+    // that we have a rendered frame ready to clock out.  This also
+    // handles the exit case if an invalid value is written to the start
+    // start position.
+_LOOP:
+    // Bump the heartbeat that the host's watchdog checks; it keeps
+    // moving while idle here and once per row during a frame.
+    MOV r10, HEARTBEAT
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
+    // Load the pointer to the buffer from PRU DRAM into r0 and the
+    // start command into r2.  The row count is ignored: receivers
+    // expect whole packets, so every row of the segments is sent.
+    LBCO      data_addr, CONST_PRUDRAM, 0, 12
+
+    // Wait for a non-zero command
+    QBEQ _LOOP, r2, #0
+
+    // Reset the stall count for the telemetry
+    RESET_COUNTERS
+
+    // Zero out the start command so that they know we have received it
+    MOV r3, 0
+    SBCO r3, CONST_PRUDRAM, 8, 4
+
+    // Command of 0xFF is the signal to exit
+    QBEQ EXIT, r2, #0xFF
+
+    // Time stamp the start of the frame, which is also the time base
+    // of the packet
+    MOV r10, IEP | IEP_COUNT
+    LBBO deadline, r10, 0, 4
+    MOV r10, TELEMETRY
+    SBBO deadline, r10, 4, 4
+
+    LBCO seg_left, CONST_PRUDRAM, 16, 4
+    MOV seg_addr, SEGMENTS
+    QBEQ FRAME_DONE, seg_left, #0
+
+    // Break, mark after break and the start code on the pins of the
+    // first segment, which has all of the universes
+    LBCO a_mask, CONST_PRUDRAM, SEGMENTS+8, 8
+    LINE GPIO_CLEARDATAOUT, BREAK_CYCLES, break_wait
+    LINE GPIO_SETDATAOUT, MAB_CYCLES, mab_wait
+    LINE GPIO_CLEARDATAOUT, 9*BIT_CYCLES, start_code_wait
+    LINE GPIO_SETDATAOUT, 2*BIT_CYCLES, start_code_stop_wait
+
+SEG_LOOP:
+    // Load the row stride, the row count (into temp2) and the active
+    // pin masks.
+    LBCO row_stride, CONST_PRUDRAM, seg_addr, 16
+    MOV data_len, temp2_reg
+    ADD seg_addr, seg_addr, 16
+
+WORD_LOOP:
+	// Fetch the row into the row cache in PRU DRAM, so that the DDR
+	// is read once per row rather than on every bit
+	MOV addr_reg, ROW_CACHE
+	LBBO r10, data_addr, 0, 16*4
+	SBBO r10, addr_reg, 0, 16*4
+	LBBO r10, data_addr, 16*4, 8*4
+	SBBO r10, addr_reg, 16*4, 8*4
+
+	// for bit in 0 to 32, the four slots of the row LSB first
+	MOV bit_num, 0
+
+	BIT_LOOP:
+		// Start bit at the start of each slot
+		AND r22, bit_num, 7
+		QBNE data_bit, r22, 0
+		LINE GPIO_CLEARDATAOUT, BIT_CYCLES, start_bit_wait
+
+	data_bit:
+		/** Macro to generate the mask of which bits are zero,
+		 * as in ws281x_1.p.
+		 */
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_skip: ; \
+
+		// Load 16 registers of data from the row cache, starting at r10
+		MOV temp_reg, ROW_CACHE
+		LBBO r10, temp_reg, 0, 16*4
+		MOV a_zeros, 0
+		MOV b_zeros, 0
+		TEST_BITS_EARLY
+
+		// Load 8 more registers of data
+		LBBO r10, temp_reg, 16*4, 8*4
+		TEST_BITS_LATE
+
+		// Only the active pins are driven
+		AND a_zeros, a_zeros, a_mask
+		AND b_zeros, b_zeros, b_mask
+		XOR r18, a_zeros, a_mask
+		XOR r19, b_zeros, b_mask
+
+		MOV r20, GPIO_A | GPIO_CLEARDATAOUT
+		MOV r21, GPIO_B | GPIO_CLEARDATAOUT
+		MOV r22, GPIO_A | GPIO_SETDATAOUT
+		MOV r23, GPIO_B | GPIO_SETDATAOUT
+
+		WAIT_DEADLINE data_bit_wait
+		SBBO a_zeros, r20, 0, 4
+#if GPIO_BANKS > 1
+		SBBO b_zeros, r21, 0, 4
+#endif
+		SBBO r18, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r19, r23, 0, 4
+#endif
+		ADD_DEADLINE BIT_CYCLES
+
+		// Stop bits at the end of each slot
+		ADD bit_num, bit_num, 1
+		AND r22, bit_num, 7
+		QBNE BIT_LOOP, r22, 0
+		LINE GPIO_SETDATAOUT, 2*BIT_CYCLES, stop_bits_wait
+
+		QBNE BIT_LOOP, bit_num, 32
+
+	// The four slots have been sent
+	// Move to the next row
+	ADD data_addr, data_addr, row_stride
+	MOV r10, HEARTBEAT
+	LBBO r11, r10, 0, 4
+	ADD r11, r11, 1
+	SBBO r11, r10, 0, 4
+	SUB data_len, data_len, 1
+	QBNE WORD_LOOP, data_len, #0
+
+	// The pins of universes that end here idle high after their
+	// stop bits
+	SUB seg_left, seg_left, 1
+	QBNE SEG_LOOP, seg_left, #0
+
+	// Let the last stop bits run out
+	WAIT_DEADLINE last_stop_wait
+
+FRAME_DONE:
+    // Finish the telemetry with the end time stamp and the cycles
+    // stalled on the DDR during the frame, then count the frame.
+    MOV r10, IEP | IEP_COUNT
+    LBBO r12, r10, 0, 4
+    MOV r10, 0x24000 // control register
+    LBBO r13, r10, 0x10, 4
+    MOV r10, TELEMETRY
+    SBBO r12, r10, 8, 8
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
+    // Write out that we are done!
+    MOV r8, 0x24000 // control register
+    LBBO r2, r8, 0xC, 4
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+    // Wake up the ARM, which sleeps on this event rather than polling
+    // the response.  Both PRUs raise the same event so that the ARM
+    // only has to watch one uio device; it checks both responses.
+#ifdef AM33XX
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
+    // Go back to waiting for the next frame buffer
+    QBA _LOOP
+
+EXIT:
+    // Write a 0xFF into the response field so that they know we're done
+    MOV r2, #0xFF
+    SBCO r2, CONST_PRUDRAM, 12, 4
+
+#ifdef AM33XX
+    // Send notification to Host for program completion
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
+    HALT
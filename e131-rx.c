@@ -33,6 +33,10 @@ main(
 	int port = 5568;
 	int led_count = 64;
 	int frame_rate = 30;
+	int rgbw = 0;
+	int apa102 = 0;
+	unsigned brightness = 0;
+	const ledscape_timing_t * timing = NULL;
 
 	extern char *optarg;
 	int opt;
@@ -43,7 +47,7 @@ main(
 
 	fprintf(stderr, "E1.31 LEDScape Receiver\n\n");
 	
-	while ((opt = getopt(argc, argv, "p:c:d:w:r:f:t:")) != -1)
+	while ((opt = getopt(argc, argv, "p:c:d:w:r:f:t:WAB:T:")) != -1)
 	{
 		switch (opt)
 		{
@@ -85,8 +89,24 @@ main(
 			lampTest = atoi(optarg);
 			break;
 
+		case 'W':
+			rgbw = 1;
+			break;
+		case 'A':
+			apa102 = 1;
+			break;
+		case 'B':
+			brightness = atoi(optarg);
+			if (brightness < 1 || brightness > 31)
+				die("-B must be 1 to 31\n");
+			break;
+		case 'T':
+			timing = ledscape_timing(optarg);
+			if (!timing)
+				die("-T %s is not a timing profile\n", optarg);
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>] [-w <output file>] [-r <input file> [-f <frame rate>]] [-t <lamp test 0-255>]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>] [-w <output file>] [-r <input file> [-f <frame rate>]] [-t <lamp test 0-255>] [-W(RGBW strips)] [-A(PA102 strips) [-B <brightness 1-31>]] [-T <timing profile>]\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -116,7 +136,16 @@ main(
 	if (sizeof(buf) < image_size + 1)
 		die("%u too large for UDP\n", image_size);
 
-	ledscape_t * const leds = ledscape_init(led_count);
+	// Only clock out what changed since the last packet
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= led_count,
+		.num_strips	= LEDSCAPE_NUM_STRIPS,
+		.change_aware	= 1,
+		.rgbw		= rgbw,
+		.apa102		= apa102,
+		.brightness	= brightness,
+		.timing		= timing,
+	});
 
 	struct timeval t;
 	gettimeofday(&t, NULL);
@@ -129,9 +158,9 @@ main(
 
 	// initial value (perhaps lamp test was specified)
 	memset(frame, lampTest, led_count * LEDSCAPE_NUM_STRIPS * 4);
-	//ledscape_set_color(frame, 0, 0, 255, 0, 0);
-	//ledscape_set_color(frame, 1, 0, 0, 255, 0);
-	//ledscape_set_color(frame, 2, 0, 0, 0, 255);
+	//ledscape_set_color(leds, frame, 0, 0, 255, 0, 0);
+	//ledscape_set_color(leds, frame, 1, 0, 0, 255, 0);
+	//ledscape_set_color(leds, frame, 2, 0, 0, 0, 255);
 	ledscape_draw(leds, 0);
 	if (fromfile)
 		printf("Playing\n");
@@ -164,11 +193,7 @@ main(
 				
 //printf("Ch %d: %db\n", cmd.channel, cmd_len);
 			uint8_t* data = buf+126;
-			for (unsigned int i=0; i<data_len; i++) {
-				const uint8_t * const in = &data[3 * i];
-			        ledscape_set_color(frame, universe + i / led_count, i % led_count, 
-							in[0], in[1], in[2]);
- 			}
+			ledscape_blit_strips(leds, frame, universe, data, data_len / 3);
 
 			ledscape_draw(leds, 0);
 
@@ -10,8 +10,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include "ledscape.h"
+#include "util.h"
 
 static void ledscape_fill_color(
+  ledscape_t * const leds,
   ledscape_frame_t * const frame,
   const unsigned num_pixels,
   const uint8_t r,
@@ -21,77 +23,77 @@ static void ledscape_fill_color(
 {
   for (unsigned i = 0 ; i < num_pixels ; i++)
     for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
-      ledscape_set_color(frame, strip, i, r, g, b);
+      ledscape_set_color(leds, frame, strip, i, r, g, b);
 }
 
- int lumCorrection[] = {
-    0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,2,2,2,2,2,2,2,2,3,3,3,3,3,
-    4,4,4,4,4,5,5,5,5,5,6,6,6,7,7,7,7,8,8,8,9,9,9,10,10,10,11,11,12,12,12,13,13,14,14,14,15,15,
-    16,16,17,17,18,18,19,19,20,20,21,21,22,23,23,24,24,25,26,26,27,28,28,29,30,30,31,32,32,33,
-    34,35,35,36,37,38,39,39,40,41,42,43,44,44,45,46,47,48,49,50,51,52,53,54,55,56,57,58,59,60,
-    61,62,63,64,65,66,67,68,70,71,72,73,74,75,77,78,79,80,82,83,84,85,87,89,91,92,93,95,96,98,
-    99,100,101,102,105,106,108,109,111,112,114,115,117,118,120,121,123,125,126,128,130,131,133,
-    135,136,138,140,142,143,145,147,149,151,152,154,156,158,160,162,164,165,167,169,171,173,175,
-    177,179,181,183,185,187,190,192,194,196,198,200,202,204,207,209,211,213,216,218,220,222,225,
-    227,229,232,234,236,239,241,244,246,249,251,253,254,255
-};
+typedef struct {
+  ledscape_dither_t * dither;
+  unsigned num_pixels;
+  uint64_t start_ns;
+} fade_t;
+
+/** Slowly ramp the red channel up and down.
+ *
+ * The ramp is squared for a roughly perceptual response, so most
+ * of it is spent at the bottom, well below one 8 bit step; the
+ * dither carries the fraction between frames.
+ */
+static void render(
+  ledscape_t * const leds,
+  ledscape_frame_t * const frame,
+  const uint64_t now_ns,
+  const uint64_t dt_ns,
+  void * const arg
+)
+{
+  (void) leds; (void) dt_ns;
+  fade_t * const fade = arg;
+
+  // 4 seconds up, 4 seconds down
+  const uint64_t period_ns = 8000000000ULL;
+  const uint64_t t = (now_ns - fade->start_ns) % period_ns;
+  const uint32_t ramp = t < period_ns / 2
+    ? t * 65535 / (period_ns / 2)
+    : (period_ns - t) * 65535 / (period_ns / 2);
+  const uint16_t level = ramp * ramp / 65535;
+
+  for (unsigned strip = 0 ; strip < 32 ; strip++)
+    for (unsigned p = 0 ; p < fade->num_pixels ; p++)
+      ledscape_dither_set(fade->dither, strip, p, level, 0, 0);
+
+  ledscape_dither_render(fade->dither, frame);
+}
 
 int main (void)
 {
-  const int num_pixels = 128;
-  ledscape_t * const leds = ledscape_init(num_pixels);
-  time_t last_time = time(NULL);
-  unsigned last_i = 0;
+  fade_t fade = {
+    .num_pixels = 128,
+  };
 
-  uint8_t rgb[3];
+  ledscape_t * const leds = ledscape_init(fade.num_pixels, LEDSCAPE_NUM_STRIPS);
+  fade.dither = ledscape_dither_init(leds);
+  fade.start_ns = monotonic_ns();
 
-  unsigned i = 0;
-  while (1)
-  {
-    // Alternate frame buffers on each draw command
-    const unsigned frame_num = i++ % 2;
-    ledscape_frame_t * const frame
-      = ledscape_frame(leds, frame_num);
-
-    uint8_t val = i >> 1;
-    uint16_t r = ((i >>  0) & 0xFF);
-    uint16_t g = ((i >>  8) & 0xFF);
-    uint16_t b = ((i >> 16) & 0xFF);
-
-    for (unsigned strip = 0 ; strip < 32 ; strip++)
-    {
-      for (unsigned p = 0 ; p < num_pixels; p++)
-      {
-        int bInput = i % 256,
-            bOutput = lumCorrection[bInput / 4];
-
-        if (p < 64 && bInput%2 == 0) {
-           bOutput ++;
-        }
-
-        ledscape_set_color(
-          frame, strip, p,
-          bOutput, 0, 0
-        );
-        //ledscape_set_color(frame, strip, 3*p+1, 0, p+val + 80, 0);
-        //ledscape_set_color(frame, strip, 3*p+2, 0, 0, p+val + 160);
-      }
-    }
+  // fps 0: dither at the full PRU frame rate
+  ledscape_pacer_t * const pacer
+    = ledscape_pacer_start(leds, 0, render, &fade);
 
-    // wait for the previous frame to finish;
-    const uint32_t response = ledscape_wait(leds);
-    time_t now = time(NULL);
-    if (now != last_time)
-    {
-      printf("%d fps. starting %d previous %"PRIx32"\n",
-        i - last_i, i, response);
-      last_i = i;
-      last_time = now;
-    }
+  uint64_t last_frames = 0;
 
-    ledscape_draw(leds, frame_num);
+  while (1)
+  {
+    sleep(1);
+
+    ledscape_pacer_stats_t stats;
+    ledscape_pacer_stats(pacer, &stats);
+    printf("%"PRIu64" fps, max frame %"PRIu64" us\n",
+      stats.frames - last_frames,
+      stats.max_frame_ns / 1000);
+    last_frames = stats.frames;
   }
 
+  ledscape_pacer_stop(pacer);
+  ledscape_dither_close(fade.dither);
   ledscape_close(leds);
 
   return EXIT_SUCCESS;
@@ -165,45 +165,47 @@ init_pallete(void)
 }
 
 
+static void
+render(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const uint64_t now_ns,
+	const uint64_t dt_ns,
+	void * const arg
+)
+{
+	(void) leds; (void) now_ns; (void) dt_ns; (void) arg;
+	draw((void*) frame);
+}
+
+
 int
 main(void)
 {
 	const int num_pixels = 256;
-	ledscape_t * const leds = ledscape_init(num_pixels);
+	ledscape_t * const leds = ledscape_init(num_pixels, LEDSCAPE_NUM_STRIPS);
 	printf("init done\n");
-	time_t last_time = time(NULL);
-	unsigned last_i = 0;
-
-	unsigned i = 0;
 	init_pallete();
 
+	ledscape_pacer_t * const pacer
+		= ledscape_pacer_start(leds, 33, render, NULL);
+
+	uint64_t last_frames = 0;
+
 	while (1)
 	{
-		// Alternate frame buffers on each draw command
-		const unsigned frame_num = i++ % 2;
-		ledscape_frame_t * const frame
-			= ledscape_frame(leds, frame_num);
-
-		uint32_t * const p = (void*) frame;
-
-		draw(p);
-		ledscape_draw(leds, frame_num);
-		usleep(30000);
-
-		// wait for the previous frame to finish;
-		//const uint32_t response = ledscape_wait(leds);
-		const uint32_t response = 0;
-		time_t now = time(NULL);
-		if (now != last_time)
-		{
-			printf("%d fps. starting %d previous %"PRIx32"\n",
-				i - last_i, i, response);
-			last_i = i;
-			last_time = now;
-		}
-
+		sleep(1);
+
+		ledscape_pacer_stats_t stats;
+		ledscape_pacer_stats(pacer, &stats);
+		printf("%"PRIu64" fps. %"PRIu64" missed, worst %"PRIu64" us\n",
+			stats.frames - last_frames,
+			stats.missed,
+			stats.max_frame_ns / 1000);
+		last_frames = stats.frames;
 	}
 
+	ledscape_pacer_stop(pacer);
 	ledscape_close(leds);
 
 	return EXIT_SUCCESS;
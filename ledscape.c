@@ -9,41 +9,124 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <unistd.h>
+#include <math.h>
+#include <pthread.h>
 #include "ledscape.h"
 #include "pru.h"
 
+// The PRU programs, assembled into C arrays by the Makefile
+#include "ws281x_0_bin.h"
+#include "ws281x_1_bin.h"
+#include "apa102_0_bin.h"
+#include "apa102_1_bin.h"
+#include "dmx_0_bin.h"
+#include "dmx_1_bin.h"
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
 
-/** GPIO pins used by the LEDscape.
+
+/** GPIO pins used by the LEDscape, in strip order.
  *
  * The device tree should handle this configuration for us, but it
  * seems horribly broken and won't configure these pins as outputs.
- * So instead we have to repeat them here as well.
- *
- * If these are changed, be sure to check the mappings in
- * ws281x.p!
+ * So instead the pins are listed in ws281x.pins, from which
+ * pinmap.pl generates strip_pins[] and pru_banks[] along with the
+ * pin tests in ws281x_0.p and ws281x_1.p.  Strips 0-23 are clocked
+ * out by PRU0 on its banks A and B, strips 24-47 by PRU1.  The APA102
+ * programs use the same pins, but clock each bank on its clock pin,
+ * and the DMX programs send a universe on each of them.
  *
  * See https://github.com/ehayon/BeagleBone-GPIO/blob/master/src/am335x.h
  * for a complete list of pins.
+ */
+#include "ws281x_pins.h"
+
+/** Number of strips clocked out by each PRU. */
+#define STRIPS_PER_PRU (LEDSCAPE_NUM_STRIPS / 2)
+
+/** A PRU whose heartbeat has not moved for this long is stuck. */
+#define WATCHDOG_MS 100
+
+/** How long a freshly loaded program has to report in. */
+#define PRU_START_MS 100
+
+/** Bit time of the APA102 programs without a floor on the period,
+ * rounded up from the loop for the frame timeout.
+ */
+#define APA102_BIT_NS 1000
+
+/** DMX512 packet times of the DMX programs: a slot is a start bit,
+ * 8 data bits and 2 stop bits at 4 us, and the header is the break,
+ * the mark after break and the start code.
+ */
+#define DMX_SLOT_NS 44000
+#define DMX_HEADER_NS (92000 + 12000 + DMX_SLOT_NS)
+
+/** Bit planes of a row for one PRU: the zero masks of banks A and B
+ * for each of up to 32 bits, in bit order.  The rows of both PRUs are
+ * interleaved so that a plane buffer has the segments' row layout.
+ */
+#define PLANE_PRU_BYTES (32 * 2 * sizeof(uint32_t))
+#define PLANE_ROW_BYTES (2 * PLANE_PRU_BYTES)
+
+
+/** Run of pixel rows that drive the same set of strips.
  *
- * TODO: Find a way to unify this with the defines in the .p file
+ * Strips drop out of the frame as they run out of pixels, so the
+ * rows are only as wide as the highest strip still active and the
+ * PRU only raises the pins of strips that have data left.
  */
-static const uint8_t gpios0[] = {
-	2, 3, 7, 8, 9, 10, 11, 14, 20, 22, 23, 26, 27, 30, 31
-};
+typedef struct
+{
+	// Bytes from one pixel row to the next
+	unsigned stride;
 
-static const uint8_t gpios1[] = {
-	12, 13, 14, 15, 16, 17, 18, 19, 28, 29
-};
+	// Number of rows in this segment
+	unsigned rows;
 
-static const uint8_t gpios2[] = {
-	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 22, 23, 24, 25,
-};
+	// Pins of the active strips on banks A and B of the PRU
+	uint32_t gpio_mask[2];
+} __attribute__((__packed__)) ws281x_segment_t;
 
-static const uint8_t gpios3[] = {
-	14, 15, 16, 17, 19, 21
-};
 
-#define ARRAY_COUNT(a) ((sizeof(a) / sizeof(*a)))
+/** Per-frame timing written by the PRU at the end of each frame.
+ *
+ * Time stamps are on the IEP timer, which runs at 200 MHz and is
+ * shared by both PRUs, so their starts can be compared.
+ */
+typedef struct
+{
+	uint32_t frames; // frames completed since the program started
+	uint32_t start; // IEP count when the frame was picked up
+	uint32_t end; // IEP count when the last bit was out
+	uint32_t stall; // cycles stalled on memory during the frame
+} __attribute__((__packed__)) ws281x_telemetry_t;
+
+/** Nanoseconds per IEP count and per PRU cycle. */
+#define PRU_NS_PER_CYCLE 5
+
+
+/** Bit timing in PRU cycles; TIMING_T0H etc in ws281x.hp. */
+typedef struct
+{
+	uint32_t t0h;
+	uint32_t t1h;
+	uint32_t period; // less the time to reset the cycle counter
+	uint32_t reset;
+} __attribute__((__packed__)) ws281x_timing_t;
+
+/** The bit loop resets its cycle counter once per bit, which takes
+ * this long on top of the counted period.
+ */
+#define COUNTER_RESET_NS 100
+
+/** Shortest high times that the WS281x bit loop honours; it has work
+ * to do between raising the pins and dropping the zeros, and between
+ * the zeros and the ones.
+ */
+#define WS281X_MIN_T0H_NS 240
+#define WS281X_MIN_T1H_GAP_NS 60
 
 
 /** Command structure shared with the PRU.
@@ -51,14 +134,17 @@ static const uint8_t gpios3[] = {
  * This is mapped into the PRU data RAM and points to the
  * frame buffer in the shared DDR segment.
  *
- * Changing this requires changes in ws281x.p
+ * Changing this requires changes in ws281x_0.p and ws281x_1.p, and
+ * in apa102_0.p, apa102_1.p, dmx_0.p and dmx_1.p
  */
 typedef struct
 {
-	// in the DDR shared with the PRU
-	uintptr_t pixels_dma;
+	// in the DDR shared with the PRU; its bus addresses are 32 bits
+	// wide, also when the library is built for a 64-bit host
+	uint32_t pixels_dma;
 
-	// Length in pixels of the longest LED strip.
+	// Number of leading rows to clock out; the strips keep showing
+	// the rest of the previous frame.
 	unsigned num_pixels;
 
 	// write 1 to start, 0xFF to abort. will be cleared when started
@@ -66,172 +152,1696 @@ typedef struct
 
 	// will have a non-zero response written when done
 	volatile unsigned response;
+
+	// Segments of rows to clock out, in order
+	unsigned num_segments;
+
+	// Read by the PRU on every bit
+	ws281x_timing_t timing;
+
+	ws281x_segment_t segment[LEDSCAPE_NUM_STRIPS];
+
+	// Written by the PRU; TELEMETRY in ws281x.hp is this offset
+	ws281x_telemetry_t telemetry;
+
+	// Bumped by the PRU while idle and once per row (HEARTBEAT)
+	volatile uint32_t heartbeat;
+
+	// 24, or 32 for RGBW and APA102 strips (PIXEL_BITS)
+	uint32_t pixel_bits;
+
+	// APA102 only: clock pins of banks A and B (CLOCK_MASKS), and
+	// clocks after the pixels to push them down the strips
+	uint32_t clock_mask[2];
+	uint32_t end_clocks;
+
+	// Non-zero if pixels_dma points at bit planes (BIT_PLANES)
+	uint32_t bit_planes;
+
+	// The PRU caches the row that it is clocking out after this, at
+	// ROW_CACHE in its data RAM.
 } __attribute__((__packed__)) ws281x_command_t;
 
 
+/** Single producer, single consumer queue of frame numbers.
+ *
+ * head is only written by the consumer and tail only by the producer,
+ * so the handoff needs no locks.  Both counters run freely and are
+ * reduced modulo the ring size.  Since there are only num_frames
+ * frames, a queue of that size can never overflow.
+ */
+typedef struct
+{
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	unsigned * slots;
+} frame_queue_t;
+
+
 struct ledscape
 {
 	ws281x_command_t * ws281x_0;
 	ws281x_command_t * ws281x_1;
 	pru_t * pru0;
-	pru_t * pru1;
+	pru_t * pru1; // NULL if all strips are on PRU0
 	unsigned num_pixels;
+	unsigned num_strips;
+	unsigned num_frames;
 	size_t frame_size;
+	ledscape_format_t format;
+	uint8_t brightness; // of APA102 pixels
+	unsigned dmx; // LEDSCAPE_DMX_PRU0 and 1 if sending DMX universes
+	unsigned dmx_slots; // in each universe
+
+	unsigned bitplanes; // PRUs that clock out bit planes, as 1 << pru
+	size_t planes_offset; // in the DDR, of two plane buffers
+	size_t planes_size; // of each
+	unsigned planes_next; // buffer that the next draw transposes into
+	uint32_t (*plane_lut)[3][256][2]; // zero masks by PRU, byte and ones
+
+	unsigned strip_pixels[LEDSCAPE_NUM_STRIPS]; // 0 for unused strips
+	size_t * row_offset; // byte offset of each pixel row in a frame
+	ledscape_lut_t * lut[LEDSCAPE_NUM_STRIPS]; // NULL if uncorrected
+
+	frame_queue_t free; // frames that a producer may acquire
+	frame_queue_t ready; // submitted frames waiting to be drawn
+	int displayed; // frame that the PRU is clocking out, or -1
+
+	uint8_t * shown; // copy of what the strips show, if change aware
+	int shown_valid;
+	uint8_t * shadow; // cached frames that draw commits to the DDR
+	size_t (*stale)[2]; // bytes of each DDR frame behind its shadow
+	int in_flight; // a frame has been started and not waited for
+	uint32_t last_response;
+
+	ws281x_command_t armed[2]; // commands as loaded, to re-arm them
+	uint64_t frame_timeout_ns; // a frame taking longer is stuck
+	uint64_t drawn_ns; // when the frame in flight was started
+	uint32_t heartbeat[2]; // last heartbeat seen from each PRU
+	uint64_t heartbeat_ns[2]; // and when it was seen to move
+
+	pthread_mutex_t telemetry_lock; // protects the fields below
+	uint64_t frames_timed;
+	uint32_t pru_frames[2]; // telemetry frame count last collected
+	ledscape_frame_timing_t timing[LEDSCAPE_TELEMETRY_FRAMES];
+	unsigned restarts;
+};
+
+
+static void
+frame_queue_push(
+	ledscape_t * const leds,
+	frame_queue_t * const q,
+	const unsigned frame
+)
+{
+	const uint32_t tail = q->tail;
+	q->slots[tail % leds->num_frames] = frame;
+
+	// Publish the slot before the new tail becomes visible
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	futex_wake(&q->tail);
+}
+
+
+static int
+frame_queue_pop(
+	ledscape_t * const leds,
+	frame_queue_t * const q,
+	const int timeout_ms
+)
+{
+	const uint32_t head = q->head;
+
+	while (1)
+	{
+		const uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+		if (tail != head)
+			break;
+		if (timeout_ms == 0)
+			return -1;
+
+		// A timeout does not restart the full wait if the futex
+		// was woken spuriously; good enough for frame pacing.
+		if (futex_wait(&q->tail, tail, timeout_ms) < 0)
+			return -1;
+	}
+
+	const unsigned frame = q->slots[head % leds->num_frames];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return frame;
+}
+
+
+/** Bit timing profiles, the first being the default.
+ *
+ * "ws2812" is what the firmware has always clocked out and works
+ * with most WS2811 and WS2812 strips.  The rest follow the data
+ * sheets; the newer WS2812B, WS2813 and SK6812 need a longer reset.
+ * The firmware clocks all of them out as given; custom timings must
+ * keep T0H at least WS281X_MIN_T0H_NS and T1H WS281X_MIN_T1H_GAP_NS
+ * above it, and a period too short for the work of a bit stretches
+ * its low time.
+ */
+const ledscape_timing_t ledscape_timings[] = {
+	{ "ws2812",	 240,  900, 1250,  50000 },
+	{ "ws2812b",	 400,  800, 1250, 280000 },
+	{ "ws2813",	 300,  750, 1250, 300000 },
+	{ "sk6812",	 300,  600, 1250,  80000 },
+	{ "ws2811",	 500, 1200, 2500,  50000 }, // 400 kHz slow mode
+	{ "apa102",	   0,    0,    0,      0 }, // clock and data, no floor
+	{ NULL },
 };
 
 
-/** Retrieve one of the two frame buffers. */
+const ledscape_timing_t *
+ledscape_timing(
+	const char * const name
+)
+{
+	for (const ledscape_timing_t * t = ledscape_timings ; t->name ; t++)
+		if (strcmp(t->name, name) == 0)
+			return t;
+
+	return NULL;
+}
+
+
+/** Convert a timing into the PRU cycles of the command structure.
+ *
+ * The APA102 programs only take the period, which may be 0.
+ */
+static void
+ws281x_timing_cycles(
+	ws281x_timing_t * const cycles,
+	const ledscape_timing_t * const timing,
+	const ledscape_format_t format
+)
+{
+	if (format == LEDSCAPE_FORMAT_APA102)
+	{
+		*cycles = (ws281x_timing_t) {
+			.period	= timing->period_ns > COUNTER_RESET_NS
+				? (timing->period_ns - COUNTER_RESET_NS) / PRU_NS_PER_CYCLE
+				: 0,
+		};
+		return;
+	}
+
+	if (timing->t0h_ns < WS281X_MIN_T0H_NS
+	||  timing->t1h_ns < timing->t0h_ns + WS281X_MIN_T1H_GAP_NS
+	||  timing->t1h_ns + COUNTER_RESET_NS >= timing->period_ns
+	||  timing->reset_ns < 2 * PRU_NS_PER_CYCLE)
+		die("%s: bit timing %u/%u/%u ns, reset %u ns is impossible\n",
+			timing->name ? timing->name : "custom",
+			timing->t0h_ns,
+			timing->t1h_ns,
+			timing->period_ns,
+			timing->reset_ns
+		);
+
+	*cycles = (ws281x_timing_t) {
+		.t0h	= timing->t0h_ns / PRU_NS_PER_CYCLE,
+		.t1h	= timing->t1h_ns / PRU_NS_PER_CYCLE,
+		.period	= (timing->period_ns - COUNTER_RESET_NS) / PRU_NS_PER_CYCLE,
+		.reset	= timing->reset_ns / PRU_NS_PER_CYCLE,
+	};
+}
+
+
+/** A frame taking several times its clock out time is not coming back. */
+static void
+ledscape_frame_timeout(
+	ledscape_t * const leds,
+	const ledscape_timing_t * const timing
+)
+{
+	const unsigned pixel_bits = leds->format == LEDSCAPE_FORMAT_GRB ? 24 : 32;
+	unsigned bit_ns = timing->period_ns;
+	if (leds->format == LEDSCAPE_FORMAT_APA102 && bit_ns < APA102_BIT_NS)
+		bit_ns = APA102_BIT_NS;
+
+	uint64_t frame_ns = 0
+		+ (uint64_t) (leds->num_pixels + 2) * pixel_bits * bit_ns
+		+ timing->reset_ns;
+
+	const uint64_t dmx_ns = DMX_HEADER_NS + (uint64_t) leds->dmx_slots * DMX_SLOT_NS;
+	if (leds->dmx && frame_ns < dmx_ns)
+		frame_ns = dmx_ns;
+
+	leds->frame_timeout_ns = 4 * frame_ns + WATCHDOG_MS * 1000000ULL;
+}
+
+
+void
+ledscape_set_timing(
+	ledscape_t * const leds,
+	const ledscape_timing_t * const timing
+)
+{
+	ws281x_timing_t cycles;
+	ws281x_timing_cycles(&cycles, timing, leds->format);
+
+	// Both the running commands and the copies that a restart uses
+	leds->armed[0].timing = leds->armed[1].timing = cycles;
+	leds->ws281x_0->timing = cycles;
+	if (leds->ws281x_1)
+		leds->ws281x_1->timing = cycles;
+
+	ledscape_frame_timeout(leds, timing);
+}
+
+
+/** Retrieve one of the frame buffers in the DDR ring. */
 ledscape_frame_t *
 ledscape_frame(
 	ledscape_t * const leds,
 	unsigned int frame
 )
 {
-	if (frame >= 2)
+	if (frame >= leds->num_frames)
 		return NULL;
 
+	if (leds->shadow)
+		return (ledscape_frame_t*)(leds->shadow + leds->frame_size * frame);
+
 	return (ledscape_frame_t*)((uint8_t*) leds->pru0->ddr + leds->frame_size * frame);
 }
+
+
+/** Copy len bytes of a shadow frame into the uncached DDR.
+ *
+ * Streams it in 64 byte bursts on NEON, so that the writes go out in
+ * full lines in order instead of a word at a time.
+ */
+static void
+frame_commit(
+	uint8_t * const out,
+	const uint8_t * const in,
+	const size_t len
+)
+{
+	size_t off = 0;
+#ifdef __ARM_NEON__
+	for ( ; off + 64 <= len ; off += 64)
+	{
+		uint8x16_t v[4];
+		for (unsigned i = 0 ; i < 4 ; i++)
+			v[i] = vld1q_u8(in + off + 16 * i);
+		for (unsigned i = 0 ; i < 4 ; i++)
+			vst1q_u8(out + off + 16 * i, v[i]);
+	}
+#endif
+	memcpy(out + off, in + off, len - off);
+}
 	
 
-/** Initiate the transfer of a frame to the LED strips */
-void
-ledscape_draw(
-	ledscape_t * const leds,
-	unsigned int frame
+/** Copy a block of the frame into the shown copy if it differs.
+ *
+ * The frame is in uncached DDR, so it is read exactly once, in
+ * 64 byte bursts on NEON; the copy is in cached memory.
+ *
+ * \returns non-zero if the block changed.
+ */
+static int
+block_changed(
+	uint8_t * const shown,
+	const uint8_t * const frame,
+	const size_t len
 )
 {
-	leds->ws281x_0->pixels_dma = leds->pru0->ddr_addr + leds->frame_size * frame;
-	leds->ws281x_1->pixels_dma = leds->pru0->ddr_addr + leds->frame_size * frame;
+#ifdef __ARM_NEON__
+	if (len == 64)
+	{
+		uint8x16_t in[4];
+		uint8x16_t diff = vdupq_n_u8(0);
+		for (unsigned i = 0 ; i < 4 ; i++)
+		{
+			in[i] = vld1q_u8(frame + 16 * i);
+			diff = vorrq_u8(diff, veorq_u8(in[i], vld1q_u8(shown + 16 * i)));
+		}
 
-	// Wait for any current command to have been acknowledged
-	while (leds->ws281x_0->command || leds->ws281x_1->command);
+		const uint64x2_t d = vreinterpretq_u64_u8(diff);
+		if (!(vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)))
+			return 0;
 
-	// Send the start command
-	leds->ws281x_0->command = 1;
-	leds->ws281x_1->command = 1;
+		for (unsigned i = 0 ; i < 4 ; i++)
+			vst1q_u8(shown + 16 * i, in[i]);
+		return 1;
+	}
+#endif
+	uint8_t in[64];
+	memcpy(in, frame, len);
+	if (memcmp(in, shown, len) == 0)
+		return 0;
+
+	memcpy(shown, in, len);
+	return 1;
 }
 
 
-/** Wait for the current frame to finish transfering to the strips.
- * \returns a token indicating the response code.
+/** Transpose the 8x8 bit matrix in x, bit t of byte j to bit j of byte t. */
+static inline uint64_t
+transpose8(
+	uint64_t x
+)
+{
+	uint64_t t;
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x ^= t ^ (t << 28);
+	return x;
+}
+
+
+#ifdef __ARM_NEON__
+/** transpose8() of both lanes at once. */
+static inline uint64x2_t
+transpose8x2(
+	uint64x2_t x
+)
+{
+	uint64x2_t t;
+	t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 7)), vdupq_n_u64(0x00AA00AA00AA00AAULL));
+	x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 7));
+	t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 14)), vdupq_n_u64(0x0000CCCC0000CCCCULL));
+	x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 14));
+	t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, 28)), vdupq_n_u64(0x00000000F0F0F0F0ULL));
+	x = veorq_u64(veorq_u64(x, t), vshlq_n_u64(t, 28));
+	return x;
+}
+#endif
+
+
+/** Transpose one PRU's part of a pixel row into its bit planes.
+ *
+ * The pixels of each group of 8 strips are a 32 by 8 bit matrix,
+ * transposed a byte of the pixels at a time into which of the strips
+ * have each bit set.  Those then look up the zero masks of their pins.
  */
-uint32_t
-ledscape_wait(
-	ledscape_t * const leds
+static void
+row_planes(
+	const uint32_t (* const lut)[256][2],
+	const uint8_t * const pixels,
+	uint32_t * const planes
 )
 {
-	while (1)
+	uint8_t ones[3][32]; // strips of each group with each bit set
+
+	for (unsigned g = 0 ; g < 3 ; g++)
 	{
-		uint32_t response0 = leds->ws281x_0->response;
-		uint32_t response1 = leds->ws281x_1->response;
+		const uint8_t * const p = pixels + 8 * g * sizeof(ledscape_pixel_t);
+#ifdef __ARM_NEON__
+		// Byte k of the 8 pixels into lane k % 2 of a vector
+		const uint8x8x4_t b = vld4_u8(p);
+		const uint64x2_t lo = vreinterpretq_u64_u8(vcombine_u8(b.val[0], b.val[1]));
+		const uint64x2_t hi = vreinterpretq_u64_u8(vcombine_u8(b.val[2], b.val[3]));
+		vst1q_u8(ones[g], vreinterpretq_u8_u64(transpose8x2(lo)));
+		vst1q_u8(ones[g] + 16, vreinterpretq_u8_u64(transpose8x2(hi)));
+#else
+		for (unsigned k = 0 ; k < 4 ; k++)
+		{
+			uint64_t x = 0;
+			for (unsigned j = 0 ; j < 8 ; j++)
+				x |= (uint64_t) p[4 * j + k] << (8 * j);
 
-		// printf("pru0: (%d,%d), pru1: (%d,%d)\n", 
-		// 	leds->ws281x_0->command, leds->ws281x_0->response,
-		// 	leds->ws281x_1->command, leds->ws281x_1->response
-		// );
+			x = transpose8(x);
+			for (unsigned t = 0 ; t < 8 ; t++)
+				ones[g][8 * k + t] = x >> (8 * t);
+		}
+#endif
+	}
 
-		if (response0 && response1) {
-			leds->ws281x_0->response = leds->ws281x_1->response = 0;
-			// TODO: How to handle both return values?
-			return response0;
+	for (unsigned bit = 0 ; bit < 32 ; bit++)
+	{
+		const uint8_t * const o = &ones[0][bit];
+		planes[2 * bit + 0] = lut[0][o[0]][0] | lut[1][o[32]][0] | lut[2][o[64]][0];
+		planes[2 * bit + 1] = lut[0][o[0]][1] | lut[1][o[32]][1] | lut[2][o[64]][1];
+	}
+}
+
+
+/** Transpose the leading rows of a frame into the next plane buffer.
+ *
+ * Only call this once the PRUs have picked up the previous command:
+ * they are then clocking out of the other buffer.
+ *
+ * \returns the DDR address of the buffer for the PRUs.
+ */
+static uintptr_t
+frame_planes(
+	ledscape_t * const leds,
+	const uint8_t * const frame,
+	const unsigned rows
+)
+{
+	const size_t offset = leds->planes_offset + leds->planes_size * leds->planes_next;
+	uint8_t * const out = (uint8_t*) leds->pru0->ddr + offset;
+	leds->planes_next ^= 1;
+
+	for (unsigned row = 0 ; row < rows ; row++)
+	{
+		// The frame is uncached, so read each row once.  Strips
+		// past the end of a narrower row read as zero bits; their
+		// pins get no start pulse anyway.
+		uint8_t pixels[LEDSCAPE_NUM_STRIPS * sizeof(ledscape_pixel_t)];
+		const size_t len = leds->row_offset[row + 1] - leds->row_offset[row];
+		memcpy(pixels, frame + leds->row_offset[row], len);
+		memset(pixels + len, 0, sizeof(pixels) - len);
+
+		for (unsigned pru = 0 ; pru < 2 ; pru++)
+		{
+			if (!(leds->bitplanes & (1 << pru)))
+				continue;
+
+			uint32_t planes[PLANE_PRU_BYTES / sizeof(uint32_t)];
+			row_planes(
+				leds->plane_lut[pru],
+				pixels + pru * STRIPS_PER_PRU * sizeof(ledscape_pixel_t),
+				planes
+			);
+			memcpy(out + row * PLANE_ROW_BYTES + pru * PLANE_PRU_BYTES, planes, sizeof(planes));
 		}
 	}
+
+	return leds->pru0->ddr_addr + offset;
 }
 
 
-ledscape_t *
-ledscape_init(
-	unsigned num_pixels
+/** Number of leading rows of a frame that differ from what is shown.
+ *
+ * Updates the shown copy as it goes, and stores the range of bytes
+ * that changed in changed[], which is empty if none did.
+ */
+static unsigned
+changed_rows(
+	ledscape_t * const leds,
+	const uint8_t * const frame,
+	size_t changed[2]
 )
 {
-	pru_t * const pru0 = pru_init(0);
-	pru_t * const pru1 = pru_init(1);
+	const size_t size = leds->frame_size;
+	size_t start = size;
+	size_t end = 0;
 
-	const size_t frame_size = num_pixels * LEDSCAPE_NUM_STRIPS * 4;
+	for (size_t off = 0 ; off < size ; off += 64)
+	{
+		const size_t len = size - off < 64 ? size - off : 64;
+		if (!block_changed(leds->shown + off, frame + off, len))
+			continue;
+		if (start == size)
+			start = off;
+		end = off + len;
+	}
 
-	if (2 *frame_size > pru0->ddr_size)
-		die("Pixel data needs at least 2 * %zu, only %zu in DDR\n",
-			frame_size,
-			pru0->ddr_size
-		);
+	changed[0] = start < end ? start : 0;
+	changed[1] = end;
 
-	ledscape_t * const leds = calloc(1, sizeof(*leds));
+	if (!leds->shown_valid)
+	{
+		leds->shown_valid = 1;
+		return leds->num_pixels;
+	}
 
-	*leds = (ledscape_t) {
-		.pru0		= pru0,
-		.pru1		= pru1,
-		.num_pixels	= num_pixels,
-		.frame_size	= frame_size,
-		.ws281x_0	= pru0->data_ram,
-		.ws281x_1	= pru1->data_ram,
-	};
+	// First row that starts at or past the last change
+	unsigned lo = 0;
+	unsigned hi = leds->num_pixels;
+	while (lo < hi)
+	{
+		const unsigned mid = (lo + hi) / 2;
+		if (leds->row_offset[mid] < end)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	*(leds->ws281x_0) = *(leds->ws281x_1) = (ws281x_command_t) {
-		.pixels_dma	= 0, // will be set in draw routine
-		.command	= 0,
-		.response	= 0,
-		.num_pixels	= leds->num_pixels,
-	};
+	return lo;
+}
 
-	// Configure all of our output pins.
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios0) ; i++)
-		pru_gpio(0, gpios0[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios1) ; i++)
-		pru_gpio(1, gpios1[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios2) ; i++)
-		pru_gpio(2, gpios2[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios3) ; i++)
-		pru_gpio(3, gpios3[i], 1, 0);
 
-	// Initiate the PRU0 program
-	pru_exec(pru0, "./ws281x_0.bin");
+/** Load the program of one PRU with its command re-armed.
+ *
+ * \returns 0 if it did not report in within PRU_START_MS.
+ */
+static int
+ledscape_start_pru(
+	ledscape_t * const leds,
+	const unsigned pru
+)
+{
+	ws281x_command_t * const cmd = pru ? leds->ws281x_1 : leds->ws281x_0;
 
-	// Watch for a done response that indicates a proper startup
-	// \todo timeout if it fails
-	fprintf(stdout, "waiting for response from pru0... ");
-	while (!leds->ws281x_0->response);
-	printf("OK\n");
+	*cmd = leds->armed[pru];
 
+	// Both PRUs run the same kind of program, unless one sends DMX
+	const uint32_t * code = pru ? ws281x_1_code : ws281x_0_code;
+	size_t size = pru ? sizeof(ws281x_1_code) : sizeof(ws281x_0_code);
+	if (leds->dmx & (1 << pru))
+	{
+		code = pru ? dmx_1_code : dmx_0_code;
+		size = pru ? sizeof(dmx_1_code) : sizeof(dmx_0_code);
+	} else if (leds->format == LEDSCAPE_FORMAT_APA102) {
+		code = pru ? apa102_1_code : apa102_0_code;
+		size = pru ? sizeof(apa102_1_code) : sizeof(apa102_0_code);
+	}
 
-	// Initiate the PRU1 program
-	pru_exec(pru1, "./ws281x_1.bin");
+	pru_exec_code(pru ? leds->pru1 : leds->pru0, code, size);
 
 	// Watch for a done response that indicates a proper startup
-	// \todo timeout if it fails
-	fprintf(stdout, "waiting for response from pru1... ");
-	while (!leds->ws281x_1->response);
-	printf("OK\n");
+	const uint64_t start_ns = monotonic_ns();
+	while (!cmd->response)
+		if (monotonic_ns() - start_ns > PRU_START_MS * 1000000ULL)
+			return 0;
 
-	return leds;
+	leds->heartbeat[pru] = cmd->heartbeat;
+	leds->heartbeat_ns[pru] = monotonic_ns();
+
+	return 1;
 }
 
 
-void
-ledscape_close(
-	ledscape_t * const leds
+/** Reload the PRU programs after the watchdog found them stuck.
+ *
+ * The frame in flight is lost, but the process and the frame ring
+ * carry on.  A change aware draw resends the whole next frame, since
+ * there is no telling what the strips show.
+ */
+static void
+ledscape_restart(
+	ledscape_t * const leds,
+	const char * const why
 )
 {
-	// Signal a halt command
-	leds->ws281x_0->command = 0xFF;
-	leds->ws281x_1->command = 0xFF;
-	pru_close(leds->pru0);
-	pru_close(leds->pru1);
+	warn("PRU %s; reloading the programs\n", why);
+
+	for (unsigned pru = 0 ; pru < 2 ; pru++)
+	{
+		ws281x_command_t * const cmd = pru ? leds->ws281x_1 : leds->ws281x_0;
+		if (!cmd)
+			continue;
+
+		if (!ledscape_start_pru(leds, pru))
+			die("PRU %u did not restart\n", pru);
+
+		cmd->response = 0;
+	}
+
+	pthread_mutex_lock(&leds->telemetry_lock);
+	leds->restarts++;
+	leds->pru_frames[0] = leds->pru_frames[1] = 0;
+	pthread_mutex_unlock(&leds->telemetry_lock);
+
+	leds->shown_valid = 0;
+	leds->in_flight = 0;
+	leds->last_response = 1;
 }
 
 
-void
-ledscape_set_color(
-	ledscape_frame_t * const frame,
-	uint32_t strip,
-	uint32_t pixel,
-	uint8_t r,
-	uint8_t g,
-	uint8_t b
+/** Check that the PRU programs are still running.
+ *
+ * A live program bumps its heartbeat continuously while idle and
+ * once per row while clocking out, so one that has not moved for
+ * WATCHDOG_MS has wedged.  A frame that is far overdue although the
+ * heartbeats move was lost.
+ *
+ * \returns 0 if the programs had to be restarted.
+ */
+static int
+ledscape_watchdog(
+	ledscape_t * const leds
 )
 {
-	ledscape_pixel_t * const p = &frame[pixel].strip[strip];
-	p->r = r;
-	p->g = g;
-	p->b = b;
+	ws281x_command_t * const cmds[2] = { leds->ws281x_0, leds->ws281x_1 };
+	const uint64_t now = monotonic_ns();
+
+	for (unsigned pru = 0 ; pru < 2 ; pru++)
+	{
+		if (!cmds[pru])
+			continue;
+
+		const uint32_t heartbeat = cmds[pru]->heartbeat;
+		if (heartbeat != leds->heartbeat[pru])
+		{
+			leds->heartbeat[pru] = heartbeat;
+			leds->heartbeat_ns[pru] = now;
+			continue;
+		}
+
+		if (now - leds->heartbeat_ns[pru] > WATCHDOG_MS * 1000000ULL)
+		{
+			ledscape_restart(leds, pru ? "1 stopped" : "0 stopped");
+			return 0;
+		}
+	}
+
+	if (leds->in_flight && now - leds->drawn_ns > leds->frame_timeout_ns)
+	{
+		ledscape_restart(leds, "frame overdue");
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/** Bring the DDR copy of a shadowed frame up to date.
+ *
+ * Each DDR frame holds its shadow as of the last draw of it, so only
+ * the bytes that changed in any draw since then need to be written:
+ * the changes of every draw are added to the stale range of every
+ * frame, and that of the drawn one is written out and cleared.  PRUs
+ * that clock out bit planes do not read the frame at all.
+ */
+static void
+shadow_commit(
+	ledscape_t * const leds,
+	const unsigned frame,
+	const size_t changed[2]
+)
+{
+	if (changed[0] < changed[1])
+	{
+		for (unsigned i = 0 ; i < leds->num_frames ; i++)
+		{
+			size_t * const stale = leds->stale[i];
+			if (stale[0] >= stale[1])
+			{
+				stale[0] = changed[0];
+				stale[1] = changed[1];
+				continue;
+			}
+
+			if (changed[0] < stale[0])
+				stale[0] = changed[0];
+			if (changed[1] > stale[1])
+				stale[1] = changed[1];
+		}
+	}
+
+	if (leds->bitplanes == (leds->pru1 ? 3u : 1u))
+		return;
+
+	size_t * const stale = leds->stale[frame];
+	if (stale[0] >= stale[1])
+		return;
+
+	const size_t offset = leds->frame_size * frame;
+	frame_commit(
+		(uint8_t*) leds->pru0->ddr + offset + stale[0],
+		leds->shadow + offset + stale[0],
+		stale[1] - stale[0]
+	);
+
+	stale[0] = stale[1] = 0;
+}
+
+
+/** Initiate the transfer of a frame to the LED strips.
+ *
+ * If the leds are change aware, only the rows up to the last one
+ * that differs from what the strips show are clocked out, and a frame
+ * without any changes is not drawn at all.  Nothing will signal the
+ * end of a skipped frame, but ledscape_wait() returns at once.
+ *
+ * \returns the number of rows clocked out, 0 if the frame was skipped.
+ */
+unsigned
+ledscape_draw(
+	ledscape_t * const leds,
+	unsigned int frame
+)
+{
+	const uintptr_t dma = leds->pru0->ddr_addr + leds->frame_size * frame;
+	ws281x_command_t * const ws281x_1 = leds->ws281x_1;
+
+	unsigned rows = leds->num_pixels;
+	size_t changed[2] = { 0, leds->frame_size };
+	if (leds->shown)
+	{
+		rows = changed_rows(leds, (const uint8_t*) ledscape_frame(leds, frame), changed);
+		if (rows == 0)
+			return 0;
+	}
+
+	if (leds->shadow)
+		shadow_commit(leds, frame, changed);
+
+	// Wait for any current command to have been acknowledged.
+	// The PRUs only pick up a queued command once the frame that
+	// they are clocking out is done.  Its end of frame event wakes
+	// this early unless ledscape_wait() has already collected it,
+	// and the PRUs clear the command just after raising it, so
+	// otherwise this sleeps in 1 ms slices rather than spinning on
+	// the DRAM.
+	const uint64_t start_ns = monotonic_ns();
+	while (leds->ws281x_0->command || (ws281x_1 && ws281x_1->command))
+	{
+		if (pru_wait_event(leds->pru0, 1) < 0)
+			die("PRU event wait failed: %s\n", strerror(errno));
+
+		// A restart leaves both PRUs idle with no command
+		if (!ledscape_watchdog(leds))
+			break;
+		if (monotonic_ns() - start_ns > leds->frame_timeout_ns)
+			ledscape_restart(leds, "ignored a command");
+	}
+
+	// The PRUs read these along with the command, so they can be
+	// written once the previous one has been picked up.
+	uintptr_t planes = 0;
+	if (leds->bitplanes)
+		planes = frame_planes(leds, (const uint8_t*) ledscape_frame(leds, frame), rows);
+
+	leds->ws281x_0->pixels_dma = leds->bitplanes & 1 ? planes : dma;
+	if (ws281x_1)
+		ws281x_1->pixels_dma = leds->bitplanes & 2
+			? planes + PLANE_PRU_BYTES
+			: dma + STRIPS_PER_PRU * sizeof(ledscape_pixel_t);
+
+	leds->ws281x_0->num_pixels = rows;
+	if (ws281x_1)
+		ws281x_1->num_pixels = rows;
+
+	// Send the start command
+	leds->in_flight = 1;
+	leds->drawn_ns = monotonic_ns();
+	leds->ws281x_0->command = 1;
+	if (ws281x_1)
+		ws281x_1->command = 1;
+
+	return rows;
+}
+
+
+/** Collect the timing of a finished frame from both PRUs. */
+static void
+telemetry_collect(
+	ledscape_t * const leds
+)
+{
+	ws281x_command_t * const cmds[2] = { leds->ws281x_0, leds->ws281x_1 };
+	ws281x_telemetry_t t[2];
+	ledscape_frame_timing_t timing = { .skew_ns = 0 };
+	int fresh = 0;
+
+	for (unsigned pru = 0 ; pru < 2 ; pru++)
+	{
+		if (!cmds[pru])
+			continue;
+
+		t[pru] = cmds[pru]->telemetry;
+		if (t[pru].frames == leds->pru_frames[pru])
+			continue;
+
+		leds->pru_frames[pru] = t[pru].frames;
+		fresh = 1;
+		timing.clock_ns[pru] = (t[pru].end - t[pru].start) * PRU_NS_PER_CYCLE;
+		timing.stall_cycles[pru] = t[pru].stall;
+	}
+
+	// The startup response is not a frame
+	if (!fresh)
+		return;
+
+	if (cmds[1])
+		timing.skew_ns = (int32_t)(t[1].start - t[0].start) * PRU_NS_PER_CYCLE;
+
+	pthread_mutex_lock(&leds->telemetry_lock);
+	leds->timing[leds->frames_timed++ % LEDSCAPE_TELEMETRY_FRAMES] = timing;
+	pthread_mutex_unlock(&leds->telemetry_lock);
+}
+
+
+/** Power of two histogram bucket of a value. */
+static unsigned
+hist_bucket(
+	uint32_t x
+)
+{
+	unsigned i = 0;
+	while (x && i < LEDSCAPE_HIST_BUCKETS - 1)
+	{
+		x >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+
+/** Timing of the last frame and histograms over the recent ones. */
+void
+ledscape_telemetry(
+	ledscape_t * const leds,
+	ledscape_telemetry_t * const t
+)
+{
+	memset(t, 0, sizeof(*t));
+
+	pthread_mutex_lock(&leds->telemetry_lock);
+
+	const uint64_t frames = leds->frames_timed;
+	const unsigned window = frames < LEDSCAPE_TELEMETRY_FRAMES
+		? frames
+		: LEDSCAPE_TELEMETRY_FRAMES;
+
+	t->frames = frames;
+	t->window = window;
+	t->restarts = leds->restarts;
+	if (frames)
+		t->last = leds->timing[(frames - 1) % LEDSCAPE_TELEMETRY_FRAMES];
+
+	for (unsigned i = 0 ; i < window ; i++)
+	{
+		const ledscape_frame_timing_t * const f = &leds->timing[i];
+		const uint32_t clock = f->clock_ns[0] > f->clock_ns[1]
+			? f->clock_ns[0]
+			: f->clock_ns[1];
+		const uint32_t skew = f->skew_ns < 0 ? -f->skew_ns : f->skew_ns;
+		const uint32_t stall = f->stall_cycles[0] + f->stall_cycles[1];
+
+		t->clock_hist[hist_bucket(clock)]++;
+		t->skew_hist[hist_bucket(skew)]++;
+		t->stall_hist[hist_bucket(stall)]++;
+
+		if (clock > t->max_clock_ns)
+			t->max_clock_ns = clock;
+		if (skew > t->max_skew_ns)
+			t->max_skew_ns = skew;
+		if (stall > t->max_stall_cycles)
+			t->max_stall_cycles = stall;
+	}
+
+	pthread_mutex_unlock(&leds->telemetry_lock);
+}
+
+
+/** Wait for the current frame to finish transfering to the strips.
+ *
+ * Sleeps on the PRU end-of-frame event instead of polling the
+ * PRU DRAM.  timeout_ms of -1 waits forever.  If no frame has
+ * been started since the last wait, because ledscape_draw() skipped
+ * an unchanged one, it returns the previous response at once.
+ *
+ * While waiting it runs the watchdog, which reloads the PRU programs
+ * if they stop responding; the lost frame then counts as done.
+ *
+ * \returns a token indicating the response code, or 0 on timeout.
+ */
+uint32_t
+ledscape_wait_timeout(
+	ledscape_t * const leds,
+	const int timeout_ms
+)
+{
+	if (!leds->in_flight)
+		return leds->last_response;
+
+	const uint64_t deadline_ns = monotonic_ns() + (uint64_t) timeout_ms * 1000000ULL;
+
+	while (1)
+	{
+		// Both PRUs write their response before raising the
+		// event, and the event is acknowledged before the
+		// responses are checked, so a frame that finishes between
+		// the check and the wait will still wake us up.
+		ws281x_command_t * const ws281x_1 = leds->ws281x_1;
+		uint32_t response0 = leds->ws281x_0->response;
+		uint32_t response1 = ws281x_1 ? ws281x_1->response : 1;
+
+		// printf("pru0: (%d,%d), pru1: (%d,%d)\n", 
+		// 	leds->ws281x_0->command, leds->ws281x_0->response,
+		// 	leds->ws281x_1->command, leds->ws281x_1->response
+		// );
+
+		if (response0 && response1) {
+			leds->ws281x_0->response = 0;
+			if (ws281x_1)
+				ws281x_1->response = 0;
+			leds->in_flight = 0;
+			leds->last_response = response0;
+			// The timing of both PRUs is in the telemetry
+			telemetry_collect(leds);
+			return response0;
+		}
+
+		// Wake up at least every WATCHDOG_MS to look after the PRUs
+		int slice_ms = WATCHDOG_MS;
+		if (timeout_ms >= 0)
+		{
+			const uint64_t now = monotonic_ns();
+			const uint64_t left_ms = now < deadline_ns
+				? (deadline_ns - now + 999999) / 1000000
+				: 0;
+			if (left_ms < (uint64_t) slice_ms)
+				slice_ms = left_ms;
+		}
+
+		const int rc = pru_wait_event(leds->pru0, slice_ms);
+		if (rc < 0)
+			die("PRU event wait failed: %s\n", strerror(errno));
+
+		if (!ledscape_watchdog(leds))
+			return leds->last_response;
+
+		if (rc == 0 && timeout_ms >= 0 && monotonic_ns() >= deadline_ns)
+			return 0;
+	}
+}
+
+
+/** Wait for the current frame to finish transfering to the strips.
+ * \returns a token indicating the response code.
+ */
+uint32_t
+ledscape_wait(
+	ledscape_t * const leds
+)
+{
+	return ledscape_wait_timeout(leds, -1);
+}
+
+
+/** File descriptor that becomes readable when a frame is done.
+ *
+ * Suitable for poll()/select() in an event loop; once it is readable
+ * call ledscape_wait_timeout(leds, 0) to collect the response.
+ */
+int
+ledscape_wait_fd(
+	ledscape_t * const leds
+)
+{
+	return pru_event_fd(leds->pru0);
+}
+
+
+/** Take a free frame from the ring to render into.
+ *
+ * Producer side of the ring.  Blocks up to timeout_ms (-1 forever)
+ * until the PRU has finished with an older frame.
+ *
+ * \returns the frame number, or -1 on timeout.
+ */
+int
+ledscape_acquire(
+	ledscape_t * const leds,
+	const int timeout_ms
+)
+{
+	return frame_queue_pop(leds, &leds->free, timeout_ms);
+}
+
+
+/** Queue a rendered frame to be drawn after those already submitted. */
+void
+ledscape_submit(
+	ledscape_t * const leds,
+	const unsigned frame
+)
+{
+	frame_queue_push(leds, &leds->ready, frame);
+}
+
+
+/** Take the oldest submitted frame off the ring.
+ *
+ * Consumer side of the ring; the frame must be handed back with
+ * ledscape_release() once the PRU is done with it.
+ *
+ * \returns the frame number, or -1 on timeout.
+ */
+int
+ledscape_next(
+	ledscape_t * const leds,
+	const int timeout_ms
+)
+{
+	return frame_queue_pop(leds, &leds->ready, timeout_ms);
+}
+
+
+/** Return a frame to the producer once it is no longer displayed. */
+void
+ledscape_release(
+	ledscape_t * const leds,
+	const unsigned frame
+)
+{
+	frame_queue_push(leds, &leds->free, frame);
+}
+
+
+/** Draw the oldest submitted frame.
+ *
+ * Waits for the PRU to finish the frame it is clocking out, starts
+ * the new one and releases the finished frame back to the producer.
+ *
+ * \returns the frame number drawn, or -1 if nothing was submitted
+ * within timeout_ms.
+ */
+int
+ledscape_present(
+	ledscape_t * const leds,
+	const int timeout_ms
+)
+{
+	const int frame = ledscape_next(leds, timeout_ms);
+	if (frame < 0)
+		return -1;
+
+	ledscape_wait(leds);
+
+	if (leds->displayed >= 0)
+		ledscape_release(leds, leds->displayed);
+
+	ledscape_draw(leds, frame);
+	leds->displayed = frame;
+
+	return frame;
+}
+
+
+/** Lay out the rows of a frame and split them into segments.
+ *
+ * Segment boundaries fall wherever a strip runs out of pixels.  Each
+ * PRU gets the leading segments that still have strips of its own;
+ * the later ones have nothing for it to clock out.  Rows are only as
+ * wide as the highest strip still active, so if the longer strips are
+ * on the lower channels the frame stays close to the sum of the
+ * strip lengths.
+ *
+ * \returns the frame size in bytes.
+ */
+static size_t
+ledscape_layout(
+	ledscape_t * const leds,
+	ws281x_segment_t segments[2][LEDSCAPE_NUM_STRIPS],
+	unsigned num_segments[2]
+)
+{
+	// Each PRU always bursts in a full row of STRIPS_PER_PRU pixels,
+	// starting at its own half of the row, and prefetches the row after
+	// the one it is clocking out, so pad the frame to keep the reads
+	// past its last row inside it.
+	const size_t burst = STRIPS_PER_PRU * sizeof(ledscape_pixel_t);
+	size_t offset = 0;
+	size_t frame_size = 0;
+	unsigned row = 0;
+
+	num_segments[0] = num_segments[1] = 0;
+
+	while (row < leds->num_pixels)
+	{
+		unsigned end = leds->num_pixels;
+		unsigned width = 0;
+		uint32_t gpio_mask[4] = { 0, 0, 0, 0 };
+
+		for (unsigned i = 0 ; i < leds->num_strips ; i++)
+		{
+			const unsigned len = leds->strip_pixels[i];
+			if (len <= row)
+				continue;
+			if (len < end)
+				end = len;
+			width = i + 1;
+			gpio_mask[strip_pins[i].gpio] |= 1 << strip_pins[i].pin;
+		}
+
+		const unsigned rows = end - row;
+		const size_t stride = width * sizeof(ledscape_pixel_t);
+
+		for (unsigned i = 0 ; i < rows ; i++)
+			leds->row_offset[row + i] = offset + i * stride;
+
+		for (unsigned pru = 0 ; pru < 2 ; pru++)
+		{
+			const uint8_t * const banks = pru_banks[pru];
+			const uint32_t mask_a = banks[0] == STRIP_NO_PIN ? 0 : gpio_mask[banks[0]];
+			const uint32_t mask_b = banks[1] == STRIP_NO_PIN ? 0 : gpio_mask[banks[1]];
+			if (!mask_a && !mask_b)
+				continue;
+
+			segments[pru][num_segments[pru]++] = (ws281x_segment_t) {
+				.stride		= stride,
+				.rows		= rows,
+				.gpio_mask	= { mask_a, mask_b },
+			};
+
+			const size_t last_read = offset + rows * stride
+				+ (pru + 1) * burst;
+			if (frame_size < last_read)
+				frame_size = last_read;
+		}
+
+		offset += rows * stride;
+		row = end;
+	}
+
+	// Where the last row ends, for its length
+	leds->row_offset[row] = offset;
+
+	if (frame_size < offset)
+		frame_size = offset;
+
+	return frame_size;
+}
+
+
+ledscape_t *
+ledscape_init(
+	unsigned num_pixels,
+	unsigned num_strips
+)
+{
+	return ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= num_pixels,
+		.num_strips	= num_strips,
+	});
+}
+
+
+ledscape_t *
+ledscape_init_config(
+	const ledscape_config_t * const config
+)
+{
+	const uint64_t start_ns = monotonic_ns();
+	const unsigned num_strips = config->num_strips ? config->num_strips : LEDSCAPE_NUM_STRIPS;
+	const unsigned num_frames = config->num_frames ? config->num_frames : 2;
+	const ledscape_format_t format = config->apa102
+		? LEDSCAPE_FORMAT_APA102
+		: config->rgbw ? LEDSCAPE_FORMAT_RGBW : LEDSCAPE_FORMAT_GRB;
+	const ledscape_timing_t * const timing = config->timing
+		? config->timing
+		: format == LEDSCAPE_FORMAT_APA102
+		? ledscape_timing("apa102")
+		: &ledscape_timings[0];
+
+	if (config->rgbw && config->apa102)
+		die("RGBW and APA102 strips are exclusive\n");
+	if (config->bitplanes && config->apa102)
+		die("Bit planes are only for WS281x strips\n");
+	if (config->brightness > 31)
+		die("APA102 brightness %u is more than 31\n", config->brightness);
+	if (config->dmx & ~(LEDSCAPE_DMX_PRU0 | LEDSCAPE_DMX_PRU1))
+		die("dmx %#x is not a set of PRUs\n", config->dmx);
+	if (config->dmx_slots > LEDSCAPE_DMX_SLOTS)
+		die("%u DMX slots requested, at most %u supported\n",
+			config->dmx_slots,
+			LEDSCAPE_DMX_SLOTS
+		);
+	if (config->dmx_slots % 4)
+		die("%u DMX slots requested, but they are sent four to a row\n",
+			config->dmx_slots
+		);
+
+	if (num_strips > LEDSCAPE_NUM_STRIPS)
+		die("%u strips requested, at most %u supported\n",
+			num_strips,
+			LEDSCAPE_NUM_STRIPS
+		);
+
+	ledscape_t * const leds = calloc(1, sizeof(*leds));
+	unsigned * const slots = calloc(2 * num_frames, sizeof(*slots));
+	if (!leds || !slots)
+		die("calloc failed: %s\n", strerror(errno));
+
+	*leds = (ledscape_t) {
+		.num_strips	= num_strips,
+		.num_frames	= num_frames,
+		.format		= format,
+		.brightness	= config->brightness ? config->brightness : 31,
+		.dmx		= config->dmx,
+		.free		= { .slots = slots },
+		.ready		= { .slots = slots + num_frames },
+		.displayed	= -1,
+		.in_flight	= 1, // the startup response
+	};
+
+	pthread_mutex_init(&leds->telemetry_lock, NULL);
+
+	// Four slots of each universe fit in a pixel row, so a DMX
+	// universe is as long as a strip of that many pixels.
+	const unsigned dmx_slots = config->dmx_slots ? config->dmx_slots : LEDSCAPE_DMX_SLOTS;
+	const unsigned dmx_rows = dmx_slots / 4;
+	if (leds->dmx)
+		leds->dmx_slots = dmx_slots;
+
+	// The frame is as long as the longest strip
+	int use_pru1 = 0;
+	for (unsigned i = 0 ; i < num_strips ; i++)
+	{
+		const int dmx = leds->dmx & (1 << (i / STRIPS_PER_PRU));
+		unsigned len = config->strip_pixels
+			? config->strip_pixels[i]
+			: config->num_pixels;
+
+		if (dmx)
+			len = config->strip_pixels && !config->strip_pixels[i] ? 0 : dmx_rows;
+
+		// The pin clocks the other strips of its bank instead
+		if (!dmx && format == LEDSCAPE_FORMAT_APA102 && strip_pins[i].clock)
+			len = 0;
+
+		if (len && strip_pins[i].gpio == STRIP_NO_PIN)
+			die("strip %u has no pin in ws281x.pins\n", i);
+
+		leds->strip_pixels[i] = len;
+		if (len > leds->num_pixels)
+			leds->num_pixels = len;
+		if (len && i >= STRIPS_PER_PRU)
+			use_pru1 = 1;
+	}
+
+	leds->row_offset = calloc(leds->num_pixels + 1, sizeof(*leds->row_offset));
+	if (!leds->row_offset)
+		die("calloc failed: %s\n", strerror(errno));
+
+	ws281x_segment_t segments[2][LEDSCAPE_NUM_STRIPS];
+	unsigned num_segments[2];
+	const size_t frame_size = ledscape_layout(leds, segments, num_segments);
+
+	// Bit planes follow the frame ring, with a spare row for the
+	// prefetch past the last one.  PRUs sending DMX read the frame.
+	if (config->bitplanes)
+	{
+		leds->bitplanes = (use_pru1 ? 3 : 1) & ~leds->dmx;
+		leds->planes_offset = num_frames * frame_size;
+		leds->planes_size = (leds->num_pixels + 1) * PLANE_ROW_BYTES;
+		leds->plane_lut = calloc(2, sizeof(*leds->plane_lut));
+		if (!leds->plane_lut)
+			die("calloc failed: %s\n", strerror(errno));
+
+		for (unsigned pru = 0 ; pru < 2 ; pru++)
+		{
+			if (!(leds->bitplanes & (1 << pru)))
+				continue;
+
+			for (unsigned i = 0 ; i < STRIPS_PER_PRU ; i++)
+			{
+				const unsigned strip = pru * STRIPS_PER_PRU + i;
+				if (!leds->strip_pixels[strip])
+					continue;
+
+				const unsigned bank = strip_pins[strip].gpio == pru_banks[pru][0] ? 0 : 1;
+				for (unsigned ones = 0 ; ones < 256 ; ones++)
+					if (!(ones & (1 << (i % 8))))
+						leds->plane_lut[pru][i / 8][ones][bank] |= 1 << strip_pins[strip].pin;
+			}
+
+			for (unsigned i = 0 ; i < num_segments[pru] ; i++)
+				segments[pru][i].stride = PLANE_ROW_BYTES;
+		}
+	}
+
+	pru_t * const pru0 = pru_init(0);
+	pru_t * const pru1 = use_pru1 ? pru_init(1) : NULL;
+	const uint64_t pruss_ns = monotonic_ns();
+
+	if (num_frames * frame_size + 2 * leds->planes_size > pru0->ddr_size)
+		die("Pixel data needs at least %u * %zu + %zu, only %zu in DDR\n",
+			num_frames,
+			frame_size,
+			2 * leds->planes_size,
+			pru0->ddr_size
+		);
+
+	leds->pru0 = pru0;
+	leds->pru1 = pru1;
+	leds->frame_size = frame_size;
+
+	// DMX receivers expect a steady stream of whole packets
+	if (config->change_aware && !leds->dmx)
+	{
+		leds->shown = calloc(1, frame_size);
+		if (!leds->shown)
+			die("calloc failed: %s\n", strerror(errno));
+	}
+
+	// Whatever is in the DDR frames is stale until their first draw
+	if (config->shadow)
+	{
+		void * shadow;
+		if (posix_memalign(&shadow, 64, num_frames * frame_size) != 0)
+			die("Unable to allocate %u shadow frames of %zu bytes\n", num_frames, frame_size);
+		memset(shadow, 0, num_frames * frame_size);
+
+		leds->shadow = shadow;
+		leds->stale = calloc(num_frames, sizeof(*leds->stale));
+		if (!leds->stale)
+			die("calloc failed: %s\n", strerror(errno));
+		for (unsigned i = 0 ; i < num_frames ; i++)
+			leds->stale[i][1] = frame_size;
+	}
+
+	leds->ws281x_0 = pru0->data_ram;
+	leds->ws281x_1 = pru1 ? pru1->data_ram : NULL;
+
+	// Every frame starts out available to the producer
+	for (unsigned i = 0 ; i < num_frames ; i++)
+		ledscape_release(leds, i);
+
+	// Only configure the pins of the strips that are in use,
+	// a bank at a time
+	uint32_t gpio_masks[4] = { 0, 0, 0, 0 };
+	for (unsigned i = 0 ; i < num_strips ; i++)
+		if (leds->strip_pixels[i])
+			gpio_masks[strip_pins[i].gpio] |= 1 << strip_pins[i].pin;
+
+	// APA102 strips also need the clock of every bank they are on
+	uint32_t clock_masks[4] = { 0, 0, 0, 0 };
+	if (format == LEDSCAPE_FORMAT_APA102)
+	{
+		for (unsigned i = 0 ; i < LEDSCAPE_NUM_STRIPS ; i++)
+			if (strip_pins[i].clock)
+				clock_masks[strip_pins[i].gpio] |= 1 << strip_pins[i].pin;
+
+		for (unsigned pru = 0 ; pru < 2 ; pru++)
+		{
+			if (leds->dmx & (1 << pru))
+				continue;
+
+			for (unsigned bank = 0 ; bank < 2 ; bank++)
+			{
+				const uint8_t gpio = pru_banks[pru][bank];
+				if (gpio == STRIP_NO_PIN || !gpio_masks[gpio])
+					continue;
+				if (!clock_masks[gpio])
+					die("gpio%u has no clock pin in ws281x.pins\n", gpio);
+				gpio_masks[gpio] |= clock_masks[gpio];
+			}
+		}
+	}
+
+	pru_gpio_outputs(gpio_masks);
+	const uint64_t gpio_ns = monotonic_ns();
+
+	for (unsigned pru = 0 ; pru < 2 ; pru++)
+	{
+		ws281x_command_t * const cmd = pru ? leds->ws281x_1 : leds->ws281x_0;
+		if (!cmd)
+			continue;
+
+		// Kept so that the watchdog can re-arm a restarted PRU
+		ws281x_command_t * const armed = &leds->armed[pru];
+		*armed = (ws281x_command_t) {
+			.pixels_dma	= 0, // will be set in draw routine
+			.command	= 0,
+			.response	= 0,
+			.num_pixels	= leds->num_pixels,
+			.num_segments	= num_segments[pru],
+			.pixel_bits	= format == LEDSCAPE_FORMAT_GRB ? 24 : 32,
+			.end_clocks	= 32 + leds->num_pixels / 2,
+			.bit_planes	= (leds->bitplanes >> pru) & 1,
+		};
+		ws281x_timing_cycles(&armed->timing, timing, format);
+
+		// Only clock the banks that have strips on this PRU
+		for (unsigned bank = 0 ; bank < 2 && !(leds->dmx & (1 << pru)) ; bank++)
+		{
+			const uint8_t gpio = pru_banks[pru][bank];
+			if (gpio != STRIP_NO_PIN && gpio_masks[gpio] & ~clock_masks[gpio])
+				armed->clock_mask[bank] = clock_masks[gpio];
+		}
+
+		memcpy(armed->segment, segments[pru], num_segments[pru] * sizeof(*segments[pru]));
+	}
+
+	ledscape_frame_timeout(leds, timing);
+
+	if (!ledscape_start_pru(leds, 0))
+		die("pru0 did not respond\n");
+	const uint64_t pru0_ns = monotonic_ns();
+
+	if (pru1 && !ledscape_start_pru(leds, 1))
+		die("pru1 did not respond\n");
+
+	const uint64_t done_ns = monotonic_ns();
+	leds->drawn_ns = done_ns;
+	printf("%s: started in %"PRIu64" us (pruss %"PRIu64", gpio %"PRIu64", pru0 %"PRIu64", pru1 %"PRIu64")\n",
+		__func__,
+		(done_ns - start_ns) / 1000,
+		(pruss_ns - start_ns) / 1000,
+		(gpio_ns - pruss_ns) / 1000,
+		(pru0_ns - gpio_ns) / 1000,
+		(done_ns - pru0_ns) / 1000
+	);
+
+	return leds;
+}
+
+
+void
+ledscape_close(
+	ledscape_t * const leds
+)
+{
+	// Signal a halt command
+	leds->ws281x_0->command = 0xFF;
+	if (leds->ws281x_1)
+		leds->ws281x_1->command = 0xFF;
+	pru_close(leds->pru0);
+	if (leds->pru1)
+		pru_close(leds->pru1);
+}
+
+
+/** How the frames hold the pixels. */
+ledscape_format_t
+ledscape_format(
+	ledscape_t * const leds
+)
+{
+	return leds->format;
+}
+
+
+/** Global brightness of APA102 pixels, 1 to 31. */
+uint8_t
+ledscape_brightness(
+	ledscape_t * const leds
+)
+{
+	return leds->brightness;
+}
+
+
+/** Number of strips the LEDscape was configured with. */
+unsigned
+ledscape_num_strips(
+	ledscape_t * const leds
+)
+{
+	return leds->num_strips;
+}
+
+
+/** Length in pixels of the longest strip. */
+unsigned
+ledscape_num_pixels(
+	ledscape_t * const leds
+)
+{
+	return leds->num_pixels;
+}
+
+
+/** Length in pixels of one strip, 0 if it is not in use. */
+unsigned
+ledscape_strip_pixels(
+	ledscape_t * const leds,
+	const unsigned strip
+)
+{
+	return strip < leds->num_strips ? leds->strip_pixels[strip] : 0;
+}
+
+
+/** Start of the row holding pixel number `pixel` of every strip.
+ *
+ * Strip s is at index s of the row, for the strips that are at
+ * least pixel + 1 long.
+ */
+ledscape_pixel_t *
+ledscape_row(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const unsigned pixel
+)
+{
+	return (ledscape_pixel_t*)((uint8_t*) frame + leds->row_offset[pixel]);
+}
+
+
+/** Input channel (0 r, 1 g, 2 b) that goes out first, second and
+ * third on the wire for each color order.
+ */
+static const uint8_t wire_order[][3] = {
+	[LEDSCAPE_GRB] = { 1, 0, 2 },
+	[LEDSCAPE_RGB] = { 0, 1, 2 },
+	[LEDSCAPE_RBG] = { 0, 2, 1 },
+	[LEDSCAPE_GBR] = { 1, 2, 0 },
+	[LEDSCAPE_BRG] = { 2, 0, 1 },
+	[LEDSCAPE_BGR] = { 2, 1, 0 },
+};
+
+
+void
+ledscape_set_correction(
+	ledscape_t * const leds,
+	const unsigned strip,
+	const ledscape_correction_t * const c
+)
+{
+	if (strip >= leds->num_strips)
+		return;
+
+	if (!c)
+	{
+		free(leds->lut[strip]);
+		leds->lut[strip] = NULL;
+		return;
+	}
+
+	if ((unsigned) c->order >= sizeof(wire_order) / sizeof(*wire_order))
+		die("strip %u: invalid color order %d\n", strip, c->order);
+
+	ledscape_lut_t * lut = leds->lut[strip];
+	if (!lut)
+	{
+		lut = calloc(1, sizeof(*lut));
+		if (!lut)
+			die("calloc failed: %s\n", strerror(errno));
+	}
+
+	const float gamma = c->gamma > 0 ? c->gamma : 1;
+
+	// The PRU clocks out bits 23..0 of each pixel, so the first
+	// color on the wire lives in the top byte.
+	for (unsigned i = 0 ; i < 3 ; i++)
+	{
+		const unsigned channel = wire_order[c->order][2 - i];
+		const float gain = c->gain[channel] > 0 ? c->gain[channel] : 1;
+
+		lut->src[i] = channel;
+		for (unsigned v = 0 ; v < 256 ; v++)
+		{
+			const float out = 255 * gain * powf(v / 255.0f, gamma) + 0.5f;
+			lut->lut[i][v] = out > 255 ? 255 : out;
+		}
+
+		for (unsigned v = 0 ; v <= 256 ; v++)
+		{
+			const float in = v < 256 ? v * 256 / 65535.0f : 1;
+			const float out = 65535 * gain * powf(in, gamma) + 0.5f;
+			lut->curve[channel][v] = out > 65535 ? 65535 : out;
+		}
+	}
+
+	leds->lut[strip] = lut;
+}
+
+
+const ledscape_lut_t *
+ledscape_strip_lut(
+	ledscape_t * const leds,
+	const unsigned strip
+)
+{
+	return strip < leds->num_strips ? leds->lut[strip] : NULL;
+}
+
+
+void
+ledscape_set_color(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	uint32_t strip,
+	uint32_t pixel,
+	uint8_t r,
+	uint8_t g,
+	uint8_t b
+)
+{
+	if (strip >= leds->num_strips || pixel >= leds->strip_pixels[strip])
+		return;
+
+	// The frame holds DMX slots for those strips, not pixels
+	if (ledscape_is_dmx(leds, strip))
+		return;
+
+	ledscape_pixel_t * const p = ledscape_row(leds, frame, pixel) + strip;
+	const ledscape_lut_t * const lut = leds->lut[strip];
+	uint32_t word = b << 0 | r << 8 | g << 16;
+	if (lut)
+	{
+		const uint8_t rgb[3] = { r, g, b };
+		word = 0
+			| lut->lut[0][rgb[lut->src[0]]] << 0
+			| lut->lut[1][rgb[lut->src[1]]] << 8
+			| lut->lut[2][rgb[lut->src[2]]] << 16;
+	}
+
+	// Built in a register so that the frame is written once
+	*(uint32_t*)(void*) p = ledscape_pack(leds->format, leds->brightness, word);
+}
+
+
+/** Non-zero if a strip is sending a DMX universe. */
+int
+ledscape_is_dmx(
+	ledscape_t * const leds,
+	const unsigned universe
+)
+{
+	return universe < leds->num_strips
+		&& leds->strip_pixels[universe]
+		&& leds->dmx & (1 << (universe / STRIPS_PER_PRU));
+}
+
+
+void
+ledscape_dmx_set(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const unsigned universe,
+	const unsigned channel,
+	const uint8_t value
+)
+{
+	if (!ledscape_is_dmx(leds, universe) || channel >= leds->dmx_slots)
+		return;
+
+	uint8_t * const p = (uint8_t*) (ledscape_row(leds, frame, channel / 4) + universe);
+	p[channel % 4] = value;
+}
+
+
+void
+ledscape_dmx_universe(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const unsigned universe,
+	const uint8_t * const data,
+	size_t len
+)
+{
+	if (!ledscape_is_dmx(leds, universe))
+		return;
+	if (len > leds->dmx_slots)
+		len = leds->dmx_slots;
+
+	// Whole rows at a time, a word each; the slots past len are zero
+	for (unsigned row = 0 ; row < leds->dmx_slots / 4 ; row++)
+	{
+		uint32_t word = 0;
+		for (unsigned i = 0 ; i < 4 && 4 * row + i < len ; i++)
+			word |= (uint32_t) data[4 * row + i] << (8 * i);
+
+		*(uint32_t*)(void*) (ledscape_row(leds, frame, row) + universe) = word;
+	}
 }
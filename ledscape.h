@@ -1,7 +1,8 @@
 /** \file
  * LEDscape for the BeagleBone Black.
  *
- * Drives up to 32 ws281x LED strips using the PRU to have no CPU overhead.
+ * Drives up to 48 ws281x LED strips using the PRU to have no CPU overhead,
+ * or 44 APA102 clock and data strips, or 48 DMX512 universes.
  * Allows easy double buffering of frames.
  */
 
@@ -9,19 +10,31 @@
 #define _ledscape_h_
 
 #include <stdint.h>
+#include <stddef.h>
 
-/** The number of strips supported.
+/** The maximum number of strips supported.
  *
- * Changing this also requires changes in ws281x.p to stride the
- * correct number of bytes per row..
+ * PRU0 drives strips 0-23 and PRU1 strips 24-47.  The number of
+ * strips actually in use is set at init time and determines the
+ * row stride of the frame buffers.
  */
 #define LEDSCAPE_NUM_STRIPS 48
 
 
+/** PRUs for ledscape_config_t.dmx: PRU0 has strips 0-23, PRU1 24-47. */
+#define LEDSCAPE_DMX_PRU0 1
+#define LEDSCAPE_DMX_PRU1 2
+
+/** Slots in a full DMX512 universe, after the start code. */
+#define LEDSCAPE_DMX_SLOTS 512
+
+
 /** LEDscape pixel format is BRGA.
  *
  * data is laid out with BRGA format, since that is how it will
- * be translated during the clock out from the PRU.
+ * be translated during the clock out from the PRU.  RGBW strips
+ * take all four bytes as WBRG instead; see ledscape_rgbw().  APA102
+ * strips take them as RGB and the brightness; see ledscape_apa102().
  */
 typedef struct {
 	uint8_t b;
@@ -33,21 +46,169 @@ typedef struct {
 
 /** LEDscape frame buffer is "strip-major".
  *
- * All 32 strips worth of data for each pixel are stored adjacent.
- * This makes it easier to clock out while reading from the DDR
- * in a burst mode.
+ * All of the active strips' data for each pixel are stored adjacent,
+ * so with strips of equal length pixel p of strip s is at index
+ * p * num_strips + s.  This makes it easier to clock out while reading
+ * from the DDR in a burst mode.  With ragged strips the rows past the
+ * end of a strip get narrower, so use ledscape_set_color() rather than
+ * indexing the frame directly.
  */
-typedef struct {
-	ledscape_pixel_t strip[LEDSCAPE_NUM_STRIPS];
-} __attribute__((__packed__)) ledscape_frame_t;
+typedef struct ledscape_frame ledscape_frame_t;
 
 
 typedef struct ledscape ledscape_t;
 
 
+/** How the frames are packed for the strips; see ledscape_pack(). */
+typedef enum {
+	LEDSCAPE_FORMAT_GRB,	// WS281x, 24 bits of BRGA
+	LEDSCAPE_FORMAT_RGBW,	// SK6812 RGBW, 32 bits of WBRG
+	LEDSCAPE_FORMAT_APA102,	// APA102 and SK9822, 32 bits of RGB and brightness
+} ledscape_format_t;
+
+
+/** Bit timing of the LED chips.
+ *
+ * The PRUs read it from their command structure on every bit, so a
+ * rig can switch chips or be tuned without reassembling the firmware.
+ * ledscape_timing() looks up one of the named profiles; a custom one
+ * can shorten the bit period to what the chips on a rig tolerate, for
+ * a higher frame rate.  Times are rounded down to the 5 ns PRU cycle.
+ */
+typedef struct {
+	const char * name;
+	unsigned t0h_ns;	// high time of a 0 bit
+	unsigned t1h_ns;	// high time of a 1 bit
+	unsigned period_ns;	// whole bit
+	unsigned reset_ns;	// low time that latches the frame
+} ledscape_timing_t;
+
+
+/** Named profiles, ending with one with a NULL name. */
+extern const ledscape_timing_t ledscape_timings[];
+
+
+/** Profile called name, or NULL if there is none. */
+extern const ledscape_timing_t *
+ledscape_timing(
+	const char * name
+);
+
+
+/** Options for ledscape_init_config().
+ *
+ * Zeroed fields select the defaults, so designated initializers
+ * only need to name the interesting ones.
+ */
+typedef struct {
+	/** Length in pixels of the longest LED strip. */
+	unsigned num_pixels;
+
+	/** Length in pixels of each of the num_strips strips, 0 for an
+	 * unused one, or NULL for all of them num_pixels long.  The
+	 * frame is most compact with the longer strips on the lower
+	 * channels of each PRU.
+	 */
+	const unsigned * strip_pixels;
+
+	/** Number of strips in use, 1 to LEDSCAPE_NUM_STRIPS (default
+	 * all of them).  Strips 24 and up are driven by PRU1, so rigs
+	 * with fewer strips leave it idle.
+	 */
+	unsigned num_strips;
+
+	/** Number of frame buffers in the DDR ring (default 2). */
+	unsigned num_frames;
+
+	/** Compare each frame with what the strips already show, skip
+	 * drawing it if nothing changed and otherwise stop clocking out
+	 * after the last changed row.  Costs a read of the frame per
+	 * draw; worth it for network receivers that redraw on every
+	 * packet.
+	 */
+	int change_aware;
+
+	/** Render into frames in ordinary cached memory instead of the
+	 * uncached DDR that the PRUs read, and have ledscape_draw()
+	 * copy each one out in a single sequential pass.  Effects that
+	 * read back the frame, or write it a pixel at a time, then run
+	 * at cache speed.  With change_aware as well, only the bytes
+	 * that changed since the DDR frame was last drawn are copied.
+	 * Costs num_frames frames of RAM.
+	 */
+	int shadow;
+
+	/** Drive SK6812 style RGBW strips: every strip is clocked out
+	 * 32 bits per pixel and the conversions into the frame pull the
+	 * common white out of r, g and b into the fourth byte.
+	 */
+	int rgbw;
+
+	/** Drive APA102 or SK9822 clock and data strips.  The strips on
+	 * each GPIO bank share the pin marked "clock" in ws281x.pins,
+	 * so the strips on those pins are not driven.  The bits go out
+	 * as fast as the PRUs can clock them.
+	 */
+	int apa102;
+
+	/** Global brightness of APA102 strips, 1 to 31 (default 31).
+	 * The chips dim by it on top of the 8 bits of each color.
+	 */
+	unsigned brightness;
+
+	/** PRUs that send DMX512 instead of driving LED strips, any of
+	 * LEDSCAPE_DMX_PRU0 and LEDSCAPE_DMX_PRU1.  Each of their strip
+	 * pins sends a universe, numbered as the strip, through an RS-485
+	 * transceiver; strip_pixels only selects which are in use.  The
+	 * other PRU, if any, drives LED strips as usual.  Universes are
+	 * always sent whole, so change_aware is ignored.
+	 */
+	unsigned dmx;
+
+	/** Slots in each DMX universe, a multiple of 4 (default
+	 * LEDSCAPE_DMX_SLOTS, which refresh at 44 Hz).
+	 */
+	unsigned dmx_slots;
+
+	/** Transpose every drawn frame on the ARM, with NEON where it is
+	 * available, into the masks of the pins to bring low on each bit.
+	 * The PRUs then only load and store those instead of testing
+	 * every strip on every bit, which leaves room for tighter bit
+	 * timings.  Costs the transpose on each draw and two buffers of
+	 * 512 bytes per pixel row in the DDR.  WS281x and RGBW strips
+	 * only; PRUs sending DMX read the frame as usual.
+	 */
+	int bitplanes;
+
+	/** Bit timing of the chips, NULL for the "ws2812" profile, or
+	 * "apa102" for clock and data strips.  Those only take the
+	 * period, as a floor on the bit time for long clock lines.
+	 */
+	const ledscape_timing_t * timing;
+} ledscape_config_t;
+
+
 extern ledscape_t *
 ledscape_init(
-	unsigned num_pixels
+	unsigned num_pixels,
+	unsigned num_strips
+);
+
+
+extern ledscape_t *
+ledscape_init_config(
+	const ledscape_config_t * const config
+);
+
+
+/** Switch the bit timing of a running rig.
+ *
+ * The PRUs pick it up on the next bit, so call it between frames.
+ */
+extern void
+ledscape_set_timing(
+	ledscape_t * const leds,
+	const ledscape_timing_t * const timing
 );
 
 
@@ -58,15 +219,107 @@ ledscape_frame(
 );
 
 
-extern void
+extern unsigned
 ledscape_draw(
 	ledscape_t * const leds,
 	unsigned frame
 );
 
 
+/** Frame ring.
+ *
+ * A producer thread acquires free frames, renders into them and
+ * submits them in order.  The consumer draws them with
+ * ledscape_present(), or takes them with ledscape_next() and hands
+ * them back with ledscape_release() once the PRU is done with them.
+ * The handoff is lock free; the blocking calls sleep on a futex and
+ * return -1 after timeout_ms (-1 waits forever).
+ */
+extern int
+ledscape_acquire(
+	ledscape_t * const leds,
+	int timeout_ms
+);
+
+
+extern void
+ledscape_submit(
+	ledscape_t * const leds,
+	unsigned frame
+);
+
+
+extern int
+ledscape_next(
+	ledscape_t * const leds,
+	int timeout_ms
+);
+
+
+extern void
+ledscape_release(
+	ledscape_t * const leds,
+	unsigned frame
+);
+
+
+extern int
+ledscape_present(
+	ledscape_t * const leds,
+	int timeout_ms
+);
+
+
+/** Frame pacer.
+ *
+ * Runs acquire/render/submit/present in a thread of its own at a
+ * fixed rate, or as fast as the PRU allows when fps is 0.  now_ns
+ * is CLOCK_MONOTONIC at the tick and dt_ns the time since the
+ * previous one.  The callback runs on the pacer thread.
+ */
+typedef void (*ledscape_render_fn)(
+	ledscape_t * leds,
+	ledscape_frame_t * frame,
+	uint64_t now_ns,
+	uint64_t dt_ns,
+	void * arg
+);
+
+typedef struct ledscape_pacer ledscape_pacer_t;
+
+typedef struct {
+	uint64_t frames;	// frames presented
+	uint64_t missed;	// ticks skipped because a frame ran late
+	uint64_t last_frame_ns; // render to end of present, last frame
+	uint64_t max_frame_ns;	// and the worst seen
+} ledscape_pacer_stats_t;
+
+
+extern ledscape_pacer_t *
+ledscape_pacer_start(
+	ledscape_t * const leds,
+	unsigned fps,
+	ledscape_render_fn render,
+	void * arg
+);
+
+
+extern void
+ledscape_pacer_stats(
+	ledscape_pacer_t * const pacer,
+	ledscape_pacer_stats_t * const stats
+);
+
+
+extern void
+ledscape_pacer_stop(
+	ledscape_pacer_t * const pacer
+);
+
+
 extern void
 ledscape_set_color(
+	ledscape_t * const leds,
 	ledscape_frame_t * const frame,
 	uint32_t strip,
 	uint32_t pixel,
@@ -76,12 +329,424 @@ ledscape_set_color(
 );
 
 
+/** Order in which a strip's chips expect the colors on the wire. */
+typedef enum {
+	LEDSCAPE_GRB = 0, // WS2812 and most WS2811 strips
+	LEDSCAPE_RGB,
+	LEDSCAPE_RBG,
+	LEDSCAPE_GBR,
+	LEDSCAPE_BRG,
+	LEDSCAPE_BGR,
+} ledscape_order_t;
+
+
+/** Per-strip color correction.
+ *
+ * Zeroed fields select the defaults: linear response, unity gain
+ * and GRB order.  Gain scales each channel after the gamma curve,
+ * for white balance or to limit the current of a strip.
+ */
+typedef struct {
+	float gamma;
+	float gain[3]; // r, g, b
+	ledscape_order_t order;
+} ledscape_correction_t;
+
+
+/** Correction compiled into lookup tables.
+ *
+ * Byte i of the frame pixel (b, r, g for a GRB strip) is
+ * lut[i][rgb[src[i]]], where rgb is the input r, g, b triple.
+ * curve has the same gamma and gain for 16 bit input channels, every
+ * 256th value, for the dither to interpolate.
+ */
+typedef struct {
+	uint8_t src[3];
+	uint8_t lut[3][256];
+	uint16_t curve[3][257]; // r, g, b
+} ledscape_lut_t;
+
+
+/** Apply a correction to one strip, or remove it if correction is NULL.
+ *
+ * It is applied by ledscape_set_color() and the blits in the same
+ * pass that converts the pixels into the frame.
+ */
+extern void
+ledscape_set_correction(
+	ledscape_t * const leds,
+	unsigned strip,
+	const ledscape_correction_t * const correction
+);
+
+
+/** Lookup tables of a strip, or NULL if it is uncorrected. */
+extern const ledscape_lut_t *
+ledscape_strip_lut(
+	ledscape_t * const leds,
+	unsigned strip
+);
+
+
+/** Layout of the frames, for code that fills them directly. */
+extern ledscape_format_t
+ledscape_format(
+	ledscape_t * const leds
+);
+
+
+/** Global brightness that APA102 pixels are packed with. */
+extern uint8_t
+ledscape_brightness(
+	ledscape_t * const leds
+);
+
+
+extern unsigned
+ledscape_num_strips(
+	ledscape_t * const leds
+);
+
+
+extern unsigned
+ledscape_num_pixels(
+	ledscape_t * const leds
+);
+
+
+extern unsigned
+ledscape_strip_pixels(
+	ledscape_t * const leds,
+	unsigned strip
+);
+
+
+extern ledscape_pixel_t *
+ledscape_row(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	unsigned pixel
+);
+
+
+/** Convert a BRGA pixel word for an RGBW strip.
+ *
+ * The white channel takes the part common to all three colors, which
+ * the RGB channels then drop, and the word is shifted so that the
+ * PRU clocks it out last: GRBW on the wire, WBRG in memory.  Apply
+ * it after any color correction; the conversions into the frame do
+ * this themselves when the rig is RGBW.
+ */
+static inline uint32_t
+ledscape_rgbw(
+	uint32_t brg
+)
+{
+	uint32_t w = brg & 0xFF;
+	if (((brg >> 8) & 0xFF) < w)
+		w = (brg >> 8) & 0xFF;
+	if (((brg >> 16) & 0xFF) < w)
+		w = (brg >> 16) & 0xFF;
+
+	return (brg - w * 0x010101) << 8 | w;
+}
+
+
+/** Convert a BRGA pixel word for an APA102 strip.
+ *
+ * The chips take 0xE0 with the 5 bit global brightness, then blue,
+ * green and red, which the PRU clocks out from the top byte.  Like
+ * ledscape_rgbw() this comes after any color correction, whose order
+ * is relative to these chips' own: the default GRB is BGR here.
+ */
+static inline uint32_t
+ledscape_apa102(
+	uint32_t brg,
+	uint8_t brightness
+)
+{
+	return 0
+		| (uint32_t)(0xE0 | brightness) << 24
+		| (brg & 0xFF) << 16
+		| ((brg >> 16) & 0xFF) << 8
+		| ((brg >> 8) & 0xFF) << 0;
+}
+
+
+/** Pack a BRGA pixel word in the format of the frames. */
+static inline uint32_t
+ledscape_pack(
+	ledscape_format_t format,
+	uint8_t brightness,
+	uint32_t brg
+)
+{
+	switch (format)
+	{
+	case LEDSCAPE_FORMAT_RGBW: return ledscape_rgbw(brg);
+	case LEDSCAPE_FORMAT_APA102: return ledscape_apa102(brg, brightness);
+	default: return brg;
+	}
+}
+
+
+/** Non-zero if a strip number is a DMX universe in use. */
+extern int
+ledscape_is_dmx(
+	ledscape_t * const leds,
+	unsigned universe
+);
+
+
+/** Set one slot of a DMX universe, channel 0 being slot 1.
+ *
+ * The frame is channel-major for the DMX PRUs: each pixel row holds
+ * four consecutive slots of every universe, one per byte, in the
+ * order that they are sent.
+ */
+extern void
+ledscape_dmx_set(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	unsigned universe,
+	unsigned channel,
+	uint8_t value
+);
+
+
+/** Copy the slots of a DMX universe into the frame.
+ *
+ * data holds up to len slots, starting with slot 1 after the start
+ * code; the rest of the universe is zeroed.
+ */
+extern void
+ledscape_dmx_universe(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	unsigned universe,
+	const uint8_t * data,
+	size_t len
+);
+
+
+/** Bulk RGB24 conversion.
+ *
+ * Much faster than a ledscape_set_color() call per pixel; see blit.c.
+ * ledscape_blit_strips() takes strip-major data, num_pixels pixels
+ * starting at first_strip with ledscape_num_pixels() per strip.
+ * ledscape_blit_rows() takes pixel-major data, num_rows rows of
+ * ledscape_num_strips() pixels.
+ */
+extern void
+ledscape_blit_strips(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	unsigned first_strip,
+	const uint8_t * rgb,
+	size_t num_pixels
+);
+
+
+extern void
+ledscape_blit_rows(
+	ledscape_t * const leds,
+	ledscape_frame_t * const frame,
+	const uint8_t * rgb,
+	unsigned num_rows
+);
+
+
+/** Temporal dithering of 16 bit per channel input.
+ *
+ * Holds a 16 bit target for every pixel and rounds it into each
+ * frame that ledscape_dither_render() fills, carrying the remainder
+ * into the next one; see dither.c.
+ */
+typedef struct ledscape_dither ledscape_dither_t;
+
+
+extern ledscape_dither_t *
+ledscape_dither_init(
+	ledscape_t * const leds
+);
+
+
+extern void
+ledscape_dither_set(
+	ledscape_dither_t * const dither,
+	unsigned strip,
+	unsigned pixel,
+	uint16_t r,
+	uint16_t g,
+	uint16_t b
+);
+
+
+extern void
+ledscape_dither_rows(
+	ledscape_dither_t * const dither,
+	const uint16_t * rgb,
+	unsigned num_rows
+);
+
+
+extern void
+ledscape_dither_render(
+	ledscape_dither_t * const dither,
+	ledscape_frame_t * const frame
+);
+
+
+extern void
+ledscape_dither_close(
+	ledscape_dither_t * const dither
+);
+
+
+/** Shared memory frame ring.
+ *
+ * Lets renderers in other processes on the BeagleBone hand frames to
+ * a receiver without going through a socket; see shm.c.  The object
+ * starts with this header, which is laid out for other languages to
+ * map as well; the slots of strip-major RGB start at data_offset.
+ */
+#define LEDSCAPE_SHM_NAME	"/ledscape"
+#define LEDSCAPE_SHM_MAGIC	0x5344454C // "LEDS"
+#define LEDSCAPE_SHM_VERSION	1
+#define LEDSCAPE_SHM_SLOTS	4
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_pixels;	// per strip
+	uint32_t num_strips;
+	uint32_t num_slots;
+	uint32_t slot_size;	// num_pixels * num_strips * 3 bytes
+	uint32_t data_offset;	// of slot 0, from the start of the object
+	volatile uint32_t published; // newest complete frame; futex
+	volatile uint32_t consumed; // newest frame the receiver took; futex
+	volatile uint32_t seq[LEDSCAPE_SHM_SLOTS]; // odd while written
+} ledscape_shm_header_t;
+
+typedef struct ledscape_shm ledscape_shm_t;
+
+
+extern ledscape_shm_t *
+ledscape_shm_create(
+	const char * const name,
+	unsigned num_pixels,
+	unsigned num_strips
+);
+
+
+extern ledscape_shm_t *
+ledscape_shm_open(
+	const char * const name
+);
+
+
+extern const ledscape_shm_header_t *
+ledscape_shm_header(
+	const ledscape_shm_t * const shm
+);
+
+
+extern uint8_t *
+ledscape_shm_begin(
+	ledscape_shm_t * const shm,
+	int timeout_ms
+);
+
+
+extern void
+ledscape_shm_publish(
+	ledscape_shm_t * const shm
+);
+
+
+extern const uint8_t *
+ledscape_shm_read(
+	ledscape_shm_t * const shm,
+	int timeout_ms
+);
+
+
+extern int
+ledscape_shm_done(
+	ledscape_shm_t * const shm
+);
+
+
+extern void
+ledscape_shm_close(
+	ledscape_shm_t * const shm
+);
+
+
 extern uint32_t
 ledscape_wait(
 	ledscape_t * const leds
 );
 
 
+/** Clock-out telemetry.
+ *
+ * Both PRUs time stamp every frame on a timer they share and count
+ * the cycles that they stalled waiting on memory.  ledscape_wait()
+ * collects them into a window of the last LEDSCAPE_TELEMETRY_FRAMES
+ * frames.  Histogram bucket i counts the frames with a value below
+ * 2^i and at least 2^(i-1); bucket 0 counts zeros.
+ */
+#define LEDSCAPE_TELEMETRY_FRAMES 256
+#define LEDSCAPE_HIST_BUCKETS 32
+
+typedef struct {
+	uint32_t clock_ns[2];	// clock out time on each PRU, 0 if idle
+	int32_t skew_ns;	// PRU1 start minus PRU0 start
+	uint32_t stall_cycles[2]; // cycles stalled on memory
+} ledscape_frame_timing_t;
+
+typedef struct {
+	uint64_t frames;	// frames timed since init
+	unsigned window;	// frames in the histograms
+	unsigned restarts;	// times the watchdog reloaded the PRUs
+	ledscape_frame_timing_t last;
+
+	// Over the window: the slower PRU's clock out time, the
+	// absolute skew and the stalls of both PRUs together.
+	uint32_t max_clock_ns;
+	uint32_t max_skew_ns;
+	uint32_t max_stall_cycles;
+	uint32_t clock_hist[LEDSCAPE_HIST_BUCKETS];
+	uint32_t skew_hist[LEDSCAPE_HIST_BUCKETS];
+	uint32_t stall_hist[LEDSCAPE_HIST_BUCKETS];
+} ledscape_telemetry_t;
+
+
+extern void
+ledscape_telemetry(
+	ledscape_t * const leds,
+	ledscape_telemetry_t * const telemetry
+);
+
+
+/** Wait at most timeout_ms (-1 forever) for the frame to finish.
+ * \returns the response code, or 0 on timeout.
+ */
+extern uint32_t
+ledscape_wait_timeout(
+	ledscape_t * const leds,
+	int timeout_ms
+);
+
+
+/** Pollable fd that is readable when the PRUs signal end of frame. */
+extern int
+ledscape_wait_fd(
+	ledscape_t * const leds
+);
+
+
 extern void
 ledscape_close(
 	ledscape_t * const leds
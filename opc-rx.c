@@ -83,6 +83,10 @@ main(
 	int port = 7890;
 	int led_count = 64;
 	int frame_rate = 30;
+	int rgbw = 0;
+	int apa102 = 0;
+	unsigned brightness = 0;
+	const ledscape_timing_t * timing = NULL;
 
 	extern char *optarg;
 	int opt;
@@ -101,7 +105,7 @@ main(
 
 	fprintf(stderr, "OpenPixelControl LEDScape Receiver\n\n");
 	
-	while ((opt = getopt(argc, argv, "p:c:d:w:r:f:t:ls:")) != -1)
+	while ((opt = getopt(argc, argv, "p:c:d:w:r:f:t:ls:WAB:T:")) != -1)
 	{
 		switch (opt)
 		{
@@ -154,8 +158,24 @@ main(
 				printf("Serial port opened: %s\n", optarg);
 			break;
 
+		case 'W':
+			rgbw = 1;
+			break;
+		case 'A':
+			apa102 = 1;
+			break;
+		case 'B':
+			brightness = atoi(optarg);
+			if (brightness < 1 || brightness > 31)
+				die("-B must be 1 to 31\n");
+			break;
+		case 'T':
+			timing = ledscape_timing(optarg);
+			if (!timing)
+				die("-T %s is not a timing profile\n", optarg);
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>] [-w <output file>] [-r <input file> [-f <frame rate>][-l(oop)] [-t <lamp test 0-255>]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>] [-w <output file>] [-r <input file> [-f <frame rate>][-l(oop)] [-t <lamp test 0-255>] [-W(RGBW strips)] [-A(PA102 strips) [-B <brightness 1-31>]] [-T <timing profile>]\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -176,7 +196,16 @@ main(
 	if (sizeof(buf) < image_size + 1)
 		die("%u too large for UDP\n", image_size);
 
-	ledscape_t * const leds = ledscape_init(led_count);
+	// Only clock out what changed since the last packet
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= led_count,
+		.num_strips	= LEDSCAPE_NUM_STRIPS,
+		.change_aware	= 1,
+		.rgbw		= rgbw,
+		.apa102		= apa102,
+		.brightness	= brightness,
+		.timing		= timing,
+	});
 
 	struct timeval t;
 	gettimeofday(&t, NULL);
@@ -187,11 +216,14 @@ main(
 
 	ledscape_frame_t * const frame = ledscape_frame(leds, 0);
 
-	// initial value (perhaps lamp test was specified)
-	memset(frame, lampTest, led_count * LEDSCAPE_NUM_STRIPS * 4);
-	//ledscape_set_color(frame, 0, 255, 255, 0, 0);
-	//ledscape_set_color(frame, 0, 256, 0, 255, 0);
-	//ledscape_set_color(frame, 0, 257, 0, 0, 255);
+	// initial value (perhaps lamp test was specified); set through
+	// ledscape_set_color() so that RGBW and APA102 pixels are packed
+	for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
+		for (int pixel = 0 ; pixel < led_count ; pixel++)
+			ledscape_set_color(leds, frame, strip, pixel, lampTest, lampTest, lampTest);
+	//ledscape_set_color(leds, frame, 0, 255, 255, 0, 0);
+	//ledscape_set_color(leds, frame, 0, 256, 0, 255, 0);
+	//ledscape_set_color(leds, frame, 0, 257, 0, 0, 255);
 	ledscape_draw(leds, 0);
 	if (fromfile)
 		printf("Playing\n");
@@ -264,11 +296,7 @@ main(
 
 //printf("Ch %d: %db\n", cmd.channel, cmd_len);
 
-			for (unsigned int i=0; i<cmd_len/3; i++) {
-				const uint8_t * const in = &buf[3*i];
-			        ledscape_set_color(frame, cmd.channel + i / led_count, i % led_count, 
-							in[0], in[1], in[2]);
- 			}
+			ledscape_blit_strips(leds, frame, cmd.channel, buf, cmd_len / 3);
 
 //			ledscape_wait(leds);
 			ledscape_draw(leds, 0);
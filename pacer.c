@@ -0,0 +1,173 @@
+/** \file
+ * Frame pacing for the LEDscape.
+ *
+ * Runs the render/draw loop in its own thread, either locked to a
+ * target frame rate or as fast as the PRU can clock frames out.
+ * The application only supplies a render callback.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ledscape.h"
+#include "util.h"
+
+
+struct ledscape_pacer
+{
+	ledscape_t * leds;
+	ledscape_render_fn render;
+	void * arg;
+	uint64_t period_ns; // 0 == as fast as the PRU allows
+
+	pthread_t thread;
+	volatile int running;
+
+	pthread_mutex_t lock; // protects stats
+	ledscape_pacer_stats_t stats;
+};
+
+
+static void
+sleep_until(
+	const uint64_t deadline_ns
+)
+{
+	const struct timespec ts = {
+		.tv_sec		= deadline_ns / 1000000000ULL,
+		.tv_nsec	= deadline_ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+
+static void *
+pacer_thread(
+	void * const arg
+)
+{
+	ledscape_pacer_t * const pacer = arg;
+	ledscape_t * const leds = pacer->leds;
+	const uint64_t period = pacer->period_ns;
+
+	uint64_t deadline = monotonic_ns();
+	uint64_t last = deadline;
+
+	while (__atomic_load_n(&pacer->running, __ATOMIC_ACQUIRE))
+	{
+		if (period)
+			sleep_until(deadline);
+
+		// Render as late as possible so that the frame is fresh
+		// when the PRU starts clocking it out.
+		const uint64_t now = monotonic_ns();
+		const int frame_num = ledscape_acquire(leds, -1);
+
+		pacer->render(
+			leds,
+			ledscape_frame(leds, frame_num),
+			now,
+			now - last,
+			pacer->arg
+		);
+		last = now;
+
+		ledscape_submit(leds, frame_num);
+		ledscape_present(leds, -1);
+
+		const uint64_t drawn = monotonic_ns();
+		unsigned missed = 0;
+
+		if (period)
+		{
+			// If rendering or waiting for the PRU ran past the next
+			// tick, skip the ticks that are already gone instead of
+			// trying to catch up with a burst of frames.
+			deadline += period;
+			while (deadline <= drawn)
+			{
+				deadline += period;
+				missed++;
+			}
+		}
+
+		pthread_mutex_lock(&pacer->lock);
+		pacer->stats.frames++;
+		pacer->stats.missed += missed;
+		pacer->stats.last_frame_ns = drawn - now;
+		if (pacer->stats.last_frame_ns > pacer->stats.max_frame_ns)
+			pacer->stats.max_frame_ns = pacer->stats.last_frame_ns;
+		pthread_mutex_unlock(&pacer->lock);
+	}
+
+	return NULL;
+}
+
+
+/** Start calling render() for every frame.
+ *
+ * fps of 0 draws as fast as the PRU allows; otherwise frames are
+ * presented on a fixed CLOCK_MONOTONIC schedule.  The pacer owns
+ * the frame ring while it runs, so the application must not call
+ * ledscape_draw() or ledscape_present() itself.
+ */
+ledscape_pacer_t *
+ledscape_pacer_start(
+	ledscape_t * const leds,
+	const unsigned fps,
+	ledscape_render_fn render,
+	void * const arg
+)
+{
+	ledscape_pacer_t * const pacer = calloc(1, sizeof(*pacer));
+	if (!pacer)
+		die("calloc failed: %s\n", strerror(errno));
+
+	*pacer = (ledscape_pacer_t) {
+		.leds		= leds,
+		.render		= render,
+		.arg		= arg,
+		.period_ns	= fps ? 1000000000ULL / fps : 0,
+		.running	= 1,
+	};
+
+	pthread_mutex_init(&pacer->lock, NULL);
+
+	const int rc = pthread_create(&pacer->thread, NULL, pacer_thread, pacer);
+	if (rc != 0)
+		die("pthread_create failed: %s\n", strerror(rc));
+
+	return pacer;
+}
+
+
+/** Snapshot of the frame and missed deadline counters. */
+void
+ledscape_pacer_stats(
+	ledscape_pacer_t * const pacer,
+	ledscape_pacer_stats_t * const stats
+)
+{
+	pthread_mutex_lock(&pacer->lock);
+	*stats = pacer->stats;
+	pthread_mutex_unlock(&pacer->lock);
+}
+
+
+/** Stop the pacer after the frame in progress and free it. */
+void
+ledscape_pacer_stop(
+	ledscape_pacer_t * const pacer
+)
+{
+	__atomic_store_n(&pacer->running, 0, __ATOMIC_RELEASE);
+	pthread_join(pacer->thread, NULL);
+	pthread_mutex_destroy(&pacer->lock);
+	free(pacer);
+}
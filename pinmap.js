@@ -108,23 +108,18 @@ pinData.forEach(function(d){
 	pinsByGpioBankAndBit[d.gpioBank][d.gpioBit] = d; 
 });
 
-var bitsUsedByBank = [
-	[2, 3, /*4, 5,*/ 7, 8, 9, 10, 11, 14, 20, 22, 23, 26, 27, 30, 31],
-	[12, 13, 14, 15, 16, 17, 18, 19, 28],
-
-	[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 22, 23, /*24,*/ 25],
-	[14, 15, 16, 17]
-];
-
-var channelIndex = 0;
+// The strip order comes from the table that pinmap.pl generates from
+// ws281x.pins, so run make first.
+var pinTable = require('fs').readFileSync(__dirname + '/ws281x_pins.h', 'utf8');
+var stripPinRe = /\{\s*(\d+),\s*(\d+),\s*\d+\s*\},\s*\/\/\s*(\d+):/g;
 var totalUsedPinCount = 0;
-bitsUsedByBank.forEach(function(usedInBank, bankNum){
-	usedInBank.forEach(function(bitNum){
-		totalUsedPinCount ++;
-		pinsByGpioBankAndBit[bankNum][bitNum].used = true;
-		pinsByGpioBankAndBit[bankNum][bitNum].channelIndex = channelIndex++;
-	});
-})
+var match;
+while ((match = stripPinRe.exec(pinTable))) {
+	var pin = pinsByGpioBankAndBit[match[1]][match[2]];
+	totalUsedPinCount ++;
+	pin.used = true;
+	pin.channelIndex = +match[3];
+}
 
 var p8verified = [ // p8
 	0,  0, // 1
@@ -0,0 +1,232 @@
+#!/usr/bin/perl
+# Compile the LEDscape pin table into the PRU pin tests and C tables.
+#
+# Usage: pinmap.pl ws281x.pins ws281x
+#
+# Reads the pin table (see ws281x.pins) and writes:
+#
+#   ws281x_0_pins.hp, ws281x_1_pins.hp
+#	The GPIO banks and the TEST_BIT sequences of each PRU program
+#   ws281x_pins.h
+#	strip_pins[] and pru_banks[] for ledscape.c
+#
+# The PRU includes are shared by the ws281x and apa102 programs.  A pin
+# marked "clock" is a strip like any other for the WS281x, and the
+# shared clock of its bank for clock and data strips like the APA102;
+# the library passes the clock pins to the apa102 programs.
+#
+# Each PRU clocks out up to 24 strips, and every GPIO bank that it
+# drives costs a set, a clear and a zeros write on the OCP bus per
+# bit.  So whole banks are assigned to the PRUs, at most two each,
+# choosing the split that drives the most pins with the fewest banks.
+#
+use strict;
+use warnings;
+
+my $STRIPS_PER_PRU = 24;
+my $EARLY_TESTS = 16; # strips tested from the first load of registers
+my @GPIO = qw(GPIO0 GPIO1 GPIO2 GPIO3);
+
+@ARGV == 2
+	or die "Usage: $0 <pin table> <output base name>\n";
+my ($table, $base) = @ARGV;
+
+# Read the table, keeping the pins of each bank in file order
+my @bank_pins = ([], [], [], []);
+my %seen;
+open my $in, '<', $table
+	or die "$table: $!\n";
+while (<$in>)
+{
+	s/#.*//;
+	next unless /\S/;
+
+	my ($name, $bank, $bit, $clock) = /^\s*(\S+)\s+gpio([0-3])_(\d+)(\s+clock)?\s*$/
+		or die "$table:$.: expected '<header pin> gpio<bank>_<bit> [clock]'\n";
+	die "$table:$.: gpio${bank}_$bit has no such bit\n"
+		if $bit > 31;
+	die "$table:$.: gpio${bank}_$bit is listed twice\n"
+		if $seen{"$bank/$bit"}++;
+
+	die "$table:$.: gpio$bank already has a clock\n"
+		if $clock && grep { $_->{clock} } @{$bank_pins[$bank]};
+
+	push @{$bank_pins[$bank]}, {
+		name	=> $name,
+		bank	=> $bank,
+		bit	=> $bit,
+		clock	=> $clock ? 1 : 0,
+	};
+}
+close $in;
+
+
+# Try every assignment of the banks to PRU0, PRU1 or neither, with at
+# most two banks per PRU.  Prefer the most pins driven, then the fewest
+# banks, then the most pins on PRU0, so that small rigs number their
+# strips from 0 and may leave PRU1 idle, then the lower banks on PRU0.
+my $best;
+for my $code (0 .. 3**4 - 1)
+{
+	my @banks = ([], []);
+	my $c = $code;
+	for my $bank (0 .. 3)
+	{
+		my $pru = $c % 3;
+		$c = int($c / 3);
+		push @{$banks[$pru]}, $bank if $pru < 2 && @{$bank_pins[$bank]};
+	}
+	next if @{$banks[0]} > 2 || @{$banks[1]} > 2;
+
+	my @pins = (0, 0);
+	for my $pru (0, 1)
+	{
+		my $n = 0;
+		$n += @{$bank_pins[$_]} for @{$banks[$pru]};
+		$pins[$pru] = $n < $STRIPS_PER_PRU ? $n : $STRIPS_PER_PRU;
+	}
+
+	# The last term reads PRU0's banks as digits, lower is better
+	my @score = (
+		$pins[0] + $pins[1],
+		-(@{$banks[0]} + @{$banks[1]}),
+		$pins[0],
+		-join('', @{$banks[0]}, 9),
+	);
+
+	my $better = !$best;
+	for my $i (0 .. $#score)
+	{
+		last if $better;
+		last if $score[$i] < $best->{score}[$i];
+		$better = $score[$i] > $best->{score}[$i];
+	}
+
+	$best = { score => \@score, banks => \@banks } if $better;
+}
+
+
+# Strips of each PRU: bank A's pins, then bank B's, in file order
+my @strips;
+for my $pru (0, 1)
+{
+	my @pins = map { @{$bank_pins[$_]} } @{$best->{banks}[$pru]};
+	if (@pins > $STRIPS_PER_PRU)
+	{
+		warn "$table: PRU$pru has more than $STRIPS_PER_PRU pins; dropping "
+			. join(' ', map { $_->{name} } @pins[$STRIPS_PER_PRU .. $#pins])
+			. "\n";
+		splice @pins, $STRIPS_PER_PRU;
+	}
+
+	$strips[$pru] = \@pins;
+}
+
+my $header = "Generated by pinmap.pl from $table; do not edit.";
+
+
+# The PRU programs test the strips' bits into a_zeros or b_zeros;
+# r10-r25 hold the first 16 strips and r10-r17 the next 8.
+for my $pru (0, 1)
+{
+	my @banks = @{$best->{banks}[$pru]};
+	my @slot = ('a', 'b');
+	my %slot_of = map { $banks[$_] => $slot[$_] } 0 .. $#banks;
+
+	my $file = "${base}_${pru}_pins.hp";
+	open my $out, '>', $file
+		or die "$file: $!\n";
+
+	print $out "// $header\n\n";
+	printf $out "// PRU%d drives %d strip%s on %s\n",
+		$pru,
+		scalar @{$strips[$pru]},
+		@{$strips[$pru]} == 1 ? '' : 's',
+		@banks ? join(' and ', map { $GPIO[$_] } @banks) : 'no bank';
+	printf $out "#define GPIO_BANKS %d\n", scalar @banks;
+	printf $out "#define GPIO_A %s\n", $GPIO[@banks ? $banks[0] : 0];
+	printf $out "#define GPIO_B %s\n", @banks > 1 ? $GPIO[$banks[1]] : 'GPIO_A // not driven';
+
+	my @tests = ('', '');
+	my $list = '';
+	for my $i (0 .. $#{$strips[$pru]})
+	{
+		my $pin = $strips[$pru][$i];
+		my $reg = 10 + ($i < $EARLY_TESTS ? $i : $i - $EARLY_TESTS);
+		$tests[$i < $EARLY_TESTS ? 0 : 1] .= sprintf " \\\n\tTEST_BIT(r%d, %s, %d, %d)",
+			$reg,
+			$slot_of{$pin->{bank}},
+			$pin->{bit},
+			$i;
+		$list .= sprintf "//  %2d: %s gpio%d_%d\n",
+			$i,
+			$pin->{name},
+			$pin->{bank},
+			$pin->{bit};
+	}
+
+	print $out "\n// Strips\n$list" if $list;
+	print $out "\n// Strips 0-15, from the first load\n";
+	print $out "#define TEST_BITS_EARLY$tests[0]\n";
+	print $out "\n// Strips 16-23, tested after the start bits\n";
+	print $out "#define TEST_BITS_LATE$tests[1]\n";
+
+	close $out;
+}
+
+
+# C tables for ledscape.c
+my $file = "${base}_pins.h";
+open my $out, '>', $file
+	or die "$file: $!\n";
+
+print $out <<"EOF";
+/** \\file
+ * $header
+ */
+
+/** No pin for this strip in the table. */
+#define STRIP_NO_PIN 0xFF
+
+/** GPIO pins used by the LEDscape, in strip order.
+ * clock is set on the pin that clocks its bank for APA102 strips.
+ */
+static const struct {
+	uint8_t gpio;
+	uint8_t pin;
+	uint8_t clock;
+} strip_pins[LEDSCAPE_NUM_STRIPS] = {
+EOF
+
+for my $pru (0, 1)
+{
+	for my $i (0 .. $STRIPS_PER_PRU - 1)
+	{
+		my $strip = $pru * $STRIPS_PER_PRU + $i;
+		my $pin = $strips[$pru][$i];
+		if ($pin)
+		{
+			printf $out "\t{ %d, %2d, %d }, // %d: %s\n",
+				$pin->{bank},
+				$pin->{bit},
+				$pin->{clock},
+				$strip,
+				$pin->{name};
+		} else {
+			printf $out "\t{ STRIP_NO_PIN, 0, 0 }, // %d\n", $strip;
+		}
+	}
+}
+
+print $out "};\n\n";
+print $out "/** GPIO banks A and B of each PRU, or STRIP_NO_PIN. */\n";
+print $out "static const uint8_t pru_banks[2][2] = {\n";
+for my $pru (0, 1)
+{
+	my @banks = @{$best->{banks}[$pru]};
+	printf $out "\t{ %s, %s },\n",
+		map { defined $_ ? $_ : 'STRIP_NO_PIN' } @banks[0, 1];
+}
+print $out "};\n";
+
+close $out;
@@ -0,0 +1,440 @@
+/** \file
+ * Stand-in for the BeagleBone PRU on an ordinary Linux machine.
+ *
+ * Implements pru.h in plain memory so that the library, the receivers
+ * and the effects run and can be benchmarked on a workstation.  The
+ * "DDR" window and the data RAMs are heap allocations, and instead of
+ * running the programs, a thread per PRU plays their side of the
+ * command protocol in ws281x_command_t: it picks up a command, takes
+ * as long as the strips would to clock the frame out, then writes the
+ * telemetry and the response and raises the event.  Nothing reaches
+ * a pin; use pru-sim to run the programs themselves.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ledscape.h"
+#include "pru.h"
+
+
+/** Offsets in the command structure of the programs.  These must
+ * match ws281x.hp and ws281x_command_t in ledscape.c.
+ */
+#define CMD_NUM_PIXELS		4
+#define CMD_COMMAND		8
+#define CMD_RESPONSE		12
+#define CMD_NUM_SEGMENTS	16
+#define CMD_TIMING_PERIOD	28
+#define CMD_TIMING_RESET	32
+#define CMD_SEGMENTS		36
+#define CMD_TELEMETRY		804
+#define CMD_HEARTBEAT		820
+#define CMD_PIXEL_BITS		824
+#define CMD_END_CLOCKS		836
+
+#define SEGMENT_SIZE		16
+
+/** Frame times of the programs, as in ledscape.c: the WS281x bit loop
+ * spends this long resetting its cycle counter on top of the period,
+ * the APA102 loop takes about this long per bit without a floor, and
+ * a DMX packet has a header and four slots per pixel row.
+ */
+#define PRU_NS_PER_CYCLE	5
+#define COUNTER_RESET_NS	100
+#define APA102_BIT_NS		1000
+#define DMX_SLOT_NS		44000
+#define DMX_HEADER_NS		(92000 + 12000 + DMX_SLOT_NS)
+
+/** Size of the pretend DDR window; the uio driver's is set by its
+ * extram_pool_sz parameter on the BeagleBone.
+ */
+#define HOST_DDR_SIZE		(8 << 20)
+#define HOST_DDR_ADDR		0x9C940000
+#define HOST_DATA_RAM_SIZE	8192
+
+/** How often an idle PRU looks at its command. */
+#define HOST_POLL_NS		20000
+
+/** The ARM interrupt, as PRU_EVTOUT_0 and PRU0_ARM_INTERRUPT. */
+#define HOST_EVTOUT		0
+#define HOST_ARM_EVENT		19
+
+
+/** The programs linked into ledscape.o, to tell which one is "run". */
+extern const unsigned int apa102_0_code[];
+extern const unsigned int apa102_1_code[];
+extern const unsigned int dmx_0_code[];
+extern const unsigned int dmx_1_code[];
+
+typedef enum {
+	HOST_WS281X,
+	HOST_APA102,
+	HOST_DMX,
+} host_program_t;
+
+
+typedef struct
+{
+	pru_t * pru;
+	pthread_t thread;
+	int running;
+	volatile int stop;
+	host_program_t program;
+} host_pru_t;
+
+
+/** State shared by both PRUs, which raise the same event. */
+static struct
+{
+	unsigned users;
+	void * ddr;
+	int event_fd;
+	host_pru_t prus[2];
+} host;
+
+
+static uint32_t
+get32(
+	const pru_t * const pru,
+	const unsigned offset
+)
+{
+	return __atomic_load_n((const uint32_t*)((const uint8_t*) pru->data_ram + offset), __ATOMIC_ACQUIRE);
+}
+
+
+static void
+put32(
+	pru_t * const pru,
+	const unsigned offset,
+	const uint32_t value
+)
+{
+	__atomic_store_n((uint32_t*)((uint8_t*) pru->data_ram + offset), value, __ATOMIC_RELEASE);
+}
+
+
+/** The IEP timer, which counts at the PRU clock. */
+static uint32_t
+iep_count(void)
+{
+	return monotonic_ns() / PRU_NS_PER_CYCLE;
+}
+
+
+static void
+raise_event(void)
+{
+	const uint64_t one = 1;
+	if (write(host.event_fd, &one, sizeof(one)) != sizeof(one))
+		die("eventfd write failed: %s\n", strerror(errno));
+}
+
+
+/** How long the program takes over the command's frame. */
+static uint64_t
+frame_ns(
+	const host_pru_t * const hp
+)
+{
+	const pru_t * const pru = hp->pru;
+	const unsigned num_segments = get32(pru, CMD_NUM_SEGMENTS);
+	const unsigned period = get32(pru, CMD_TIMING_PERIOD);
+	const unsigned bits = get32(pru, CMD_PIXEL_BITS);
+
+	// Rows in the segments, up to the rows asked for
+	uint64_t rows = 0;
+	for (unsigned i = 0 ; i < num_segments && i < LEDSCAPE_NUM_STRIPS ; i++)
+		rows += get32(pru, CMD_SEGMENTS + i * SEGMENT_SIZE + 4);
+	if (rows > get32(pru, CMD_NUM_PIXELS))
+		rows = get32(pru, CMD_NUM_PIXELS);
+
+	switch (hp->program)
+	{
+	case HOST_DMX:
+		return DMX_HEADER_NS + rows * 4 * DMX_SLOT_NS;
+
+	case HOST_APA102:
+	{
+		uint64_t bit_ns = period ? period * PRU_NS_PER_CYCLE + COUNTER_RESET_NS : 0;
+		if (bit_ns < APA102_BIT_NS)
+			bit_ns = APA102_BIT_NS;
+		return (32 + rows * bits + get32(pru, CMD_END_CLOCKS)) * bit_ns;
+	}
+
+	default:
+		return rows * bits * (period * PRU_NS_PER_CYCLE + COUNTER_RESET_NS)
+			+ (uint64_t) get32(pru, CMD_TIMING_RESET) * PRU_NS_PER_CYCLE;
+	}
+}
+
+
+/** Sleep until the deadline, bumping the heartbeat as the programs do
+ * once per row, so that the library's watchdog sees a live PRU.
+ */
+static void
+busy_until(
+	host_pru_t * const hp,
+	const uint64_t deadline_ns
+)
+{
+	while (!hp->stop)
+	{
+		const uint64_t now = monotonic_ns();
+		if (now >= deadline_ns)
+			return;
+
+		uint64_t left = deadline_ns - now;
+		if (left > 1000000)
+			left = 1000000;
+
+		const struct timespec ts = { 0, left };
+		nanosleep(&ts, NULL);
+		put32(hp->pru, CMD_HEARTBEAT, get32(hp->pru, CMD_HEARTBEAT) + 1);
+	}
+}
+
+
+static void *
+host_pru_thread(
+	void * const arg
+)
+{
+	host_pru_t * const hp = arg;
+	pru_t * const pru = hp->pru;
+
+	// Report in, like the programs do when they start
+	put32(pru, CMD_RESPONSE, 1);
+
+	while (!hp->stop)
+	{
+		put32(pru, CMD_HEARTBEAT, get32(pru, CMD_HEARTBEAT) + 1);
+
+		const uint32_t command = get32(pru, CMD_COMMAND);
+		if (!command)
+		{
+			const struct timespec ts = { 0, HOST_POLL_NS };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		const uint64_t start_ns = monotonic_ns();
+		put32(pru, CMD_COMMAND, 0);
+
+		if (command == 0xFF)
+		{
+			put32(pru, CMD_RESPONSE, 0xFF);
+			raise_event();
+			break;
+		}
+
+		put32(pru, CMD_TELEMETRY + 4, iep_count());
+		busy_until(hp, start_ns + frame_ns(hp));
+
+		put32(pru, CMD_TELEMETRY + 8, iep_count());
+		put32(pru, CMD_TELEMETRY + 12, 0);
+		put32(pru, CMD_TELEMETRY + 0, get32(pru, CMD_TELEMETRY + 0) + 1);
+
+		// The cycles that the frame took, which is never zero
+		put32(pru, CMD_RESPONSE, (monotonic_ns() - start_ns) / PRU_NS_PER_CYCLE | 1);
+		raise_event();
+	}
+
+	return NULL;
+}
+
+
+static void
+host_stop(
+	host_pru_t * const hp
+)
+{
+	if (!hp->running)
+		return;
+
+	hp->stop = 1;
+	pthread_join(hp->thread, NULL);
+	hp->running = 0;
+}
+
+
+static void
+host_start(
+	pru_t * const pru,
+	const host_program_t program
+)
+{
+	host_pru_t * const hp = &host.prus[pru->pru_num];
+
+	// A program that is already running is replaced
+	host_stop(hp);
+
+	*hp = (host_pru_t) {
+		.pru		= pru,
+		.program	= program,
+		.running	= 1,
+	};
+
+	if (pthread_create(&hp->thread, NULL, host_pru_thread, hp) != 0)
+		die("PRU %u: pthread_create failed\n", pru->pru_num);
+}
+
+
+pru_t *
+pru_init(
+	const unsigned short pru_num
+)
+{
+	if (pru_num > 1)
+		die("There is no PRU %u\n", pru_num);
+
+	if (host.users++ == 0)
+	{
+		host.ddr = calloc(1, HOST_DDR_SIZE);
+		host.event_fd = eventfd(0, EFD_CLOEXEC);
+		if (!host.ddr || host.event_fd < 0)
+			die("Unable to set up the host PRUs: %s\n", strerror(errno));
+	}
+
+	pru_t * const pru = calloc(1, sizeof(*pru));
+	void * const data_ram = calloc(1, HOST_DATA_RAM_SIZE);
+	if (!pru || !data_ram)
+		die("calloc failed: %s", strerror(errno));
+
+	*pru = (pru_t) {
+		.pru_num	= pru_num,
+		.evtout		= HOST_EVTOUT,
+		.arm_event	= HOST_ARM_EVENT,
+		.data_ram	= data_ram,
+		.data_ram_size	= HOST_DATA_RAM_SIZE,
+		.ddr_addr	= HOST_DDR_ADDR,
+		.ddr		= host.ddr,
+		.ddr_size	= HOST_DDR_SIZE,
+	};
+
+	printf("%s: PRU %d: simulated on the host, data %zu bytes, DMA %zu bytes\n",
+		__func__,
+		pru_num,
+		pru->data_ram_size,
+		pru->ddr_size
+	);
+
+	return pru;
+}
+
+
+/** Only the name tells the programs apart. */
+void
+pru_exec(
+	pru_t * const pru,
+	const char * const program
+)
+{
+	host_start(pru,
+		strstr(program, "dmx") ? HOST_DMX :
+		strstr(program, "apa102") ? HOST_APA102 :
+		HOST_WS281X
+	);
+}
+
+
+void
+pru_exec_code(
+	pru_t * const pru,
+	const uint32_t * const code,
+	const size_t size
+)
+{
+	(void) size;
+	const void * const p = code;
+
+	host_start(pru,
+		p == dmx_0_code || p == dmx_1_code ? HOST_DMX :
+		p == apa102_0_code || p == apa102_1_code ? HOST_APA102 :
+		HOST_WS281X
+	);
+}
+
+
+int
+pru_event_fd(
+	pru_t * const pru
+)
+{
+	(void) pru;
+	return host.event_fd;
+}
+
+
+int
+pru_wait_event(
+	pru_t * const pru,
+	const int timeout_ms
+)
+{
+	(void) pru;
+	struct pollfd pfd = { .fd = host.event_fd, .events = POLLIN };
+
+	const int rc = poll(&pfd, 1, timeout_ms);
+	if (rc <= 0)
+		return rc;
+
+	uint64_t count;
+	if (read(host.event_fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+
+	return 1;
+}
+
+
+void
+pru_close(
+	pru_t * const pru
+)
+{
+	host_stop(&host.prus[pru->pru_num]);
+	free(pru->data_ram);
+	free(pru);
+
+	if (--host.users == 0)
+	{
+		close(host.event_fd);
+		free(host.ddr);
+		host.ddr = NULL;
+	}
+}
+
+
+/** The host has no pins to configure. */
+int
+pru_gpio(
+	const unsigned gpio,
+	const unsigned pin,
+	const unsigned direction,
+	const unsigned initial_value
+)
+{
+	(void) gpio;
+	(void) pin;
+	(void) direction;
+	(void) initial_value;
+	return 0;
+}
+
+
+int
+pru_gpio_outputs(
+	const uint32_t masks[4]
+)
+{
+	(void) masks;
+	return 0;
+}
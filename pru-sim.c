@@ -0,0 +1,433 @@
+/** \file
+ * Clock frames out of the WS281x PRU programs in the simulator.
+ *
+ * Runs ws281x_0.bin and ws281x_1.bin, as pasm assembles them, on the
+ * host with prusim.c and reports how long their frames take, how long
+ * they stalled on the DDR and the range of the high times and periods
+ * of the bits on the pins, so that changes to the firmware can be
+ * timed in CI without a BeagleBone.  -e writes every pin edge to a
+ * file, one "time_ns gpio pin level" line each, for ws281x-check, and
+ * -d the frame that was clocked out to compare its pixels with.
+ * The APA102 and DMX programs are refused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "ledscape.h"
+#include "ws281x_pins.h"
+#include "prusim.h"
+#include "util.h"
+
+
+/** Offsets in the command of the WS281x programs.  These must match
+ * ws281x.hp and ws281x_command_t in ledscape.c.
+ */
+#define CMD_PIXELS_DMA		0
+#define CMD_NUM_PIXELS		4
+#define CMD_COMMAND		8
+#define CMD_RESPONSE		12
+#define CMD_NUM_SEGMENTS	16
+#define CMD_TIMING		20
+#define CMD_SEGMENTS		36
+#define CMD_TELEMETRY		804
+#define CMD_PIXEL_BITS		824
+#define CMD_BIT_PLANES		840
+
+/** The event both programs raise at the end of a frame. */
+#define PRU0_ARM_INTERRUPT	19
+
+/** The bit loop resets its cycle counter once per bit, which takes
+ * this long on top of the counted period; as in ledscape.c.
+ */
+#define COUNTER_RESET_NS	100
+
+/** Where the frame appears in the PRUs' address space.  The firmware
+ * is handed absolute addresses, so any will do.
+ */
+#define DDR_ADDR		0x80000000
+
+#define STRIPS_PER_PRU		24
+
+
+typedef struct
+{
+	prusim_t * sim;
+	unsigned num_prus;
+	unsigned frames;
+	FILE * trace;
+
+	// high times above this many cycles are ones
+	uint64_t threshold;
+
+	// lows longer than this are a reset, not part of a bit
+	uint64_t gap;
+
+	uint64_t rise[4][32];
+	uint64_t high_min[2];
+	uint64_t high_max[2];
+	uint64_t period_min;
+	uint64_t period_max;
+	uint64_t edges;
+
+	unsigned done[2];
+	uint64_t armed[2];
+	uint64_t frame_cycles[2];
+} bench_t;
+
+
+static void
+put32(
+	void * const dram,
+	const unsigned offset,
+	const uint32_t value
+)
+{
+	memcpy((uint8_t*) dram + offset, &value, sizeof(value));
+}
+
+
+static uint32_t
+get32(
+	const void * const dram,
+	const unsigned offset
+)
+{
+	uint32_t value;
+	memcpy(&value, (const uint8_t*) dram + offset, sizeof(value));
+	return value;
+}
+
+
+static void
+bench_edge(
+	void * const arg,
+	const prusim_edge_t * const edge
+)
+{
+	bench_t * const bench = arg;
+	uint64_t * const rise = &bench->rise[edge->gpio][edge->pin];
+
+	bench->edges++;
+	if (bench->trace)
+		fprintf(bench->trace, "%"PRIu64" %u %u %u\n",
+			edge->cycle * PRUSIM_NS_PER_CYCLE,
+			edge->gpio,
+			edge->pin,
+			edge->level
+		);
+
+	if (!edge->level)
+	{
+		const uint64_t high = edge->cycle - *rise;
+		const unsigned one = high > bench->threshold;
+		if (high < bench->high_min[one])
+			bench->high_min[one] = high;
+		if (high > bench->high_max[one])
+			bench->high_max[one] = high;
+		return;
+	}
+
+	const uint64_t period = edge->cycle - *rise;
+	if (*rise && period < bench->gap)
+	{
+		if (period < bench->period_min)
+			bench->period_min = period;
+		if (period > bench->period_max)
+			bench->period_max = period;
+	}
+	*rise = edge->cycle;
+}
+
+
+/** A PRU is done with its frame; start the next one right away. */
+static void
+bench_event(
+	void * const arg,
+	const unsigned pru,
+	const unsigned event
+)
+{
+	bench_t * const bench = arg;
+	const uint64_t now = prusim_now(bench->sim);
+
+	if (event != PRU0_ARM_INTERRUPT)
+		die("PRU%u raised event %u\n", pru, event);
+
+	bench->frame_cycles[pru] += now - bench->armed[pru];
+	if (++bench->done[pru] >= bench->frames)
+		return;
+
+	bench->armed[pru] = now;
+	put32(prusim_dram(bench->sim, pru), CMD_COMMAND, 1);
+}
+
+
+static uint32_t *
+read_program(
+	const char * const filename,
+	size_t * const size
+)
+{
+	FILE * const file = fopen(filename, "rb");
+	if (!file)
+		die("%s: unable to open: %s\n", filename, strerror(errno));
+
+	uint32_t * const code = calloc(1, PRUSIM_IRAM_SIZE + 1);
+	if (!code)
+		die("calloc failed\n");
+
+	*size = fread(code, 1, PRUSIM_IRAM_SIZE + 1, file);
+	fclose(file);
+
+	if (*size == 0 || *size > PRUSIM_IRAM_SIZE || *size % 4)
+		die("%s: %zu bytes is not a PRU program\n", filename, *size);
+
+	// The APA102 and DMX programs take the same command, but clock
+	// their pins in ways that the checks here would make nonsense
+	// of.  Only the WS281x programs load the offset of BIT_PLANES
+	// (MOV rN, BIT_PLANES, which pasm makes an LDI).
+	int ws281x = 0;
+	for (size_t i = 0 ; i < *size / 4 ; i++)
+		if ((code[i] >> 24) == 0x24 && ((code[i] >> 8) & 0xFFFF) == CMD_BIT_PLANES)
+			ws281x = 1;
+	if (!ws281x)
+		die("%s: not a WS281x program; only ws281x_0.bin, ws281x_1.bin and their variants can be simulated\n", filename);
+
+	return code;
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	unsigned num_pixels = 512;
+	unsigned num_strips = LEDSCAPE_NUM_STRIPS;
+	unsigned frames = 2;
+	unsigned pixel_bits = 24;
+	unsigned t0h = 240, t1h = 900, period = 1250, reset = 50000;
+	const char * trace_file = NULL;
+	const char * frame_file = NULL;
+	prusim_config_t config = { .ddr_addr = DDR_ADDR };
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:s:f:Wl:o:t:e:d:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			num_pixels = atoi(optarg);
+			break;
+		case 's':
+			num_strips = atoi(optarg);
+			break;
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'W':
+			pixel_bits = 32;
+			break;
+		case 'l':
+			config.ddr_cycles = atoi(optarg);
+			break;
+		case 'o':
+			config.ocp_cycles = atoi(optarg);
+			break;
+		case 't':
+			if (sscanf(optarg, "%u,%u,%u,%u", &t0h, &t1h, &period, &reset) != 4)
+				die("-t expects t0h,t1h,period,reset in ns\n");
+			break;
+		case 'e':
+			trace_file = optarg;
+			break;
+		case 'd':
+			frame_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c <led_count>] [-s <strips>] [-f <frames>] [-W(RGBW strips)] [-l <DDR load cycles>] [-o <OCP write cycles>] [-t <t0h,t1h,period,reset ns>] [-e <edge trace file>] [-d <frame file>] [pru0.bin [pru1.bin]]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (num_strips < 1 || num_strips > LEDSCAPE_NUM_STRIPS)
+		die("-s must be 1 to %u\n", LEDSCAPE_NUM_STRIPS);
+	if (num_pixels < 1 || frames < 1)
+		die("-c and -f must be at least 1\n");
+	if (t0h >= t1h || t1h + COUNTER_RESET_NS >= period || reset < 2 * PRUSIM_NS_PER_CYCLE)
+		die("bit timing %u/%u/%u ns, reset %u ns is impossible\n", t0h, t1h, period, reset);
+
+	const char * const programs[2] = {
+		optind < argc ? argv[optind] : "ws281x_0.bin",
+		optind + 1 < argc ? argv[optind + 1] : "ws281x_1.bin",
+	};
+
+	// One frame of pixels, laid out as ledscape.c does with a row of
+	// all the strips for each pixel, and the row past the end that
+	// the last row prefetches.
+	const size_t stride = LEDSCAPE_NUM_STRIPS * 4;
+	config.ddr_size = stride * (num_pixels + 1);
+	config.ddr = malloc(config.ddr_size);
+	if (!config.ddr)
+		die("malloc failed\n");
+
+	uint8_t * const pixels = config.ddr;
+	for (size_t i = 0 ; i < config.ddr_size ; i++)
+		pixels[i] = (i * 2654435761u) >> 24;
+
+	bench_t bench = {
+		.num_prus	= num_strips > STRIPS_PER_PRU ? 2 : 1,
+		.frames		= frames,
+		.threshold	= (t0h + t1h) / 2 / PRUSIM_NS_PER_CYCLE,
+		.gap		= reset / 2 / PRUSIM_NS_PER_CYCLE,
+		.high_min	= { UINT64_MAX, UINT64_MAX },
+		.period_min	= UINT64_MAX,
+	};
+
+	if (trace_file)
+	{
+		bench.trace = fopen(trace_file, "w");
+		if (!bench.trace)
+			die("%s: unable to create: %s\n", trace_file, strerror(errno));
+		fprintf(bench.trace, "# time_ns gpio pin level\n");
+	}
+
+	config.edge = bench_edge;
+	config.event = bench_event;
+	config.arg = &bench;
+	prusim_t * const sim = bench.sim = prusim_init(&config);
+
+	for (unsigned pru = 0 ; pru < bench.num_prus ; pru++)
+	{
+		void * const dram = prusim_dram(sim, pru);
+		uint32_t gpio_mask[2] = { 0, 0 };
+
+		for (unsigned i = pru * STRIPS_PER_PRU ; i < num_strips && i < (pru + 1) * STRIPS_PER_PRU ; i++)
+		{
+			if (strip_pins[i].gpio == STRIP_NO_PIN)
+				continue;
+			const unsigned bank = strip_pins[i].gpio == pru_banks[pru][0] ? 0 : 1;
+			gpio_mask[bank] |= 1u << strip_pins[i].pin;
+		}
+
+		put32(dram, CMD_PIXELS_DMA, DDR_ADDR + pru * STRIPS_PER_PRU * 4);
+		put32(dram, CMD_NUM_PIXELS, num_pixels);
+		put32(dram, CMD_COMMAND, 1);
+		put32(dram, CMD_RESPONSE, 0);
+		put32(dram, CMD_NUM_SEGMENTS, 1);
+		put32(dram, CMD_TIMING + 0, t0h / PRUSIM_NS_PER_CYCLE);
+		put32(dram, CMD_TIMING + 4, t1h / PRUSIM_NS_PER_CYCLE);
+		put32(dram, CMD_TIMING + 8, (period - COUNTER_RESET_NS) / PRUSIM_NS_PER_CYCLE);
+		put32(dram, CMD_TIMING + 12, reset / PRUSIM_NS_PER_CYCLE);
+		put32(dram, CMD_SEGMENTS + 0, stride);
+		put32(dram, CMD_SEGMENTS + 4, num_pixels);
+		put32(dram, CMD_SEGMENTS + 8, gpio_mask[0]);
+		put32(dram, CMD_SEGMENTS + 12, gpio_mask[1]);
+		put32(dram, CMD_PIXEL_BITS, pixel_bits);
+		put32(dram, CMD_BIT_PLANES, 0);
+
+		size_t size;
+		uint32_t * const code = read_program(programs[pru], &size);
+		prusim_load(sim, pru, code, size);
+		free(code);
+	}
+
+	// Far longer than the frames could take with any sane latency
+	const uint64_t bit_cycles = period / PRUSIM_NS_PER_CYCLE;
+	const uint64_t limit = frames * (4 * bit_cycles * pixel_bits * num_pixels + reset) + 1000000;
+
+	while (bench.done[0] < frames || (bench.num_prus > 1 && bench.done[1] < frames))
+	{
+		if (prusim_now(sim) > limit)
+			die("the PRUs did not finish %u frames in %"PRIu64" cycles\n", frames, limit);
+		for (unsigned pru = 0 ; pru < bench.num_prus ; pru++)
+			if (!prusim_running(sim, pru))
+				die("PRU%u halted\n", pru);
+		prusim_run(sim, 100000);
+	}
+
+	// The event comes after the reset, so the strips have latched
+	if (bench.trace)
+	{
+		fprintf(bench.trace, "# end %"PRIu64"\n", prusim_now(sim) * PRUSIM_NS_PER_CYCLE);
+		fclose(bench.trace);
+	}
+
+	if (frame_file)
+	{
+		FILE * const file = fopen(frame_file, "wb");
+		if (!file
+		||  fwrite(pixels, stride, num_pixels, file) != num_pixels
+		||  fclose(file) != 0)
+			die("%s: unable to write: %s\n", frame_file, strerror(errno));
+	}
+
+	const double bit_ns = (double) pixel_bits * num_pixels * period;
+	printf("%u pixels on %u strips, %u bits, %u/%u/%u ns bits, %u ns reset\n",
+		num_pixels,
+		num_strips,
+		pixel_bits,
+		t0h,
+		t1h,
+		period,
+		reset
+	);
+
+	for (unsigned pru = 0 ; pru < bench.num_prus ; pru++)
+	{
+		const prusim_stats_t * const stats = prusim_stats(sim, pru);
+		const void * const dram = prusim_dram(sim, pru);
+		const uint32_t start = get32(dram, CMD_TELEMETRY + 4);
+		const uint32_t end = get32(dram, CMD_TELEMETRY + 8);
+		const uint32_t stall = get32(dram, CMD_TELEMETRY + 12);
+		const double frame_ns = (double) bench.frame_cycles[pru] / frames * PRUSIM_NS_PER_CYCLE;
+		const double clock_ns = (double) (end - start) * PRUSIM_NS_PER_CYCLE;
+
+		printf("PRU%u %s: %.1f us per frame, %.1f fps\n",
+			pru,
+			programs[pru],
+			frame_ns / 1000,
+			1e9 / frame_ns
+		);
+		printf("\tlast frame clocked out in %.1f us, %.1f%% over the bit times, stalled %"PRIu32" cycles\n",
+			clock_ns / 1000,
+			100 * (clock_ns - bit_ns) / bit_ns,
+			stall
+		);
+		printf("\t%"PRIu64" instructions, %"PRIu64" DDR reads of %"PRIu64" bytes, %"PRIu64" GPIO writes, %"PRIu64" cycles stalled\n",
+			stats->instructions,
+			stats->ddr_reads,
+			stats->ddr_read_bytes,
+			stats->gpio_writes,
+			stats->stall_cycles
+		);
+	}
+
+	if (!bench.edges)
+		die("no pin changed\n");
+
+	// Ranges that saw nothing, such as the zeros of a white frame
+	for (unsigned i = 0 ; i < 2 ; i++)
+		if (bench.high_min[i] > bench.high_max[i])
+			bench.high_min[i] = 0;
+	if (bench.period_min > bench.period_max)
+		bench.period_min = 0;
+
+	printf("%"PRIu64" edges: zeros high %"PRIu64"-%"PRIu64" ns, ones high %"PRIu64"-%"PRIu64" ns, bits %"PRIu64"-%"PRIu64" ns\n",
+		bench.edges,
+		bench.high_min[0] * PRUSIM_NS_PER_CYCLE,
+		bench.high_max[0] * PRUSIM_NS_PER_CYCLE,
+		bench.high_min[1] * PRUSIM_NS_PER_CYCLE,
+		bench.high_max[1] * PRUSIM_NS_PER_CYCLE,
+		bench.period_min * PRUSIM_NS_PER_CYCLE,
+		bench.period_max * PRUSIM_NS_PER_CYCLE
+	);
+
+	prusim_close(sim);
+	free(config.ddr);
+	return 0;
+}
@@ -32,12 +32,26 @@ proc_read(
 }
 
 
-pru_t *
-pru_init(
-	const unsigned short pru_num
-)
+/** State shared by both PRUs.
+ *
+ * prussdrv keeps a single global context that prussdrv_init() wipes,
+ * so the uio device is opened, the interrupt controller set up and the
+ * DDR window mapped only by the first pru_init().  The second PRU
+ * reuses them, and the last pru_close() tears them down.
+ */
+static struct
 {
-	prussdrv_init();		
+	unsigned users;
+	void * ddr;
+	uintptr_t ddr_addr;
+	size_t ddr_size;
+} pruss;
+
+
+static void
+pruss_open(void)
+{
+	prussdrv_init();
 
 	int ret = prussdrv_open(PRU_EVTOUT_0);
 	if (ret)
@@ -46,40 +60,29 @@ pru_init(
 	tpruss_intc_initdata pruss_intc_initdata = PRUSS_INTC_INITDATA;
 	prussdrv_pruintc_init(&pruss_intc_initdata);
 
-	void * pru_data_mem;
-	prussdrv_map_prumem(
-		pru_num == 0 ? PRUSS0_PRU0_DATARAM :PRUSS0_PRU1_DATARAM,
-		&pru_data_mem
-	);
+	// prussdrv_open() has already mapped the DDR window that the
+	// uio driver exports; no need to map it again from /dev/mem.
+	if (prussdrv_map_extmem(&pruss.ddr) < 0 || !pruss.ddr)
+		die("Failed to map the PRU DDR window\n");
 
-	const int mem_fd = open("/dev/mem", O_RDWR);
-	if (mem_fd < 0)
-		die("Failed to open /dev/mem: %s\n", strerror(errno));
+	pruss.ddr_addr = proc_read("/sys/class/uio/uio0/maps/map1/addr");
+	pruss.ddr_size = proc_read("/sys/class/uio/uio0/maps/map1/size");
+}
 
-	const uintptr_t ddr_addr = proc_read("/sys/class/uio/uio0/maps/map1/addr");
-	const uintptr_t ddr_size = proc_read("/sys/class/uio/uio0/maps/map1/size");
 
-	const uintptr_t ddr_start = 0x10000000;
-	const uintptr_t ddr_offset = ddr_addr - ddr_start;
-	const size_t ddr_filelen = ddr_size + ddr_start;
+pru_t *
+pru_init(
+	const unsigned short pru_num
+)
+{
+	if (pruss.users++ == 0)
+		pruss_open();
 
-	/* map the memory */
-	uint8_t * const ddr_mem = mmap(
-		0,
-		ddr_filelen,
-		PROT_WRITE | PROT_READ,
-		MAP_SHARED,
-		mem_fd,
-		ddr_offset
+	void * pru_data_mem;
+	prussdrv_map_prumem(
+		pru_num == 0 ? PRUSS0_PRU0_DATARAM :PRUSS0_PRU1_DATARAM,
+		&pru_data_mem
 	);
-	if (ddr_mem == MAP_FAILED)
-		die("Failed to mmap offset %"PRIxPTR" @ %zu bytes: %s\n",
-			ddr_offset,
-			ddr_filelen,
-			strerror(errno)
-		);
-
-	close(mem_fd);
 
 	pru_t * const pru = calloc(1, sizeof(*pru));
 	if (!pru)
@@ -87,11 +90,15 @@ pru_init(
 
 	*pru = (pru_t) {
 		.pru_num	= pru_num,
+		// Both programs signal the same event so that only one
+		// uio device has to be watched for frame completion.
+		.evtout		= PRU_EVTOUT_0,
+		.arm_event	= PRU0_ARM_INTERRUPT,
 		.data_ram	= pru_data_mem,
 		.data_ram_size	= 8192, // how to determine?
-		.ddr_addr	= ddr_addr,
-		.ddr		= (void*)(ddr_mem + ddr_start),
-		.ddr_size	= ddr_size,
+		.ddr_addr	= pruss.ddr_addr,
+		.ddr		= pruss.ddr,
+		.ddr_size	= pruss.ddr_size,
 	};
     
 	printf("%s: PRU %d: data %p @ %zu bytes,  DMA %p / %"PRIxPTR" @ %zu bytes\n",
@@ -120,16 +127,56 @@ pru_exec(
 }
 
 
+/** Load a program linked into the caller straight into the PRU IRAM. */
+void
+pru_exec_code(
+	pru_t * const pru,
+	const uint32_t * const code,
+	const size_t size
+)
+{
+	if (prussdrv_exec_code(pru->pru_num, code, size) < 0)
+		die("PRU %u: %zu byte program failed\n", pru->pru_num, size);
+}
+
+
+int
+pru_event_fd(
+	pru_t * const pru
+)
+{
+	return prussdrv_pru_event_fd(pru->evtout);
+}
+
+
+int
+pru_wait_event(
+	pru_t * const pru,
+	const int timeout_ms
+)
+{
+	return prussdrv_pru_wait_event_timeout(
+		pru->evtout,
+		pru->arm_event,
+		timeout_ms
+	);
+}
+
+
 void
 pru_close(
 	pru_t * const pru
 )
 {
 	// \todo unmap memory
-	prussdrv_pru_wait_event(PRU_EVTOUT_0);
-	prussdrv_pru_clear_event(PRU0_ARM_INTERRUPT);
+	// Give the program a moment to signal its exit; if the event
+	// was already consumed by a frame wait we do not want to hang.
+	pru_wait_event(pru, 100);
 	prussdrv_pru_disable(pru->pru_num); 
-	prussdrv_exit();
+	free(pru);
+
+	if (--pruss.users == 0)
+		prussdrv_exit();
 }
 
 
@@ -187,3 +234,95 @@ pru_gpio(
 
 	return 0;
 }
+
+
+/** GPIO banks and the CM_PER clock controls of banks 1-3.
+ *
+ * GPIO0 is in the wakeup domain and always clocked.
+ */
+static const struct {
+	uintptr_t base;
+	unsigned clkctrl;
+} gpio_banks[4] = {
+	{ 0x44E07000, 0 },
+	{ 0x4804C000, 0xAC },
+	{ 0x481AC000, 0xB0 },
+	{ 0x481AE000, 0xB4 },
+};
+
+#define CM_PER_BASE		0x44E00000
+#define CM_MODULEMODE_ENABLE	(2 << 0)
+#define CM_OPTFCLKEN_GPIO	(1 << 18)
+#define CM_IDLEST_MASK		(3 << 16)
+
+#define GPIO_OE			0x134
+#define GPIO_CLEARDATAOUT	0x190
+
+
+static volatile uint32_t *
+map_regs(
+	const int mem_fd,
+	const uintptr_t base
+)
+{
+	void * const regs = mmap(
+		0,
+		4096,
+		PROT_WRITE | PROT_READ,
+		MAP_SHARED,
+		mem_fd,
+		base
+	);
+	if (regs == MAP_FAILED)
+		die("Failed to mmap %"PRIxPTR": %s\n", base, strerror(errno));
+
+	return regs;
+}
+
+
+int
+pru_gpio_outputs(
+	const uint32_t masks[4]
+)
+{
+	const int mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+	if (mem_fd < 0)
+		die("Failed to open /dev/mem: %s\n", strerror(errno));
+
+	volatile uint32_t * const cm_per = map_regs(mem_fd, CM_PER_BASE);
+
+	for (unsigned bank = 0 ; bank < 4 ; bank++)
+	{
+		const uint32_t mask = masks[bank];
+		if (!mask)
+			continue;
+
+		// Touching an unclocked bank is a bus error, so turn its
+		// clock on and wait for it to become functional.
+		const unsigned clkctrl = gpio_banks[bank].clkctrl;
+		if (clkctrl)
+		{
+			volatile uint32_t * const clk = &cm_per[clkctrl / 4];
+			if ((*clk & 3) != CM_MODULEMODE_ENABLE)
+				*clk = CM_MODULEMODE_ENABLE | CM_OPTFCLKEN_GPIO;
+
+			unsigned tries = 0;
+			while (*clk & CM_IDLEST_MASK)
+				if (++tries > 1000000)
+					die("GPIO%u clock did not start\n", bank);
+		}
+
+		volatile uint32_t * const gpio = map_regs(mem_fd, gpio_banks[bank].base);
+
+		// Drive low before enabling the outputs
+		gpio[GPIO_CLEARDATAOUT / 4] = mask;
+		gpio[GPIO_OE / 4] &= ~mask;
+
+		munmap((void*)(uintptr_t) gpio, 4096);
+	}
+
+	munmap((void*)(uintptr_t) cm_per, 4096);
+	close(mem_fd);
+
+	return 0;
+}
@@ -19,6 +19,9 @@ typedef struct
 {
 	unsigned pru_num;
 
+	unsigned evtout; // uio host event that the PRU signals
+	unsigned arm_event; // PRU to ARM system event to acknowledge
+
 	void * data_ram; // PRU data ram in ARM space
 	size_t data_ram_size; // size in bytes of the PRU's data RAM
 
@@ -40,6 +43,38 @@ pru_exec(
 );
 
 
+/** Run a program from memory, such as one assembled with pasm -c. */
+extern void
+pru_exec_code(
+	pru_t * const pru,
+	const uint32_t * const code,
+	const size_t size
+);
+
+
+/** Pollable file descriptor for the PRU to ARM event.
+ *
+ * Becomes readable when the PRU program raises its ARM event;
+ * call pru_wait_event() to acknowledge it.
+ */
+extern int
+pru_event_fd(
+	pru_t * const pru
+);
+
+
+/** Sleep until the PRU raises its ARM event.
+ *
+ * timeout_ms of -1 blocks forever.
+ * \returns 1 if the event fired, 0 on timeout, -1 on error.
+ */
+extern int
+pru_wait_event(
+	pru_t * const pru,
+	const int timeout_ms
+);
+
+
 extern void
 pru_close(
 	pru_t * const pru
@@ -64,4 +99,16 @@ pru_gpio(
 );
 
 
+/** Configure pins as outputs driven low, a bitmask per GPIO bank.
+ *
+ * Writes the output enable registers of the banks directly instead of
+ * going through /sys/class/gpio, which takes three file writes per
+ * pin.  The pins must still be muxed as GPIOs by the device tree.
+ */
+extern int
+pru_gpio_outputs(
+	const uint32_t masks[4]
+);
+
+
 #endif
@@ -0,0 +1,936 @@
+/** \file
+ * Simulator of the AM335x PRU subsystem for the host.
+ *
+ * The two cores run in time order: whichever is due first executes
+ * its next instruction, so their accesses to the shared memories and
+ * the GPIOs interleave as they would on the chip.  The instructions
+ * are decoded from the words that pasm emits, see am335x/pasm/pasmop.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "util.h"
+#include "prusim.h"
+
+
+/** Shared RAM, in the PRUs' own address space. */
+#define SHARED_ADDR		0x10000
+#define SHARED_SIZE		0x3000
+
+/** The control registers of PRU0; PRU1's follow 0x2000 later. */
+#define CTRL_ADDR		0x22000
+#define CTRL_CONTROL		0x00
+#define CTRL_STATUS		0x04
+#define CTRL_CYCLE		0x0C
+#define CTRL_STALL		0x10
+#define CTRL_CTBIR0		0x20
+#define CTRL_CTBIR1		0x24
+#define CTRL_CTPPR0		0x28
+#define CTRL_CTPPR1		0x2C
+#define CONTROL_COUNTER_ENABLE	(1 << 3)
+
+#define INTC_ADDR		0x20000
+#define CFG_ADDR		0x26000
+
+#define IEP_ADDR		0x2E000
+#define IEP_GLOBAL_CFG		0x00
+#define IEP_COUNT		0x0C
+
+#define GPIO_SIZE		0x1000
+#define GPIO_DATAIN		0x138
+#define GPIO_DATAOUT		0x13C
+#define GPIO_CLEARDATAOUT	0x190
+#define GPIO_SETDATAOUT		0x194
+
+static const uint32_t gpio_addr[4] = {
+	0x44E07000,
+	0x4804C000,
+	0x481AC000,
+	0x481AE000,
+};
+
+/** Cycles of a load from the PRU subsystem for its first word. */
+#define LOCAL_LOAD_CYCLES	3
+
+#define DEFAULT_DDR_CYCLES	40
+#define DEFAULT_OCP_CYCLES	2
+
+/** Broadside devices of XIN and XOUT */
+#define XFR_SCRATCH0		10
+#define XFR_FILL		254
+#define XFR_ZERO		255
+
+
+typedef struct
+{
+	uint32_t reg[32];
+	unsigned carry;
+
+	uint32_t code[PRUSIM_IRAM_SIZE / 4];
+	size_t code_words;
+	uint32_t pc;
+	int running;
+
+	// cycle at which the next instruction issues
+	uint64_t ready;
+
+	// control registers; the cycle count is folded into cycle at
+	// cycle_at whenever the counter is written or switched
+	uint32_t control;
+	uint32_t cycle;
+	uint64_t cycle_at;
+	uint32_t stall;
+	uint32_t ctbir[2];
+	uint32_t ctppr[2];
+
+	prusim_stats_t stats;
+} prusim_core_t;
+
+
+struct prusim
+{
+	prusim_config_t config;
+	prusim_core_t core[2];
+
+	uint8_t dram[2][PRUSIM_DRAM_SIZE];
+	uint8_t shared[SHARED_SIZE];
+	uint8_t scratch[3][32 * 4];
+
+	uint32_t iep_cfg;
+	uint32_t iep_count;
+	uint64_t iep_at;
+
+	uint32_t gpio[4];
+
+	// issue time of the instruction being executed
+	uint64_t now;
+};
+
+
+/** Shift and width of the register fields, .b0 to .w2 and whole. */
+static const uint8_t field_shift[8] = { 0, 8, 16, 24, 0, 8, 16, 0 };
+static const uint8_t field_bits[8] = { 8, 8, 8, 8, 16, 16, 16, 32 };
+
+static uint32_t
+field_mask(
+	const unsigned field
+)
+{
+	return field_bits[field] == 32 ? 0xFFFFFFFF : (1u << field_bits[field]) - 1;
+}
+
+
+static uint32_t
+reg_get(
+	const prusim_core_t * const core,
+	const unsigned reg,
+	const unsigned field
+)
+{
+	return (core->reg[reg] >> field_shift[field]) & field_mask(field);
+}
+
+
+/** Write a register field.  r31 is the event interface: writing a
+ * value with bit 5 set raises system event 16 plus its low nibble.
+ */
+static void
+reg_set(
+	prusim_t * const sim,
+	const unsigned pru,
+	const unsigned reg,
+	const unsigned field,
+	const uint32_t value
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+	const uint32_t mask = field_mask(field) << field_shift[field];
+	const uint32_t v = (core->reg[reg] & ~mask) | ((value << field_shift[field]) & mask);
+
+	if (reg != 31)
+	{
+		core->reg[reg] = v;
+		return;
+	}
+
+	if ((v & 0x20) && sim->config.event)
+		sim->config.event(sim->config.arg, pru, 16 + (v & 0xF));
+}
+
+
+static uint8_t
+reg_byte(
+	const prusim_core_t * const core,
+	const unsigned byte
+)
+{
+	return core->reg[byte / 4] >> (8 * (byte % 4));
+}
+
+
+static void
+reg_set_byte(
+	prusim_core_t * const core,
+	const unsigned byte,
+	const uint8_t value
+)
+{
+	const unsigned shift = 8 * (byte % 4);
+	core->reg[byte / 4] = (core->reg[byte / 4] & ~(0xFFu << shift)) | (uint32_t) value << shift;
+}
+
+
+static uint32_t
+cycle_count(
+	const prusim_core_t * const core,
+	const uint64_t now
+)
+{
+	if (!(core->control & CONTROL_COUNTER_ENABLE))
+		return core->cycle;
+	return core->cycle + (uint32_t) (now - core->cycle_at);
+}
+
+
+static uint32_t
+iep_count(
+	const prusim_t * const sim
+)
+{
+	if (!(sim->iep_cfg & 1))
+		return sim->iep_count;
+	const unsigned inc = (sim->iep_cfg >> 4) & 0xF;
+	return sim->iep_count + (uint32_t) ((sim->now - sim->iep_at) * inc);
+}
+
+
+/** The base address of a constant table entry. */
+static uint32_t
+constant(
+	const prusim_t * const sim,
+	const unsigned pru,
+	const unsigned c
+)
+{
+	static const uint32_t table[32] = {
+		0x00020000, 0x48040000, 0x4802A000, 0x00030000,
+		0x00026000, 0x48060000, 0x48030000, 0x00028000,
+		0x46000000, 0x4A100000, 0x48318000, 0x48022000,
+		0x48024000, 0x48310000, 0x481CC000, 0x481D0000,
+		0x481A0000, 0x4819C000, 0x48300000, 0x48302000,
+		0x48304000, 0x00032400, 0x480C8000, 0x480CA000,
+	};
+	const prusim_core_t * const core = &sim->core[pru];
+
+	switch (c)
+	{
+	case 24: return (core->ctbir[0] & 0xFF) << 8;
+	case 25: return 0x2000 | ((core->ctbir[0] >> 16) & 0xFF) << 8;
+	case 26: return IEP_ADDR;
+	case 27: return 0x00032000;
+	case 28: return (core->ctppr[0] & 0xFFFF) << 8;
+	case 29: return 0x49000000 | (core->ctppr[0] >> 16) << 8;
+	case 30: return 0x40000000 | (core->ctppr[1] & 0xFFFF) << 8;
+	case 31: return 0x80000000 | (core->ctppr[1] >> 16) << 8;
+	default: return table[c];
+	}
+}
+
+
+/** The memory at addr, or NULL if it is not RAM.
+ *
+ * Sets *external if it is the DDR, outside the PRU subsystem.
+ */
+static uint8_t *
+mem_ptr(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t addr,
+	const size_t len,
+	int * const external
+)
+{
+	const uint64_t end = (uint64_t) addr + len;
+	const prusim_config_t * const config = &sim->config;
+	*external = 0;
+
+	if (end <= PRUSIM_DRAM_SIZE)
+		return sim->dram[pru] + addr;
+	if (addr >= 0x2000 && end <= 0x2000 + PRUSIM_DRAM_SIZE)
+		return sim->dram[!pru] + addr - 0x2000;
+	if (addr >= SHARED_ADDR && end <= SHARED_ADDR + SHARED_SIZE)
+		return sim->shared + addr - SHARED_ADDR;
+
+	if (config->ddr
+	&&  addr >= config->ddr_addr
+	&&  end <= (uint64_t) config->ddr_addr + config->ddr_size)
+	{
+		*external = 1;
+		return (uint8_t*) config->ddr + addr - config->ddr_addr;
+	}
+
+	return NULL;
+}
+
+
+static int
+gpio_bank(
+	const uint32_t addr
+)
+{
+	for (unsigned i = 0 ; i < 4 ; i++)
+		if (addr - gpio_addr[i] < GPIO_SIZE)
+			return i;
+	return -1;
+}
+
+
+/** Read a word of the memory mapped registers; sets *external for the
+ * GPIOs, which are outside the PRU subsystem.
+ */
+static uint32_t
+periph_read(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t addr,
+	int * const external
+)
+{
+	*external = 0;
+
+	if (addr - CTRL_ADDR < 0x4000)
+	{
+		const prusim_core_t * const core = &sim->core[(addr - CTRL_ADDR) / 0x2000];
+		switch ((addr - CTRL_ADDR) % 0x2000)
+		{
+		case CTRL_CONTROL: return core->control;
+		case CTRL_STATUS: return core->pc;
+		case CTRL_CYCLE: return cycle_count(core, sim->now);
+		case CTRL_STALL: return core->stall;
+		case CTRL_CTBIR0: return core->ctbir[0];
+		case CTRL_CTBIR1: return core->ctbir[1];
+		case CTRL_CTPPR0: return core->ctppr[0];
+		case CTRL_CTPPR1: return core->ctppr[1];
+		default: return 0;
+		}
+	}
+
+	if (addr - IEP_ADDR < 0x1000)
+	{
+		switch (addr - IEP_ADDR)
+		{
+		case IEP_GLOBAL_CFG: return sim->iep_cfg;
+		case IEP_COUNT: return iep_count(sim);
+		default: return 0;
+		}
+	}
+
+	// The interrupt controller and the SYSCFG of the subsystem
+	// have nothing to simulate; they read as zero.
+	if (addr - INTC_ADDR < 0x2000 || addr - CFG_ADDR < 0x2000)
+		return 0;
+
+	const int gpio = gpio_bank(addr);
+	if (gpio >= 0)
+	{
+		*external = 1;
+		switch (addr - gpio_addr[gpio])
+		{
+		case GPIO_DATAIN:
+		case GPIO_DATAOUT: return sim->gpio[gpio];
+		default: return 0;
+		}
+	}
+
+	die("PRU%u: read of unmapped address %08"PRIx32" at %"PRIu32"\n",
+		pru,
+		addr,
+		sim->core[pru].pc
+	);
+}
+
+
+static void
+gpio_write(
+	prusim_t * const sim,
+	const unsigned pru,
+	const unsigned gpio,
+	const uint32_t value
+)
+{
+	const uint32_t changed = sim->gpio[gpio] ^ value;
+	sim->gpio[gpio] = value;
+	sim->core[pru].stats.gpio_writes++;
+
+	if (!changed || !sim->config.edge)
+		return;
+
+	for (unsigned pin = 0 ; pin < 32 ; pin++)
+	{
+		if (!(changed & (1u << pin)))
+			continue;
+
+		const prusim_edge_t edge = {
+			.cycle	= sim->now,
+			.pru	= pru,
+			.gpio	= gpio,
+			.pin	= pin,
+			.level	= (value >> pin) & 1,
+		};
+		sim->config.edge(sim->config.arg, &edge);
+	}
+}
+
+
+static void
+periph_write(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t addr,
+	const uint32_t value,
+	int * const external
+)
+{
+	*external = 0;
+
+	if (addr - CTRL_ADDR < 0x4000)
+	{
+		prusim_core_t * const core = &sim->core[(addr - CTRL_ADDR) / 0x2000];
+		switch ((addr - CTRL_ADDR) % 0x2000)
+		{
+		case CTRL_CONTROL:
+			core->cycle = cycle_count(core, sim->now);
+			core->cycle_at = sim->now;
+			core->control = value;
+			break;
+		case CTRL_CYCLE:
+			core->cycle = value;
+			core->cycle_at = sim->now;
+			break;
+		case CTRL_STALL: core->stall = value; break;
+		case CTRL_CTBIR0: core->ctbir[0] = value; break;
+		case CTRL_CTBIR1: core->ctbir[1] = value; break;
+		case CTRL_CTPPR0: core->ctppr[0] = value; break;
+		case CTRL_CTPPR1: core->ctppr[1] = value; break;
+		default: break;
+		}
+		return;
+	}
+
+	if (addr - IEP_ADDR < 0x1000)
+	{
+		switch (addr - IEP_ADDR)
+		{
+		case IEP_GLOBAL_CFG:
+			sim->iep_count = iep_count(sim);
+			sim->iep_at = sim->now;
+			sim->iep_cfg = value;
+			break;
+		case IEP_COUNT:
+			sim->iep_count = value;
+			sim->iep_at = sim->now;
+			break;
+		default: break;
+		}
+		return;
+	}
+
+	if (addr - INTC_ADDR < 0x2000 || addr - CFG_ADDR < 0x2000)
+		return;
+
+	const int gpio = gpio_bank(addr);
+	if (gpio >= 0)
+	{
+		*external = 1;
+		switch (addr - gpio_addr[gpio])
+		{
+		case GPIO_DATAOUT:
+			gpio_write(sim, pru, gpio, value);
+			break;
+		case GPIO_SETDATAOUT:
+			gpio_write(sim, pru, gpio, sim->gpio[gpio] | value);
+			break;
+		case GPIO_CLEARDATAOUT:
+			gpio_write(sim, pru, gpio, sim->gpio[gpio] & ~value);
+			break;
+		default: break;
+		}
+		return;
+	}
+
+	die("PRU%u: write of unmapped address %08"PRIx32" at %"PRIu32"\n",
+		pru,
+		addr,
+		sim->core[pru].pc
+	);
+}
+
+
+/** Move len bytes between the register file, from byte reg on, and
+ * memory at addr, as LBBO and SBBO do.
+ *
+ * \returns the cycles that the instruction takes.
+ */
+static unsigned
+transfer(
+	prusim_t * const sim,
+	const unsigned pru,
+	const int load,
+	const unsigned reg,
+	const uint32_t addr,
+	const unsigned len
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+	const unsigned words = (len + 3) / 4;
+	int external;
+
+	if (reg + len > sizeof(core->reg))
+		die("PRU%u: %u bytes from register byte %u overrun the register file at %"PRIu32"\n",
+			pru,
+			len,
+			reg,
+			core->pc
+		);
+
+	uint8_t * const mem = mem_ptr(sim, pru, addr, len, &external);
+	if (mem)
+	{
+		for (unsigned i = 0 ; i < len ; i++)
+		{
+			if (load)
+				reg_set_byte(core, reg + i, mem[i]);
+			else
+				mem[i] = reg_byte(core, reg + i);
+		}
+	} else {
+		// A word of registers at a time; partial words are
+		// merged with what the register holds.
+		for (unsigned i = 0 ; i < len ; i += 4)
+		{
+			const unsigned n = len - i < 4 ? len - i : 4;
+			uint32_t v = periph_read(sim, pru, addr + i, &external);
+
+			if (load)
+			{
+				for (unsigned j = 0 ; j < n ; j++)
+					reg_set_byte(core, reg + i + j, v >> (8 * j));
+				continue;
+			}
+
+			for (unsigned j = 0 ; j < n ; j++)
+			{
+				v &= ~(0xFFu << (8 * j));
+				v |= (uint32_t) reg_byte(core, reg + i + j) << (8 * j);
+			}
+			periph_write(sim, pru, addr + i, v, &external);
+		}
+	}
+
+	if (mem && external)
+	{
+		if (load)
+		{
+			core->stats.ddr_reads++;
+			core->stats.ddr_read_bytes += len;
+		} else {
+			core->stats.ddr_writes++;
+			core->stats.ddr_write_bytes += len;
+		}
+	}
+
+	if (!load)
+		return external ? sim->config.ocp_cycles + words - 1 : words;
+	if (external)
+		return sim->config.ddr_cycles + words;
+	return LOCAL_LOAD_CYCLES + words - 1;
+}
+
+
+/** XIN, XOUT and XCHG with the scratch pad banks; ZERO and FILL are
+ * XIN from the pseudo devices 255 and 254.
+ */
+static void
+broadside(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t w
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+	const unsigned op = (w >> 23) & 0x7F;
+	const unsigned dev = (w >> 15) & 0xFF;
+	const unsigned reg = (w & 0x1F) * 4 + ((w >> 5) & 3);
+	const unsigned len = ((w >> 7) & 0x7F) + 1;
+
+	if (reg + len > sizeof(core->reg))
+		die("PRU%u: broadside of %u bytes overruns the register file at %"PRIu32"\n",
+			pru,
+			len,
+			core->pc
+		);
+
+	if (dev == XFR_ZERO || dev == XFR_FILL)
+	{
+		if (op != 0x5D)
+			die("PRU%u: bad broadside %08"PRIx32" at %"PRIu32"\n", pru, w, core->pc);
+		for (unsigned i = 0 ; i < len ; i++)
+			reg_set_byte(core, reg + i, dev == XFR_FILL ? 0xFF : 0);
+		return;
+	}
+
+	if (dev < XFR_SCRATCH0 || dev > XFR_SCRATCH0 + 2)
+		die("PRU%u: broadside device %u is not simulated at %"PRIu32"\n",
+			pru,
+			dev,
+			core->pc
+		);
+
+	uint8_t * const bank = sim->scratch[dev - XFR_SCRATCH0];
+	for (unsigned i = reg ; i < reg + len ; i++)
+	{
+		const uint8_t r = reg_byte(core, i);
+		if (op != 0x5E)
+			reg_set_byte(core, i, bank[i]);
+		if (op != 0x5D)
+			bank[i] = r;
+	}
+}
+
+
+/** Format 1 and 2: the ALU, jumps, LDI and friends. */
+static uint32_t
+alu(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t w
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+	const unsigned op = (w >> 25) & 0x1F;
+	const unsigned dst = w & 0x1F;
+	const unsigned dst_field = (w >> 5) & 7;
+	const uint32_t a = reg_get(core, (w >> 8) & 0x1F, (w >> 13) & 7);
+	const uint32_t b = (w & (1 << 24))
+		? (w >> 16) & 0xFF
+		: reg_get(core, (w >> 16) & 0x1F, (w >> 21) & 7);
+	const unsigned bits = field_bits[dst_field];
+	uint64_t r;
+
+	switch (op)
+	{
+	case 0x00: r = (uint64_t) a + b; break;
+	case 0x01: r = (uint64_t) a + b + core->carry; break;
+	case 0x02: r = (uint64_t) a - b; break;
+	case 0x03: r = (uint64_t) a - b - core->carry; break;
+	case 0x04: r = (uint64_t) a << (b & 0x1F); break;
+	case 0x05: r = a >> (b & 0x1F); break;
+	case 0x06: r = (uint64_t) b - a; break;
+	case 0x07: r = (uint64_t) b - a - core->carry; break;
+	case 0x08: r = a & b; break;
+	case 0x09: r = a | b; break;
+	case 0x0A: r = a ^ b; break;
+	case 0x0B: r = ~a; break;
+	case 0x0C: r = a < b ? a : b; break;
+	case 0x0D: r = a > b ? a : b; break;
+	case 0x0E: r = a & ~(1u << (b & 0x1F)); break;
+	case 0x0F: r = a | (1u << (b & 0x1F)); break;
+
+	case 0x10: // JMP
+	case 0x11: // JAL
+	{
+		const uint32_t target = (w & (1 << 24))
+			? (w >> 8) & 0xFFFF
+			: reg_get(core, (w >> 16) & 0x1F, (w >> 21) & 7);
+		if (op == 0x11)
+			reg_set(sim, pru, dst, dst_field, core->pc + 1);
+		return target;
+	}
+
+	case 0x12: // LDI
+		reg_set(sim, pru, dst, dst_field, (w >> 8) & 0xFFFF);
+		return core->pc + 1;
+
+	case 0x13: // LMBD
+	{
+		const unsigned width = field_bits[(w >> 13) & 7];
+		uint32_t bit = 32;
+		for (int i = width - 1 ; i >= 0 ; i--)
+		{
+			if (((a >> i) & 1) == (b & 1))
+			{
+				bit = i;
+				break;
+			}
+		}
+		reg_set(sim, pru, dst, dst_field, bit);
+		return core->pc + 1;
+	}
+
+	case 0x15: // HALT
+	case 0x1F: // SLP, which nothing would wake
+		core->running = 0;
+		return core->pc;
+
+	default:
+		die("PRU%u: instruction %08"PRIx32" at %"PRIu32" is not simulated\n",
+			pru,
+			w,
+			core->pc
+		);
+	}
+
+	// The carry is the bit past the destination for additions, and
+	// the borrow for subtractions, which wrap to the top of r.
+	if (op <= 0x01)
+		core->carry = (r >> bits) & 1;
+	else
+	if (op <= 0x07 && op != 0x04 && op != 0x05)
+		core->carry = (r >> 63) & 1;
+
+	reg_set(sim, pru, dst, dst_field, r);
+	return core->pc + 1;
+}
+
+
+/** Execute the next instruction of a PRU. */
+static void
+step(
+	prusim_t * const sim,
+	const unsigned pru
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+
+	if (core->pc >= core->code_words)
+		die("PRU%u: ran off the end of its program at %"PRIu32"\n",
+			pru,
+			core->pc
+		);
+
+	const uint32_t w = core->code[core->pc];
+	uint32_t next = core->pc + 1;
+	unsigned cycles = 1;
+	sim->now = core->ready;
+
+	// The second operand of the ALU, branches and bursts
+	const uint32_t op2 = (w & (1 << 24))
+		? (w >> 16) & 0xFF
+		: reg_get(core, (w >> 16) & 0x1F, (w >> 21) & 7);
+	const uint32_t src = reg_get(core, (w >> 8) & 0x1F, (w >> 13) & 7);
+
+	// Branches are words relative, ten bits signed
+	int32_t offset = (w & 0xFF) | ((w >> 25) & 3) << 8;
+	if (offset & 0x200)
+		offset -= 0x400;
+
+	switch (w >> 29)
+	{
+	case 0:
+	case 1:
+		// The seven bit opcodes, with XIN, XOUT and XCHG and
+		// LOOP taking the space of 0x17 to 0x19.
+		if ((w >> 25) == 0x17)
+			broadside(sim, pru, w);
+		else
+		if ((w >> 25) == 0x18 || (w >> 25) == 0x19)
+			die("PRU%u: LOOP at %"PRIu32" is not simulated\n", pru, core->pc);
+		else
+			next = alu(sim, pru, w);
+		break;
+
+	case 2:
+	case 3:
+	{
+		// QBGT, QBEQ and QBLT are the bits 29:27, which combine
+		// into QBGE, QBLE, QBNE and QBA.
+		const unsigned cond = (w >> 27) & 7;
+		const unsigned is = op2 > src ? 4 : op2 == src ? 2 : 1;
+		if ((w >> 27) == 0xF || (cond & is))
+			next = core->pc + offset;
+		break;
+	}
+
+	case 6:
+	{
+		const unsigned set = (src >> (op2 & 0x1F)) & 1;
+		if ((w >> 27) == 0x1A ? set : !set)
+			next = core->pc + offset;
+		break;
+	}
+
+	case 4:
+	case 7:
+	{
+		const int load = (w >> 28) & 1;
+		const unsigned base = (w >> 8) & 0x1F;
+		const uint32_t addr = op2 + ((w >> 29) == 4
+			? constant(sim, pru, base)
+			: core->reg[base]);
+		const unsigned reg = (w & 0x1F) * 4 + ((w >> 5) & 3);
+		const unsigned code = ((w >> 25) & 7) << 4 | ((w >> 13) & 7) << 1 | ((w >> 7) & 1);
+		const unsigned len = code < 124
+			? code + 1
+			: (core->reg[0] >> (8 * (code - 124))) & 0x7F;
+
+		cycles = len ? transfer(sim, pru, load, reg, addr, len) : 1;
+		break;
+	}
+
+	default:
+		die("PRU%u: instruction %08"PRIx32" at %"PRIu32" is not simulated\n",
+			pru,
+			w,
+			core->pc
+		);
+	}
+
+	if (cycles < 1)
+		cycles = 1;
+
+	core->pc = next;
+	core->ready += cycles;
+	core->stats.cycles += cycles;
+	core->stats.instructions++;
+	core->stats.stall_cycles += cycles - 1;
+	if (core->control & CONTROL_COUNTER_ENABLE)
+		core->stall += cycles - 1;
+}
+
+
+prusim_t *
+prusim_init(
+	const prusim_config_t * const config
+)
+{
+	prusim_t * const sim = calloc(1, sizeof(*sim));
+	if (!sim)
+		die("prusim: out of memory\n");
+
+	sim->config = *config;
+	if (!sim->config.ddr_cycles)
+		sim->config.ddr_cycles = DEFAULT_DDR_CYCLES;
+	if (!sim->config.ocp_cycles)
+		sim->config.ocp_cycles = DEFAULT_OCP_CYCLES;
+
+	return sim;
+}
+
+
+void
+prusim_close(
+	prusim_t * const sim
+)
+{
+	free(sim);
+}
+
+
+void *
+prusim_dram(
+	prusim_t * const sim,
+	const unsigned pru
+)
+{
+	return sim->dram[pru];
+}
+
+
+void
+prusim_load(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t * const code,
+	const size_t size
+)
+{
+	prusim_core_t * const core = &sim->core[pru];
+
+	if (size > sizeof(core->code))
+		die("PRU%u: program of %zu bytes does not fit in %u bytes\n",
+			pru,
+			size,
+			PRUSIM_IRAM_SIZE
+		);
+
+	memset(core, 0, sizeof(*core));
+	memcpy(core->code, code, size);
+	core->code_words = size / 4;
+	core->running = 1;
+	core->ready = sim->now;
+	core->cycle_at = sim->now;
+	core->control = 2; // enabled, the counter off
+}
+
+
+void
+prusim_halt(
+	prusim_t * const sim,
+	const unsigned pru
+)
+{
+	sim->core[pru].running = 0;
+}
+
+
+int
+prusim_running(
+	const prusim_t * const sim,
+	const unsigned pru
+)
+{
+	return sim->core[pru].running;
+}
+
+
+uint64_t
+prusim_run(
+	prusim_t * const sim,
+	const uint64_t cycles
+)
+{
+	const uint64_t start = sim->now;
+	const uint64_t end = start + cycles;
+
+	while (1)
+	{
+		// The core that is due first goes next
+		int pru = -1;
+		for (unsigned i = 0 ; i < 2 ; i++)
+		{
+			const prusim_core_t * const core = &sim->core[i];
+			if (core->running && (pru < 0 || core->ready < sim->core[pru].ready))
+				pru = i;
+		}
+
+		if (pru < 0)
+			return sim->now - start;
+		if (sim->core[pru].ready >= end)
+			break;
+
+		step(sim, pru);
+	}
+
+	sim->now = end;
+	return cycles;
+}
+
+
+uint64_t
+prusim_now(
+	const prusim_t * const sim
+)
+{
+	return sim->now;
+}
+
+
+const prusim_stats_t *
+prusim_stats(
+	const prusim_t * const sim,
+	const unsigned pru
+)
+{
+	return &sim->core[pru].stats;
+}
@@ -0,0 +1,175 @@
+/** \file
+ * Simulator of the AM335x PRU subsystem for the host.
+ *
+ * Runs the programs that pasm assembles for the PRUs on a plain Linux
+ * box, so that changes to the firmware can be timed without a
+ * BeagleBone.  Both PRUs, their data RAMs, the shared RAM, the control
+ * registers' cycle and stall counters, the IEP timer, the data out
+ * registers of the four GPIO banks and a window of DDR are modelled,
+ * along with the instructions that pasm emits for them.
+ *
+ * Every instruction takes one cycle, and the memory accesses the
+ * extra cycles given in prusim_config_t.  Those are estimates of the
+ * interconnect rather than measurements, so the edges on the pins
+ * are as exact as the firmware's own instruction counts, and the
+ * stalls on the DDR as good as its latency.
+ */
+#ifndef _prusim_h_
+#define _prusim_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/** Size in bytes of each PRU's instruction and data RAMs. */
+#define PRUSIM_IRAM_SIZE	0x2000
+#define PRUSIM_DRAM_SIZE	0x2000
+
+/** Nanoseconds per cycle of the PRUs and of the IEP timer. */
+#define PRUSIM_NS_PER_CYCLE	5
+
+
+/** A pin of a GPIO bank changing level. */
+typedef struct
+{
+	uint64_t cycle; // time of the write that changed it
+	unsigned pru; // which PRU wrote it
+	uint8_t gpio; // bank 0 to 3
+	uint8_t pin; // bit 0 to 31
+	uint8_t level;
+} prusim_edge_t;
+
+
+/** Options for prusim_init().
+ *
+ * Zeroed latencies select the defaults.
+ */
+typedef struct
+{
+	/** DDR window, at ddr_addr in the PRUs' address space. */
+	void * ddr;
+	uint32_t ddr_addr;
+	size_t ddr_size;
+
+	/** Cycles that a load from the DDR waits for its first word. */
+	unsigned ddr_cycles;
+
+	/** Cycles that a write outside the PRU subsystem, to the GPIOs
+	 * or the DDR, waits before the PRU can go on.
+	 */
+	unsigned ocp_cycles;
+
+	/** Called on every pin that changes level, if not NULL. */
+	void (*edge)(
+		void * arg,
+		const prusim_edge_t * edge
+	);
+
+	/** Called when a PRU raises a system event with a write to
+	 * r31, such as PRU0_ARM_INTERRUPT, if not NULL.
+	 */
+	void (*event)(
+		void * arg,
+		unsigned pru,
+		unsigned event
+	);
+
+	void * arg;
+} prusim_config_t;
+
+
+/** Counters of one PRU. */
+typedef struct
+{
+	uint64_t cycles; // spent running
+	uint64_t instructions;
+	uint64_t stall_cycles; // waiting on memory beyond the first cycle
+	uint64_t ddr_reads; // bursts read from the DDR
+	uint64_t ddr_read_bytes;
+	uint64_t ddr_writes;
+	uint64_t ddr_write_bytes;
+	uint64_t gpio_writes;
+} prusim_stats_t;
+
+
+typedef struct prusim prusim_t;
+
+
+extern prusim_t *
+prusim_init(
+	const prusim_config_t * const config
+);
+
+
+extern void
+prusim_close(
+	prusim_t * const sim
+);
+
+
+/** The data RAM of a PRU, for the host's side of the command. */
+extern void *
+prusim_dram(
+	prusim_t * const sim,
+	const unsigned pru
+);
+
+
+/** Load a program into a PRU and start it at its first instruction.
+ *
+ * size is in bytes, as pasm -b writes or pasm -c declares it.
+ * A program that is already running is replaced.
+ */
+extern void
+prusim_load(
+	prusim_t * const sim,
+	const unsigned pru,
+	const uint32_t * const code,
+	const size_t size
+);
+
+
+/** Stop a PRU wherever it is. */
+extern void
+prusim_halt(
+	prusim_t * const sim,
+	const unsigned pru
+);
+
+
+/** Non-zero if the PRU has not halted. */
+extern int
+prusim_running(
+	const prusim_t * const sim,
+	const unsigned pru
+);
+
+
+/** Run both PRUs for up to cycles cycles.
+ *
+ * Returns early only when both PRUs have halted; the callbacks may
+ * write to the data RAMs and halt or reload the PRUs.
+ * \returns the cycles actually simulated.
+ */
+extern uint64_t
+prusim_run(
+	prusim_t * const sim,
+	const uint64_t cycles
+);
+
+
+/** Cycles simulated since prusim_init(). */
+extern uint64_t
+prusim_now(
+	const prusim_t * const sim
+);
+
+
+extern const prusim_stats_t *
+prusim_stats(
+	const prusim_t * const sim,
+	const unsigned pru
+);
+
+
+#endif
@@ -12,6 +12,7 @@
 #include "ledscape.h"
 
 static void ledscape_fill_color(
+  ledscape_t * const leds,
   ledscape_frame_t * const frame,
   const unsigned num_pixels,
   const uint8_t r,
@@ -21,70 +22,84 @@ static void ledscape_fill_color(
 {
   for (unsigned i = 0 ; i < num_pixels ; i++)
     for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
-      ledscape_set_color(frame, strip, i, r, g, b);
+      ledscape_set_color(leds, frame, strip, i, r, g, b);
 }
 
-int main (void)
+static void render(
+  ledscape_t * const leds,
+  ledscape_frame_t * const frame,
+  const uint64_t now_ns,
+  const uint64_t dt_ns,
+  void * const arg
+)
 {
-  const int num_pixels = 170;
-  ledscape_t * const leds = ledscape_init(num_pixels);
-  time_t last_time = time(NULL);
-  unsigned last_i = 0;
+  (void) leds; (void) now_ns; (void) dt_ns;
+  const unsigned num_pixels = *(const unsigned*) arg;
+  static unsigned i;
+  i++;
 
   uint8_t rgb[3];
 
-  unsigned i = 0;
-  while (1)
+  for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
   {
-    // Alternate frame buffers on each draw command
-    const unsigned frame_num = i++ % 2;
-    ledscape_frame_t * const frame
-      = ledscape_frame(leds, frame_num);
-
-    uint8_t val = i >> 1;
-    uint16_t r = ((i >>  0) & 0xFF);
-    uint16_t g = ((i >>  4) & 0xFF);
-    uint16_t b = ((i >>  8) & 0xFF);
-
-    for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
+    for (unsigned p = 0 ; p < num_pixels; p++)
     {
-      for (unsigned p = 0 ; p < num_pixels; p++)
-      {
-        HSBtoRGB(
-          ((i + (p*360)/num_pixels) % 360), 
-          100, 
-          219,
-          rgb
-        );
-
-        ledscape_set_color(
-          frame,
-          strip,
-          p,
-          
-         rgb[0],
-         rgb[1],
-         rgb[2]
-        );
-        //ledscape_set_color(frame, strip, 3*p+1, 0, p+val + 80, 0);
-        //ledscape_set_color(frame, strip, 3*p+2, 0, 0, p+val + 160);
-      }
+      HSBtoRGB(
+        ((i + (p*360)/num_pixels) % 360), 
+        100, 
+        219,
+        rgb
+      );
+
+      ledscape_set_color(
+        leds,
+        frame,
+        strip,
+        p,
+        rgb[0],
+        rgb[1],
+        rgb[2]
+      );
     }
+  }
+}
 
-    // wait for the previous frame to finish;
-    const uint32_t response = ledscape_wait(leds);
-    time_t now = time(NULL);
+int main (void)
+{
+  unsigned num_pixels = 170;
+  ledscape_t * const leds = ledscape_init(num_pixels, LEDSCAPE_NUM_STRIPS);
 
-    if (now != last_time)
-    {
-      printf("%d fps. starting %d previous %"PRIx32"\n", i - last_i, i, response);
-      last_i = i;
-      last_time = now;
-    }
+  // fps 0: redraw as soon as the PRU has clocked out the last frame
+  ledscape_pacer_t * const pacer
+    = ledscape_pacer_start(leds, 0, render, &num_pixels);
+
+  uint64_t last_frames = 0;
 
-    ledscape_draw(leds, frame_num);
+  while (1)
+  {
+    sleep(1);
+
+    ledscape_pacer_stats_t stats;
+    ledscape_pacer_stats(pacer, &stats);
+    printf("%"PRIu64" fps. frame time %"PRIu64" us, worst %"PRIu64" us\n",
+      stats.frames - last_frames,
+      stats.last_frame_ns / 1000,
+      stats.max_frame_ns / 1000
+    );
+
+    ledscape_telemetry_t telemetry;
+    ledscape_telemetry(leds, &telemetry);
+    printf("clock out %"PRIu32" us, worst %"PRIu32" us, skew %"PRId32" ns, stalls %"PRIu32", restarts %u\n",
+      telemetry.last.clock_ns[0] / 1000,
+      telemetry.max_clock_ns / 1000,
+      telemetry.last.skew_ns,
+      telemetry.max_stall_cycles,
+      telemetry.restarts
+    );
+    last_frames = stats.frames;
   }
 
+  ledscape_pacer_stop(pacer);
   ledscape_close(leds);
 
   return EXIT_SUCCESS;
@@ -0,0 +1,144 @@
+/** \file
+ * Shared memory frame receiver.
+ *
+ * Creates the frame ring of shm.c and draws whatever renderers on
+ * the same board publish into it.  The frames are strip-major RGB,
+ * as udp-rx takes them, but are blitted straight out of the shared
+ * memory instead of being copied through a socket.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <string.h>
+#include "ledscape.h"
+#include "util.h"
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	const char * name = LEDSCAPE_SHM_NAME;
+	int num_pixels = 256;
+	int num_strips = LEDSCAPE_NUM_STRIPS;
+	int rgbw = 0;
+	int apa102 = 0;
+	unsigned brightness = 0;
+	const ledscape_timing_t * timing = NULL;
+
+	extern char *optarg;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:c:d:s:WAB:T:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			name = optarg;
+			break;
+		case 'c':
+			num_pixels = atoi(optarg);
+			break;
+		case 's':
+			num_strips = atoi(optarg);
+			if (num_strips < 1 || num_strips > LEDSCAPE_NUM_STRIPS)
+				die("-s must be 1 to %d strips\n", LEDSCAPE_NUM_STRIPS);
+			break;
+		case 'd': {
+			int width=0, height=0;
+
+			if (sscanf(optarg,"%dx%d", &width, &height) == 2) {
+				num_pixels = width * height;
+			} else {
+				printf("Invalid argument for -d; expected NxN; actual: %s", optarg);
+				exit(EXIT_FAILURE);
+			}
+		}
+		break;
+		case 'W':
+			rgbw = 1;
+			break;
+		case 'A':
+			apa102 = 1;
+			break;
+		case 'B':
+			brightness = atoi(optarg);
+			if (brightness < 1 || brightness > 31)
+				die("-B must be 1 to 31\n");
+			break;
+		case 'T':
+			timing = ledscape_timing(optarg);
+			if (!timing)
+				die("-T %s is not a timing profile\n", optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n <shm name>] [-s <strips>] [-c <led_count> | -d <width>x<height>] [-W(RGBW strips)] [-A(PA102 strips) [-B <brightness 1-31>]] [-T <timing profile>]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Only clock out what changed since the last frame
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= num_pixels,
+		.num_strips	= num_strips,
+		.change_aware	= 1,
+		.rgbw		= rgbw,
+		.apa102		= apa102,
+		.brightness	= brightness,
+		.timing		= timing,
+	});
+
+	ledscape_shm_t * const shm = ledscape_shm_create(name, num_pixels, num_strips);
+
+	fprintf(stderr, "Started LEDscape shared memory receiver on %s for %d pixels\n", name, num_pixels);
+
+	uint64_t last_ns = monotonic_ns();
+	unsigned frames = 0;
+	unsigned torn = 0;
+	int frame_num = -1;
+
+	while (1)
+	{
+		const uint8_t * const rgb = ledscape_shm_read(shm, 1000);
+
+		if (rgb)
+		{
+			if (frame_num < 0)
+				frame_num = ledscape_acquire(leds, -1);
+
+			ledscape_blit_strips(
+				leds,
+				ledscape_frame(leds, frame_num),
+				0,
+				rgb,
+				num_pixels * num_strips
+			);
+
+			// A frame that the producer overwrote while it was
+			// blitted is replaced with the next one
+			if (ledscape_shm_done(shm))
+			{
+				ledscape_submit(leds, frame_num);
+				ledscape_present(leds, -1);
+				frame_num = -1;
+				frames++;
+			} else {
+				torn++;
+			}
+		}
+
+		const uint64_t now = monotonic_ns();
+		if (now - last_ns >= 1000000000)
+		{
+			printf("%u fps, %u torn\n", frames, torn);
+			last_ns = now;
+			frames = torn = 0;
+		}
+	}
+
+	ledscape_shm_close(shm);
+	ledscape_close(leds);
+	return 0;
+}
@@ -0,0 +1,353 @@
+/** \file
+ * Shared memory frame ring for renderers on the BeagleBone itself.
+ *
+ * Sending frames to udp-rx on localhost costs a sendto(), a copy
+ * through the network stack and a recv() per frame.  Instead, the
+ * receiver creates a POSIX shared memory object and a renderer in
+ * another process writes its frames straight into it; the receiver
+ * blits the newest one into a LEDscape frame, which is the only pass
+ * over the pixels.
+ *
+ * The object is a page with ledscape_shm_header_t followed by
+ * num_slots slots of strip-major RGB, as udp-rx takes it.  Frame n,
+ * counting from 1, goes into slot n % num_slots.  Each slot has a
+ * sequence count that is odd while the producer writes it, so that
+ * the receiver can tell when it was overwritten under it, and the
+ * published count of the newest complete frame doubles as a futex
+ * that the receiver sleeps on.  consumed is the newest frame that the
+ * receiver took, which paces a producer that runs ahead of the PRUs.
+ *
+ * There is one producer at a time.  The object is not removed on
+ * close, so a producer keeps its mapping across receiver restarts.
+ *
+ * Any user may write the header, and the receiver usually runs as
+ * root, so the geometry of the ring is checked once when it is
+ * created or opened and only the private copy is used after that.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ledscape.h"
+#include "util.h"
+
+
+struct ledscape_shm
+{
+	ledscape_shm_header_t * header;
+	size_t size;
+
+	// The geometry, as checked by create or open
+	uint32_t num_slots;
+	size_t slot_size;
+	size_t data_offset;
+
+	// Producer: the frame being written
+	uint32_t writing;
+
+	// Receiver: the frame being read, its slot's count when it was
+	// picked and the newest frame that was returned
+	uint32_t reading;
+	uint32_t reading_seq;
+	uint32_t last;
+};
+
+
+static ledscape_shm_t *
+shm_map(
+	const int fd,
+	const size_t size
+)
+{
+	void * const p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		die("mmap %zu bytes failed: %s\n", size, strerror(errno));
+	close(fd);
+
+	ledscape_shm_t * const shm = calloc(1, sizeof(*shm));
+	if (!shm)
+		die("calloc failed: %s\n", strerror(errno));
+
+	*shm = (ledscape_shm_t) {
+		.header	= p,
+		.size	= size,
+	};
+
+	return shm;
+}
+
+
+static uint8_t *
+shm_slot(
+	const ledscape_shm_t * const shm,
+	const uint32_t frame
+)
+{
+	return (uint8_t*) shm->header + shm->data_offset + (frame % shm->num_slots) * shm->slot_size;
+}
+
+
+/** Create the frame ring for num_strips strips of num_pixels pixels.
+ *
+ * Called by the receiver.  An existing object of the same name is
+ * resized and reset, and everyone may map it, so that renderers do
+ * not have to run as the same user as the receiver.
+ */
+ledscape_shm_t *
+ledscape_shm_create(
+	const char * const name,
+	const unsigned num_pixels,
+	const unsigned num_strips
+)
+{
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t data_offset = (sizeof(ledscape_shm_header_t) + page - 1) & ~(page - 1);
+	const size_t slot_size = (size_t) num_pixels * num_strips * 3;
+	const size_t size = data_offset + LEDSCAPE_SHM_SLOTS * slot_size;
+
+	const int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		die("shm_open %s failed: %s\n", name, strerror(errno));
+
+	// The mode passed to shm_open() is subject to the umask
+	if (fchmod(fd, 0666) < 0)
+		warn("chmod %s failed: %s\n", name, strerror(errno));
+
+	if (ftruncate(fd, size) < 0)
+		die("%s: resize to %zu bytes failed: %s\n", name, size, strerror(errno));
+
+	ledscape_shm_t * const shm = shm_map(fd, size);
+	ledscape_shm_header_t * const h = shm->header;
+	shm->num_slots = LEDSCAPE_SHM_SLOTS;
+	shm->slot_size = slot_size;
+	shm->data_offset = data_offset;
+
+	// A producer that already has it mapped must not see a
+	// half written header
+	__atomic_store_n(&h->magic, 0, __ATOMIC_RELEASE);
+
+	h->version	= LEDSCAPE_SHM_VERSION;
+	h->num_pixels	= num_pixels;
+	h->num_strips	= num_strips;
+	h->num_slots	= LEDSCAPE_SHM_SLOTS;
+	h->slot_size	= slot_size;
+	h->data_offset	= data_offset;
+	h->published	= 0;
+	h->consumed	= 0;
+	for (unsigned i = 0 ; i < LEDSCAPE_SHM_SLOTS ; i++)
+		h->seq[i] = 0;
+
+	__atomic_store_n(&h->magic, LEDSCAPE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return shm;
+}
+
+
+/** Map the frame ring that a receiver created.
+ *
+ * \returns NULL if there is none or it is not a LEDscape ring.
+ */
+ledscape_shm_t *
+ledscape_shm_open(
+	const char * const name
+)
+{
+	const int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+	{
+		warn("shm_open %s failed: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(ledscape_shm_header_t))
+	{
+		warn("%s: not a frame ring\n", name);
+		close(fd);
+		return NULL;
+	}
+
+	ledscape_shm_t * const shm = shm_map(fd, st.st_size);
+	const ledscape_shm_header_t * const h = shm->header;
+
+	const int valid = __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == LEDSCAPE_SHM_MAGIC;
+	shm->num_slots = h->num_slots;
+	shm->slot_size = h->slot_size;
+	shm->data_offset = h->data_offset;
+	const uint64_t pixel_bytes = (uint64_t) h->num_pixels * h->num_strips * 3;
+
+	if (!valid
+	||  h->version != LEDSCAPE_SHM_VERSION
+	||  shm->num_slots == 0
+	||  shm->num_slots > LEDSCAPE_SHM_SLOTS
+	||  shm->slot_size < pixel_bytes
+	||  shm->data_offset < sizeof(ledscape_shm_header_t)
+	||  shm->data_offset + (uint64_t) shm->num_slots * shm->slot_size > shm->size)
+	{
+		warn("%s: not a version %u frame ring\n", name, LEDSCAPE_SHM_VERSION);
+		ledscape_shm_close(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+
+/** The geometry of the ring; num_pixels and num_strips at least. */
+const ledscape_shm_header_t *
+ledscape_shm_header(
+	const ledscape_shm_t * const shm
+)
+{
+	return shm->header;
+}
+
+
+/** Start writing the next frame.
+ *
+ * Waits up to timeout_ms (-1 forever) while the receiver is a whole
+ * ring of frames behind, then takes the oldest slot anyway so that a
+ * producer does not hang with the receiver stopped.
+ *
+ * \returns the slot to fill with strip-major RGB.
+ */
+uint8_t *
+ledscape_shm_begin(
+	ledscape_shm_t * const shm,
+	const int timeout_ms
+)
+{
+	ledscape_shm_header_t * const h = shm->header;
+	const uint32_t frame = __atomic_load_n(&h->published, __ATOMIC_RELAXED) + 1;
+	const uint64_t deadline_ns = monotonic_ns() + (uint64_t) timeout_ms * 1000000;
+
+	while (1)
+	{
+		const uint32_t consumed = __atomic_load_n(&h->consumed, __ATOMIC_ACQUIRE);
+		if (frame - consumed <= shm->num_slots)
+			break;
+
+		int wait_ms = timeout_ms;
+		if (timeout_ms >= 0)
+		{
+			const uint64_t now = monotonic_ns();
+			if (now >= deadline_ns)
+				break;
+			wait_ms = (deadline_ns - now + 999999) / 1000000;
+		}
+
+		futex_wait(&h->consumed, consumed, wait_ms);
+	}
+
+	// Odd while the slot is written
+	volatile uint32_t * const seq = &h->seq[frame % shm->num_slots];
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	shm->writing = frame;
+	return shm_slot(shm, frame);
+}
+
+
+/** Hand the frame from ledscape_shm_begin() to the receiver. */
+void
+ledscape_shm_publish(
+	ledscape_shm_t * const shm
+)
+{
+	ledscape_shm_header_t * const h = shm->header;
+	const uint32_t frame = shm->writing;
+	volatile uint32_t * const seq = &h->seq[frame % shm->num_slots];
+
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->published, frame, __ATOMIC_RELEASE);
+	futex_wake(&h->published);
+}
+
+
+/** Wait up to timeout_ms (-1 forever) for a frame newer than the
+ * last one returned.
+ *
+ * Frames that were published in the mean time are skipped.  The slot
+ * must be passed to ledscape_shm_done() once it has been copied.
+ *
+ * \returns the newest frame's slot, or NULL on timeout.
+ */
+const uint8_t *
+ledscape_shm_read(
+	ledscape_shm_t * const shm,
+	const int timeout_ms
+)
+{
+	ledscape_shm_header_t * const h = shm->header;
+	const uint64_t deadline_ns = monotonic_ns() + (uint64_t) timeout_ms * 1000000;
+
+	while (1)
+	{
+		// If the producer is already writing over the newest frame,
+		// it has lapped the ring and will publish a newer one, which
+		// is waited for like any other.
+		const uint32_t frame = __atomic_load_n(&h->published, __ATOMIC_ACQUIRE);
+		const uint32_t seq = frame == shm->last ? 0
+			: __atomic_load_n(&h->seq[frame % shm->num_slots], __ATOMIC_ACQUIRE);
+		if (frame == shm->last || seq & 1)
+		{
+			int wait_ms = timeout_ms;
+			if (timeout_ms >= 0)
+			{
+				const uint64_t now = monotonic_ns();
+				if (now >= deadline_ns)
+					return NULL;
+				wait_ms = (deadline_ns - now + 999999) / 1000000;
+			}
+
+			futex_wait(&h->published, frame, wait_ms);
+			continue;
+		}
+
+		shm->reading = frame;
+		shm->reading_seq = seq;
+		shm->last = frame;
+		return shm_slot(shm, frame);
+	}
+}
+
+
+/** Finish with the slot from ledscape_shm_read().
+ *
+ * \returns 1 if the slot was intact, or 0 if the producer wrote over
+ * it while it was read, in which case the copy is torn and should be
+ * replaced with the next frame.
+ */
+int
+ledscape_shm_done(
+	ledscape_shm_t * const shm
+)
+{
+	ledscape_shm_header_t * const h = shm->header;
+	const uint32_t frame = shm->reading;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	const uint32_t seq = __atomic_load_n(&h->seq[frame % shm->num_slots], __ATOMIC_RELAXED);
+
+	__atomic_store_n(&h->consumed, frame, __ATOMIC_RELEASE);
+	futex_wake(&h->consumed);
+
+	return seq == shm->reading_seq;
+}
+
+
+/** Unmap the ring; the shared memory object itself stays. */
+void
+ledscape_shm_close(
+	ledscape_shm_t * const shm
+)
+{
+	munmap(shm->header, shm->size);
+	free(shm);
+}
@@ -1,6 +1,11 @@
 /** \file
  *  UDP image packet receiver.
  *
+ * With -n it also creates the shared memory frame ring of shm.c, so
+ * that renderers on the BeagleBone itself can publish frames without
+ * going through the socket, and draws whichever frames arrive from
+ * either.
+ *
  * Based on the HackRockCity LED Display code:
  * https://github.com/agwn/pyramidTransmitter/blob/master/LEDDisplay.pde
  */
@@ -13,8 +18,103 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 #include "ledscape.h"
 #include "pru.h"
+#include "util.h"
+
+
+/** The socket and the frame ring take turns with the LEDscape frames;
+ * the lock keeps one from blitting into the frame the other draws.
+ * Frames from the ring are blitted into a spare frame of their own
+ * and swapped in only if they were not torn, so that a torn one never
+ * shows through a short packet.
+ */
+typedef struct
+{
+	ledscape_t * leds;
+	ledscape_shm_t * shm;
+	size_t num_pixels;
+
+	pthread_mutex_t lock;
+	unsigned frame_num; // the next frame for packets
+	unsigned shown; // the frame drawn last
+	unsigned spare; // the next frame for the ring
+	time_t last_time;
+	int fps_counter;
+} udp_rx_t;
+
+
+static void
+rx_blit(
+	udp_rx_t * const rx,
+	const unsigned frame_num,
+	const uint8_t * const rgb,
+	const size_t num_pixels
+)
+{
+	ledscape_frame_t * const frame
+		= ledscape_frame(rx->leds, frame_num);
+
+	ledscape_blit_strips(rx->leds, frame, 0, rgb, num_pixels);
+}
+
+
+static void
+rx_draw(
+	udp_rx_t * const rx,
+	const unsigned frame_num
+)
+{
+	ledscape_wait(rx->leds);
+	ledscape_draw(rx->leds, frame_num);
+
+	time_t now = time(NULL);
+
+	if (now != rx->last_time)
+	{
+		printf("%d fps\n", rx->fps_counter);
+		rx->last_time = now;
+		rx->fps_counter = 0;
+	}
+	rx->fps_counter++;
+
+	// The frame that was shown before is free again
+	if (frame_num == rx->frame_num)
+		rx->frame_num = rx->shown;
+	else
+		rx->spare = rx->shown;
+	rx->shown = frame_num;
+}
+
+
+static void *
+shm_thread(
+	void * const arg
+)
+{
+	udp_rx_t * const rx = arg;
+
+	while (1)
+	{
+		const uint8_t * const rgb = ledscape_shm_read(rx->shm, -1);
+		if (!rgb)
+			continue;
+
+		pthread_mutex_lock(&rx->lock);
+		rx_blit(rx, rx->spare, rgb, rx->num_pixels);
+
+		// A frame that the producer overwrote while it was
+		// blitted stays in the spare frame, to be overwritten by
+		// the next one
+		if (ledscape_shm_done(rx->shm))
+			rx_draw(rx, rx->spare);
+		pthread_mutex_unlock(&rx->lock);
+	}
+
+	return NULL;
+}
+
 
 int
 main(
@@ -23,21 +123,34 @@ main(
 )
 {
 	int port = 9999;
+	const char * shm_name = NULL;
 	int num_pixels = 256;
 	int num_strips = LEDSCAPE_NUM_STRIPS;
+	int rgbw = 0;
+	int apa102 = 0;
+	unsigned brightness = 0;
+	const ledscape_timing_t * timing = NULL;
 
 	extern char *optarg;
 	int opt;
-	while ((opt = getopt(argc, argv, "p:c:d:")) != -1)
+	while ((opt = getopt(argc, argv, "p:n:c:d:s:WAB:T:")) != -1)
 	{
 		switch (opt)
 		{
 		case 'p':
 			port = atoi(optarg);
 			break;
+		case 'n':
+			shm_name = optarg;
+			break;
 		case 'c':
 			num_pixels = atoi(optarg);
 			break;
+		case 's':
+			num_strips = atoi(optarg);
+			if (num_strips < 1 || num_strips > LEDSCAPE_NUM_STRIPS)
+				die("-s must be 1 to %d strips\n", LEDSCAPE_NUM_STRIPS);
+			break;
 		case 'd': {
 			int width=0, height=0;
 
@@ -49,8 +162,24 @@ main(
 			}
 		}
 		break;
+		case 'W':
+			rgbw = 1;
+			break;
+		case 'A':
+			apa102 = 1;
+			break;
+		case 'B':
+			brightness = atoi(optarg);
+			if (brightness < 1 || brightness > 31)
+				die("-B must be 1 to 31\n");
+			break;
+		case 'T':
+			timing = ledscape_timing(optarg);
+			if (!timing)
+				die("-T %s is not a timing profile\n", optarg);
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-p <port>] [-c <led_count> | -d <width>x<height>]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-p <port>] [-n <shm name>] [-s <strips>] [-c <led_count> | -d <width>x<height>] [-W(RGBW strips)] [-A(PA102 strips) [-B <brightness 1-31>]] [-T <timing profile>]\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -68,16 +197,45 @@ main(
 	if (bind(sock, (const struct sockaddr*) &addr, sizeof(addr)) < 0)
 		die("bind port %d failed: %s\n", port, strerror(errno));
 
-	ledscape_t * const leds = ledscape_init(num_pixels);
+	// Only clock out what changed since the last packet; the frame
+	// ring has a spare frame of its own
+	ledscape_t * const leds = ledscape_init_config(&(ledscape_config_t) {
+		.num_pixels	= num_pixels,
+		.num_strips	= num_strips,
+		.num_frames	= shm_name ? 3 : 2,
+		.change_aware	= 1,
+		.rgbw		= rgbw,
+		.apa102		= apa102,
+		.brightness	= brightness,
+		.timing		= timing,
+	});
+
+	udp_rx_t rx = {
+		.leds		= leds,
+		.num_pixels	= num_pixels * num_strips,
+		.frame_num	= 0,
+		.shown		= 1,
+		.spare		= 2,
+		.last_time	= time(NULL),
+	};
+	pthread_mutex_init(&rx.lock, NULL);
 
 	fprintf(stderr, "Started LEDscape UDP receiver on port %d for %d pixels\n", port, num_pixels);
 
-	unsigned frame_num = 0;
+	if (shm_name)
+	{
+		rx.shm = ledscape_shm_create(shm_name, num_pixels, num_strips);
+
+		pthread_t thread;
+		const int rc = pthread_create(&thread, NULL, shm_thread, &rx);
+		if (rc)
+			die("pthread_create failed: %s\n", strerror(rc));
+
+		fprintf(stderr, "and on shared memory %s\n", shm_name);
+	}
 
 	uint8_t buf[num_pixels * num_strips * 4];
 
-	time_t last_time = time(NULL);
-	int fps_counter=0;
 	while (1)
 	{
 		const ssize_t rc = recv(sock, buf, sizeof(buf), 0);
@@ -86,35 +244,10 @@ main(
 			continue;
 		}
 
-		ledscape_frame_t * const frame
-			= ledscape_frame(leds, frame_num);
-
-		for(unsigned x=0 ; x < num_pixels ; x++)
-		{
-			for(unsigned strip = 0 ; strip < num_strips ; strip++)
-			{
-				const uint8_t r = buf[strip*num_pixels*3 + x*3 + 0];
-				const uint8_t g = buf[strip*num_pixels*3 + x*3 + 1];
-				const uint8_t b = buf[strip*num_pixels*3 + x*3 + 2];
-				ledscape_set_color(frame, strip, x, r, g, b);
-			}
-		}
-
-		ledscape_wait(leds);
-		ledscape_draw(leds, frame_num);
-
-		time_t now = time(NULL);
-
-		if (now != last_time)
-		{
-			printf("%d fps\n", fps_counter);
-			last_time = now;
-			fps_counter = 0;
-		}
-		fps_counter++;
-
-
-		frame_num = (frame_num+1) % 2;
+		pthread_mutex_lock(&rx.lock);
+		rx_blit(&rx, rx.frame_num, buf, rc / 3);
+		rx_draw(&rx, rx.frame_num);
+		pthread_mutex_unlock(&rx.lock);
 	}
 
 	ledscape_close(leds);
@@ -16,6 +16,9 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "util.h"
 
 /** Write all the bytes to a fd, even if there is a brief interruption.
@@ -90,3 +93,45 @@ hexdump(
 	fprintf(outfile, "\n");
 }
 
+
+
+uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int
+futex_wait(
+	volatile uint32_t * const addr,
+	const uint32_t expected,
+	const int timeout_ms
+)
+{
+	struct timespec ts = {
+		.tv_sec		= timeout_ms / 1000,
+		.tv_nsec	= (timeout_ms % 1000) * 1000000,
+	};
+
+	const int rc = syscall(SYS_futex, addr, FUTEX_WAIT, expected,
+		timeout_ms < 0 ? NULL : &ts, NULL, 0);
+
+	if (rc < 0 && errno == ETIMEDOUT)
+		return -1;
+
+	// EAGAIN (value already changed) and EINTR look like a wakeup;
+	// the caller re-checks its condition anyway.
+	return 0;
+}
+
+
+void
+futex_wake(
+	volatile uint32_t * const addr
+)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -57,4 +57,28 @@ write_all(
 	const size_t len
 );
 
+
+
+/** Current CLOCK_MONOTONIC time in nanoseconds. */
+extern uint64_t
+monotonic_ns(void);
+
+
+/** Sleep while *addr == expected, or until timeout_ms (-1 forever).
+ * \return 0 when woken (or the value already changed), -1 on timeout.
+ */
+extern int
+futex_wait(
+	volatile uint32_t * const addr,
+	const uint32_t expected,
+	const int timeout_ms
+);
+
+
+/** Wake every thread sleeping in futex_wait() on addr. */
+extern void
+futex_wake(
+	volatile uint32_t * const addr
+);
+
 #endif
@@ -0,0 +1,537 @@
+/** \file
+ * Check pin edge traces of the WS281x firmware against the chips.
+ *
+ * Reads the "time_ns gpio pin level" lines that pru-sim -e writes
+ * and checks every bit of every strip against the timing that a chip
+ * accepts: the high times of zeros and ones, the low times after them
+ * that the chips need before the next bit, the low time between bits
+ * (TLL) that must stay short of a latch, and the reset that latches a
+ * frame.  The bits are decoded back into each strip's pixels, which
+ * can be written out or compared with the frame that was clocked out,
+ * and the trace can be converted into a VCD file for a waveform viewer.
+ *
+ * Exits non-zero if any bit is out of spec or any pixel differs, so
+ * that a timing change can be verified in CI before it goes near a rig.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "ledscape.h"
+#include "ws281x_pins.h"
+#include "util.h"
+
+
+/** What the chips accept, in ns.
+ *
+ * The windows are the data sheets' typical times give or take their
+ * 150 ns tolerance, or their own limits where they give them.  The
+ * exception is the ws2812, whose ones may stay high for up to 1000 ns
+ * and low for as little as 300 ns, as they do with the "ws2812" timing
+ * in ledscape.c that LEDscape has always clocked them out with.
+ * t0l_min and t1l_min are the shortest lows after a zero and a one
+ * before the next bit starts.  tll_max is the longest low between
+ * bits that is safely not a latch; some chips latch well before the
+ * reset time in their data sheet.
+ */
+typedef struct
+{
+	const char * name;
+	unsigned t0h_min;
+	unsigned t0h_max;
+	unsigned t1h_min;
+	unsigned t1h_max;
+	unsigned t0l_min;
+	unsigned t1l_min;
+	unsigned tll_max;
+	unsigned reset_min;
+} chip_t;
+
+static const chip_t chips[] = {
+	{ "ws2812",	200,  500,  550, 1000,  650,  300, 5000,  50000 },
+	{ "ws2812b",	250,  550,  650,  950,  700,  300, 5000, 280000 },
+	{ "ws2813",	150,  450,  600, 1000,  300,  300, 5000, 300000 },
+	{ "sk6812",	150,  450,  450,  750,  750,  450, 5000,  80000 },
+	{ "ws2811",	350,  650, 1050, 1350, 1850, 1150, 5000,  50000 }, // 400 kHz slow mode
+	{ NULL },
+};
+
+
+enum {
+	BAD_T0H,
+	BAD_T1H,
+	BAD_T0L,
+	BAD_T1L,
+	BAD_TLL,
+	BAD_RESET,
+	BAD_PIXELS,
+	BAD_MISMATCH,
+	BAD_KINDS,
+};
+
+static const char * const bad_names[BAD_KINDS] = {
+	"T0H",
+	"T1H",
+	"T0L",
+	"T1L",
+	"TLL",
+	"reset",
+	"partial pixel",
+	"pixel mismatch",
+};
+
+/** Only the first few of each kind are worth printing. */
+#define BAD_REPORT		10
+
+
+typedef struct
+{
+	int active; // has clocked out a bit since the last latch
+	unsigned level;
+	unsigned one; // the last bit
+	uint64_t rise;
+	uint64_t fall;
+
+	unsigned frame;
+	uint32_t * pixels;
+	size_t num_bits;
+	size_t alloc;
+} strip_t;
+
+
+typedef struct
+{
+	const chip_t * chip;
+	unsigned pixel_bits;
+	FILE * vcd;
+	FILE * pixel_file;
+
+	// frame to compare with, as ledscape.c lays it out
+	const uint8_t * expected;
+	size_t expected_rows;
+
+	int pin_strip[4][32];
+	strip_t strip[LEDSCAPE_NUM_STRIPS];
+
+	uint64_t now;
+	uint64_t bits;
+	uint64_t frames;
+	uint64_t pixels;
+	uint64_t bad[BAD_KINDS];
+} check_t;
+
+
+static void
+bad(
+	check_t * const check,
+	const unsigned kind,
+	const unsigned strip,
+	const char * const fmt,
+	...
+)
+{
+	if (check->bad[kind]++ >= BAD_REPORT)
+		return;
+
+	const strip_t * const s = &check->strip[strip];
+	printf("strip %u frame %u bit %zu at %"PRIu64" ns: %s: ",
+		strip,
+		s->frame,
+		s->num_bits,
+		check->now,
+		bad_names[kind]
+	);
+
+	va_list ap;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+
+static void
+strip_bit(
+	check_t * const check,
+	const unsigned strip,
+	const uint64_t high
+)
+{
+	const chip_t * const chip = check->chip;
+	strip_t * const s = &check->strip[strip];
+
+	// Decode on the middle of the gap between the windows, as the
+	// chips sample the line part way into the bit.
+	const unsigned one = high * 2 > (uint64_t) chip->t0h_max + chip->t1h_min;
+
+	if (!one && (high < chip->t0h_min || high > chip->t0h_max))
+		bad(check, BAD_T0H, strip, "high %"PRIu64" ns is outside %u-%u ns",
+			high,
+			chip->t0h_min,
+			chip->t0h_max
+		);
+	if (one && (high < chip->t1h_min || high > chip->t1h_max))
+		bad(check, BAD_T1H, strip, "high %"PRIu64" ns is outside %u-%u ns",
+			high,
+			chip->t1h_min,
+			chip->t1h_max
+		);
+
+	const size_t pixel = s->num_bits / check->pixel_bits;
+	if (pixel >= s->alloc)
+	{
+		s->alloc = s->alloc ? 2 * s->alloc : 1024;
+		s->pixels = realloc(s->pixels, s->alloc * sizeof(*s->pixels));
+		if (!s->pixels)
+			die("realloc failed\n");
+	}
+
+	if (s->num_bits % check->pixel_bits == 0)
+		s->pixels[pixel] = 0;
+
+	// Most significant bit first
+	s->pixels[pixel] = s->pixels[pixel] << 1 | one;
+	s->one = one;
+	s->num_bits++;
+	check->bits++;
+}
+
+
+/** The strip has latched its frame: check and report its pixels. */
+static void
+strip_latch(
+	check_t * const check,
+	const unsigned strip
+)
+{
+	strip_t * const s = &check->strip[strip];
+	const size_t num_pixels = s->num_bits / check->pixel_bits;
+	const uint32_t mask = check->pixel_bits == 32 ? 0xFFFFFFFF : (1u << check->pixel_bits) - 1;
+
+	if (s->num_bits % check->pixel_bits)
+		bad(check, BAD_PIXELS, strip, "%zu bits are not whole %u bit pixels",
+			s->num_bits,
+			check->pixel_bits
+		);
+
+	for (size_t i = 0 ; i < num_pixels ; i++)
+	{
+		if (check->pixel_file)
+			fprintf(check->pixel_file, "%u %u %zu %0*"PRIx32"\n",
+				s->frame,
+				strip,
+				i,
+				check->pixel_bits / 4,
+				s->pixels[i]
+			);
+
+		if (!check->expected)
+			continue;
+
+		if (i >= check->expected_rows)
+		{
+			bad(check, BAD_MISMATCH, strip, "%zu pixels, but the frame has %zu rows",
+				num_pixels,
+				check->expected_rows
+			);
+			break;
+		}
+
+		uint32_t want;
+		memcpy(&want, check->expected + (i * LEDSCAPE_NUM_STRIPS + strip) * 4, sizeof(want));
+		if ((want & mask) != s->pixels[i])
+			bad(check, BAD_MISMATCH, strip, "pixel %zu is %0*"PRIx32", not %0*"PRIx32,
+				i,
+				check->pixel_bits / 4,
+				s->pixels[i],
+				check->pixel_bits / 4,
+				want & mask
+			);
+	}
+
+	check->frames++;
+	check->pixels += num_pixels;
+	s->active = 0;
+	s->num_bits = 0;
+	s->frame++;
+}
+
+
+static void
+strip_edge(
+	check_t * const check,
+	const unsigned strip,
+	const unsigned level
+)
+{
+	strip_t * const s = &check->strip[strip];
+
+	if (level == s->level)
+		return;
+	s->level = level;
+
+	if (!level)
+	{
+		s->fall = check->now;
+		strip_bit(check, strip, s->fall - s->rise);
+		return;
+	}
+
+	// A low long enough to latch the frame starts the next one, one
+	// that might latch breaks it, and one that is too short runs the
+	// bit into the next.
+	const chip_t * const chip = check->chip;
+	const uint64_t low = check->now - s->fall;
+	const unsigned low_min = s->one ? chip->t1l_min : chip->t0l_min;
+	if (s->active && low >= chip->reset_min)
+		strip_latch(check, strip);
+	else
+	if (s->active && low > chip->tll_max)
+		bad(check, BAD_TLL, strip, "low %"PRIu64" ns is over %u ns and short of the %u ns reset",
+			low,
+			chip->tll_max,
+			chip->reset_min
+		);
+	else
+	if (s->active && low < low_min)
+		bad(check, s->one ? BAD_T1L : BAD_T0L, strip, "low %"PRIu64" ns is under %u ns",
+			low,
+			low_min
+		);
+
+	s->active = 1;
+	s->rise = check->now;
+}
+
+
+/** One character VCD identifiers, from '!' on. */
+static void
+vcd_header(
+	check_t * const check
+)
+{
+	fprintf(check->vcd,
+		"$comment ws281x-check, %s timing $end\n"
+		"$timescale 1ns $end\n"
+		"$scope module ledscape $end\n",
+		check->chip->name
+	);
+
+	for (unsigned i = 0 ; i < LEDSCAPE_NUM_STRIPS ; i++)
+		if (strip_pins[i].gpio != STRIP_NO_PIN)
+			fprintf(check->vcd, "$var wire 1 %c strip%u_gpio%u_%u $end\n",
+				'!' + i,
+				i,
+				strip_pins[i].gpio,
+				strip_pins[i].pin
+			);
+
+	fprintf(check->vcd, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+	for (unsigned i = 0 ; i < LEDSCAPE_NUM_STRIPS ; i++)
+		if (strip_pins[i].gpio != STRIP_NO_PIN)
+			fprintf(check->vcd, "0%c\n", '!' + i);
+	fprintf(check->vcd, "$end\n");
+}
+
+
+static const uint8_t *
+read_frame(
+	const char * const filename,
+	size_t * const rows
+)
+{
+	FILE * const file = fopen(filename, "rb");
+	if (!file)
+		die("%s: unable to open: %s\n", filename, strerror(errno));
+
+	size_t len = 0, alloc = 1 << 16;
+	uint8_t * buf = malloc(alloc);
+	size_t rc;
+	while (buf && (rc = fread(buf + len, 1, alloc - len, file)) > 0)
+	{
+		len += rc;
+		if (len == alloc)
+			buf = realloc(buf, alloc *= 2);
+	}
+	if (!buf)
+		die("malloc failed\n");
+	fclose(file);
+
+	*rows = len / (LEDSCAPE_NUM_STRIPS * 4);
+	return buf;
+}
+
+
+int
+main(
+	int argc,
+	char ** argv
+)
+{
+	const char * chip_name = "ws2812";
+	const char * vcd_file = NULL;
+	const char * pixel_file = NULL;
+	const char * expected_file = NULL;
+	unsigned pixel_bits = 24;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "T:Wv:p:x:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'T':
+			chip_name = optarg;
+			break;
+		case 'W':
+			pixel_bits = 32;
+			break;
+		case 'v':
+			vcd_file = optarg;
+			break;
+		case 'p':
+			pixel_file = optarg;
+			break;
+		case 'x':
+			expected_file = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-T <chip>] [-W(RGBW strips)] [-v <vcd file>] [-p <pixel file>] [-x <expected frame>] [edge trace]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	check_t check = {
+		.pixel_bits	= pixel_bits,
+	};
+
+	for (const chip_t * chip = chips ; chip->name ; chip++)
+		if (strcmp(chip->name, chip_name) == 0)
+			check.chip = chip;
+	if (!check.chip)
+		die("-T %s is not a chip I know\n", chip_name);
+
+	memset(check.pin_strip, 0xFF, sizeof(check.pin_strip));
+	for (unsigned i = 0 ; i < LEDSCAPE_NUM_STRIPS ; i++)
+		if (strip_pins[i].gpio != STRIP_NO_PIN)
+			check.pin_strip[strip_pins[i].gpio][strip_pins[i].pin] = i;
+
+	if (expected_file)
+		check.expected = read_frame(expected_file, &check.expected_rows);
+
+	if (pixel_file)
+	{
+		check.pixel_file = fopen(pixel_file, "w");
+		if (!check.pixel_file)
+			die("%s: unable to create: %s\n", pixel_file, strerror(errno));
+		fprintf(check.pixel_file, "# frame strip pixel value\n");
+	}
+
+	if (vcd_file)
+	{
+		check.vcd = fopen(vcd_file, "w");
+		if (!check.vcd)
+			die("%s: unable to create: %s\n", vcd_file, strerror(errno));
+		vcd_header(&check);
+	}
+
+	const char * const trace_file = optind < argc ? argv[optind] : "-";
+	FILE * const trace = strcmp(trace_file, "-") == 0 ? stdin : fopen(trace_file, "r");
+	if (!trace)
+		die("%s: unable to open: %s\n", trace_file, strerror(errno));
+
+	char line[256];
+	unsigned line_num = 0;
+	uint64_t vcd_time = 0;
+	uint64_t end = 0;
+
+	while (fgets(line, sizeof(line), trace))
+	{
+		uint64_t when;
+		unsigned gpio, pin, level;
+		line_num++;
+
+		// pru-sim notes when the trace stopped, after the reset
+		if (sscanf(line, "# end %"SCNu64, &when) == 1)
+		{
+			end = when;
+			continue;
+		}
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%"SCNu64" %u %u %u", &when, &gpio, &pin, &level) != 4
+		||  gpio > 3 || pin > 31 || level > 1)
+			die("%s:%u: expected 'time_ns gpio pin level'\n", trace_file, line_num);
+		if (when < check.now)
+			die("%s:%u: time goes backwards\n", trace_file, line_num);
+		check.now = when;
+
+		const int strip = check.pin_strip[gpio][pin];
+		if (strip < 0)
+		{
+			warn_once("gpio%u_%u is not a strip; ignored\n", gpio, pin);
+			continue;
+		}
+
+		strip_edge(&check, strip, level);
+
+		if (check.vcd)
+		{
+			if (when != vcd_time)
+				fprintf(check.vcd, "#%"PRIu64"\n", when);
+			vcd_time = when;
+			fprintf(check.vcd, "%u%c\n", level, '!' + strip);
+		}
+	}
+
+	if (end < check.now)
+		end = check.now;
+	check.now = end;
+
+	// Whatever the strips were still clocking out when the trace
+	// ended has to have been followed by its reset.
+	for (unsigned i = 0 ; i < LEDSCAPE_NUM_STRIPS ; i++)
+	{
+		strip_t * const s = &check.strip[i];
+		if (!s->active)
+			continue;
+
+		if (s->level || end - s->fall < check.chip->reset_min)
+			bad(&check, BAD_RESET, i, "trace ends %"PRIu64" ns after the last bit, short of the %u ns reset",
+				s->level ? 0 : end - s->fall,
+				check.chip->reset_min
+			);
+		strip_latch(&check, i);
+	}
+
+	if (check.vcd)
+	{
+		fprintf(check.vcd, "#%"PRIu64"\n", end);
+		fclose(check.vcd);
+	}
+	if (check.pixel_file)
+		fclose(check.pixel_file);
+
+	printf("%s timing: %"PRIu64" bits, %"PRIu64" pixels in %"PRIu64" strip frames\n",
+		check.chip->name,
+		check.bits,
+		check.pixels,
+		check.frames
+	);
+
+	uint64_t total = 0;
+	for (unsigned i = 0 ; i < BAD_KINDS ; i++)
+	{
+		total += check.bad[i];
+		if (check.bad[i])
+			printf("%"PRIu64" %s errors\n", check.bad[i], bad_names[i]);
+	}
+
+	if (!total)
+		printf("OK\n");
+
+	return total ? EXIT_FAILURE : 0;
+}
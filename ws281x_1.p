@@ -13,28 +13,35 @@
  //*  0 is 0.25 usec high, 1 usec low
  //*  1 is 0.60 usec high, 0.65 usec low
  //*  Reset is 50 usec
+ //*
+ //* These are the defaults; the host passes the timings of the chips
+ //* actually attached in the command (see ledscape_timing_t).
+ //
+ // Pins are not contiguous.  ws281x.pins lists them, and each PRU
+ // drives its 24 strips on at most two GPIO banks, A and B.
  //
- // Pins are not contiguous.
- // 16 pins on GPIO0: 2 3 4 5 7 12 13 14 15 20 22 23 26 27 30 31
- // 10 pins on GPIO1: 12 13 14 15 16 17 18 19 28 29
- //  5 pins on GPIO2: 1 2 3 4 5
- //  8 pins on GPIO3: 14 15 16 17 18 19 20 21
+ // each pixel is stored in 4 bytes in the order GRBA (4th byte is ignored),
+ // or GRBW for RGBW strips, which clock out all 32 bits
  //
- // each pixel is stored in 4 bytes in the order GRBA (4th byte is ignored)
+ // With BIT_PLANES set in the command, the ARM has already transposed
+ // the pixels into the zero masks of banks A and B for every bit, 8
+ // bytes per bit in a row of 256 bytes per PRU, and the bit loop only
+ // loads and stores them.
  //
  // while len > 0:
-	 // for bit# = 24 down to 0:
-		 // delay 600 ns
-		 // read 16 registers of data, build zero map for gpio0
-		 // read 10 registers of data, build zero map for gpio1
-		 // read  5 registers of data, build zero map for gpio3
+	 // for bit# = 24 (or 32) down to 0:
+		 // read 16 registers of the cached row, build their zero maps
+		 // (on the last bit: the last 8 strips as well, and fetch
+		 //  the next row into the cache)
+		 // wait for the end of the previous bit
 		 //
-		 // Send start pulse on all pins on gpio0, gpio1 and gpio3
+		 // Send start pulse on all pins on banks A and B
+		 // read 8 more registers, build the zero maps of the last 8 strips
 		 // delay 250 ns
 		 // bring zero pins low
-		 // delay 300 ns
+		 // delay 350 ns
 		 // bring all pins low
-	 // increment address by 32
+	 // increment address by the row stride
 
  //*
  //* So to clock this out:
@@ -53,87 +60,30 @@
 
 //===============================
 // GPIO Pin Mapping
+//
+// The banks and pins of the strips are generated from ws281x.pins by
+// pinmap.pl.  The start pulse masks for banks A and B come from the
+// command structure, so that only the pins of active strips are driven.
+#include "ws281x_1_pins.hp"
 
-// Pins in GPIO2
-#define gpio2_bit0 1
-#define gpio2_bit1 2
-#define gpio2_bit2 3
-#define gpio2_bit3 4
-#define gpio2_bit4 5
-#define gpio2_bit5 6
-#define gpio2_bit6 7
-#define gpio2_bit7 8
-#define gpio2_bit8 9
-#define gpio2_bit9 10
-#define gpio2_bit10 11
-#define gpio2_bit11 12
-#define gpio2_bit12 13
-#define gpio2_bit13 14
-#define gpio2_bit14 15
-#define gpio2_bit15 16
-
-#define gpio2_bit16 17
-#define gpio2_bit17 22
-#define gpio2_bit18 23
-// #define gpio2_bit19 24 // BROKEN
-#define gpio2_bit19 25
-
-// Pins in GPIO3
-#define gpio3_bit0 14
-#define gpio3_bit1 15
-#define gpio3_bit2 16
-#define gpio3_bit3 17
-#define gpio3_bit4 19
-#define gpio3_bit5 21
-
-
-#define GPIO2_LED_MASK  0x3c3fffe
-// (0\
-// |(1<<gpio2_bit0)\
-// |(1<<gpio2_bit1)\
-// |(1<<gpio2_bit2)\
-// |(1<<gpio2_bit3)\
-// |(1<<gpio2_bit4)\
-// |(1<<gpio2_bit5)\
-// |(1<<gpio2_bit6)\
-// |(1<<gpio2_bit7)\
-// |(1<<gpio2_bit8)\
-// |(1<<gpio2_bit9)\
-// |(1<<gpio2_bit10)\
-// |(1<<gpio2_bit11)\
-// |(1<<gpio2_bit12)\
-// |(1<<gpio2_bit13)\
-// |(1<<gpio2_bit14)\
-// |(1<<gpio2_bit15)\
-// |(1<<gpio2_bit16)\
-// |(1<<gpio2_bit17)\
-// |(1<<gpio2_bit18)\
-// |(1<<gpio2_bit19)\
-// |(1<<gpio2_bit20)\
-// )
-
-#define GPIO3_LED_MASK (0\
-|(1<<gpio3_bit0)\
-|(1<<gpio3_bit1)\
-|(1<<gpio3_bit2)\
-|(1<<gpio3_bit3)\
-)
-//|(1<<gpio3_bit4)\
-//|(1<<gpio3_bit5)\
 
 /** Register map */
 #define data_addr r0
 #define data_len r1
-#define gpio0_zeros r2
-#define gpio1_zeros r3
-#define gpio2_zeros r4
-#define gpio3_zeros r5
+#define a_zeros r2
+#define b_zeros r3
+#define seg_addr r4
+#define seg_left r5
 #define bit_num r6
 #define sleep_counter r7
+#define rows_left r7 // sleep_counter is only used for the reset delay
 #define addr_reg r8
 #define temp_reg r9
+#define row_stride r26
 #define temp2_reg r27
-// r10 - r26 are used for temp storage and bitmap processing
+#define a_mask r28
+#define b_mask r29
+// r10 - r25 are used for temp storage and bitmap processing
 
 
 /** Sleep a given number of nanoseconds with 10 ns resolution.
@@ -143,29 +93,26 @@
  */
 .macro SLEEPNS
 .mparam ns,inst,lab
-#ifdef CONFIG_WS2812
-    MOV sleep_counter, (ns/5)-1-inst // ws2812 -- low speed
-#else
-    MOV sleep_counter, (ns/10)-1-inst // ws2811 -- high speed
-#endif
+    MOV sleep_counter, (ns/10)-1-inst // two 5 ns cycles per loop
 lab:
     SUB sleep_counter, sleep_counter, 1
     QBNE lab, sleep_counter, 0
 .endm
 
 
-/** Wait for the cycle counter to reach a given value */
-.macro WAITNS
-.mparam ns,lab
+/** Wait for the cycle counter to reach one of the bit timings.
+ *
+ * The timings are in PRU cycles in the command structure, so that
+ * the host can switch chips without reassembling; temp2_reg is free
+ * between resets of the counter.
+ */
+.macro WAITTIMING
+.mparam timing,lab
     MOV r8, 0x24000 // control register
+    LBCO temp2_reg, CONST_PRUDRAM, timing, 4
 lab:
 	LBBO r9, r8, 0xC, 4 // read the cycle counter
-//	SUB r9, r9, sleep_counter 
-#ifdef CONFIG_WS2812
-	QBGT lab, r9, 2*(ns)/5
-#else
-	QBGT lab, r9, (ns)/5
-#endif
+	QBGT lab, r9, temp2_reg
 .endm
 
 /** Reset the cycle counter */
@@ -184,7 +131,46 @@ lab:
 
 		// Read the current counter value
 		// Should be zero.
-		LBBO sleep_counter, addr_reg, 0xC, 4
+		LBBO r9, addr_reg, 0xC, 4
+.endm
+
+/** Copy the row at src from the DDR into the row cache */
+.macro FETCH_ROW
+.mparam src
+    MOV addr_reg, ROW_CACHE
+    LBBO r10, src, 0, 16*4
+    SBBO r10, addr_reg, 0, 16*4
+    LBBO r10, src, 16*4, 8*4
+    SBBO r10, addr_reg, 16*4, 8*4
+.endm
+
+/** Copy the bit planes of the row at src from the DDR into the row cache */
+.macro FETCH_PLANES
+.mparam src
+    MOV addr_reg, ROW_CACHE
+    LBBO r10, src, 0, 16*4
+    SBBO r10, addr_reg, 0, 16*4
+    LBBO r10, src, 64, 16*4
+    SBBO r10, addr_reg, 64, 16*4
+    LBBO r10, src, 128, 16*4
+    SBBO r10, addr_reg, 128, 16*4
+    LBBO r10, src, 192, 16*4
+    SBBO r10, addr_reg, 192, 16*4
+.endm
+
+/** Reset the cycle counter and the stall counter for a new frame */
+.macro RESET_COUNTERS
+		MOV addr_reg, 0x24000 // control register
+		LBBO r9, addr_reg, 0, 4
+		CLR r9, r9, 3 // disable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
+
+		MOV temp2_reg, 0
+		SBBO temp2_reg, addr_reg, 0xC, 4 // clear the timer
+		SBBO temp2_reg, addr_reg, 0x10, 4 // and the stall count
+
+		SET r9, r9, 3 // enable counter bit
+		SBBO r9, addr_reg, 0, 4 // write it back
 .endm
 
 START:
@@ -210,6 +196,13 @@ START:
     MOV		r1, CTPPR_1
     ST32	r0, r1
 
+    // Start the IEP timer, which both PRUs share for the frame
+    // telemetry.  Whichever PRU starts second rewrites the same
+    // configuration, which does not disturb the count.
+    MOV r0, IEP | IEP_GLOBAL_CFG
+    MOV r1, 0x11 // increment by 1 per cycle, count enable
+    SBBO r1, r0, 0, 4
+
     // Write a 0x1 into the response field so that they know we have started
     MOV r2, #0x1
     SBCO r2, CONST_PRUDRAM, 12, 4
@@ -251,16 +244,23 @@ _REFERENCE_SIGNAL_LOOP:
     // handles the exit case if an invalid value is written to the start
     // start position.
 _LOOP:
+    // Bump the heartbeat that the host's watchdog checks; it keeps
+    // moving while idle here and once per row during a frame.
+    MOV r10, HEARTBEAT
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
     // Load the pointer to the buffer from PRU DRAM into r0 and the
-    // length (in bytes-bit words) into r1.
+    // number of rows to clock out this frame into r1.
     // start command into r2
     LBCO      data_addr, CONST_PRUDRAM, 0, 12
 
     // Wait for a non-zero command
     QBEQ _LOOP, r2, #0
 
-    // Reset the sleep timer
-    RESET_COUNTER
+    // Reset the sleep timer and the stall count for the telemetry
+    RESET_COUNTERS
 
     // Zero out the start command so that they know we have received it
     // This allows maximum speed frame drawing since they know that they
@@ -271,111 +271,238 @@ _LOOP:
     // Command of 0xFF is the signal to exit
     QBEQ EXIT, r2, #0xFF
 
+    // Time stamp the start of the frame.  The telemetry is past the
+    // reach of a constant offset, so address it from the start of
+    // the PRU's own data RAM.
+    MOV r10, IEP | IEP_COUNT
+    LBBO r11, r10, 0, 4
+    MOV r10, TELEMETRY
+    SBBO r11, r10, 4, 4
+
+    // The frame is clocked out as a series of segments of rows that
+    // share the same set of active strips.  The segment table follows
+    // the command in PRU DRAM; a PRU without strips has no segments.
+    // Only the leading rows that changed may have been asked for;
+    // the strips keep showing the rest from the previous frame.
+    MOV rows_left, data_len
+    LBCO seg_left, CONST_PRUDRAM, 16, 4
+    MOV seg_addr, SEGMENTS
+    QBEQ FRAME_DONE, seg_left, #0
+    QBEQ FRAME_DONE, rows_left, #0
+
+    // Fetch the first row into the row cache in PRU DRAM.  Every bit
+    // reads the row from there, and the last bit of each row prefetches
+    // the next, so that the DDR is read once per row rather than on
+    // every bit; its stalls would stretch the bit timings.
+    MOV r10, BIT_PLANES
+    LBBO r11, r10, 0, 4
+    QBNE first_planes, r11, 0
+    FETCH_ROW data_addr
+    QBA SEG_LOOP
+first_planes:
+    FETCH_PLANES data_addr
+
+SEG_LOOP:
+    // Load the row stride, the row count (into temp2, which is only
+    // used while resetting the counter) and the active pin masks.
+    LBCO row_stride, CONST_PRUDRAM, seg_addr, 16
+    MOV data_len, temp2_reg
+    ADD seg_addr, seg_addr, 16
+
+    // Stop early in this segment if the frame is cut short
+    QBGE seg_rows_ok, data_len, rows_left
+    MOV data_len, rows_left
+seg_rows_ok:
+    SUB rows_left, rows_left, data_len
+
 WORD_LOOP:
-	// for bit in 24 to 0
-	MOV bit_num, 24
+	// for bit in 24 (32 for RGBW strips) to 0
+	MOV r10, PIXEL_BITS
+	LBBO bit_num, r10, 0, 4
+	MOV r10, BIT_PLANES
+	LBBO r11, r10, 0, 4
+	QBNE PLANE_BIT_LOOP, r11, 0
 
 	BIT_LOOP:
 		SUB bit_num, bit_num, 1
 		/** Macro to generate the mask of which bits are zero.
-		 * For each of these registers, set the
-		 * corresponding bit in the gpio0_zeros register if
-		 * the current bit is set in the strided register.
+		 * For strip n in register regN, set its pin in the
+		 * zeros register of its bank (a or b) if the current
+		 * bit is clear.  The sequences of tests are generated
+		 * from the pin table into TEST_BITS_EARLY and _LATE.
 		 */
-		#define TEST_BIT(regN,gpioN,bitN) \
-			QBBS gpioN##_##bitN##_skip, regN, bit_num; \
-			SET gpioN##_zeros, gpioN##_zeros, gpioN##_##bitN ; \
-			gpioN##_##bitN##_skip: ; \
-
-		// Load 16 registers of data, starting at r10
-		LBBO r10, r0, 24*4, 16*4
-		MOV gpio2_zeros, 0
-		TEST_BIT(r10, gpio2, bit0)
-		TEST_BIT(r11, gpio2, bit1)
-		TEST_BIT(r12, gpio2, bit2)
-		TEST_BIT(r13, gpio2, bit3)
-		TEST_BIT(r14, gpio2, bit4)
-		TEST_BIT(r15, gpio2, bit5)
-		TEST_BIT(r16, gpio2, bit6)
-		TEST_BIT(r17, gpio2, bit7)
-		TEST_BIT(r18, gpio2, bit8)
-		TEST_BIT(r19, gpio2, bit9)
-		TEST_BIT(r20, gpio2, bit10)
-		TEST_BIT(r21, gpio2, bit11)
-		TEST_BIT(r22, gpio2, bit12)
-		TEST_BIT(r23, gpio2, bit13)
-		TEST_BIT(r24, gpio2, bit14)
-		TEST_BIT(r25, gpio2, bit15)
-
-		// Load 8 more registers of data
-		LBBO r10, r0, 40*4, 8*4
-		// Data loaded
-
-		MOV r22, GPIO2_LED_MASK
-		MOV r23, GPIO3_LED_MASK
-
-		// Clear the 1 bits from the last frame
-		MOV r24, GPIO2 | GPIO_CLEARDATAOUT
-		MOV r25, GPIO3 | GPIO_CLEARDATAOUT
-
-		WAITNS 900, wait_one_time
-		SBBO r23, r25, 0, 4
-		SBBO r22, r24, 0, 4
-
-		MOV r24, GPIO2 | GPIO_SETDATAOUT
-		MOV r25, GPIO3 | GPIO_SETDATAOUT
-
-		// Wait until the end of the frame (including the time it takes to reset the counter)
-		WAITNS 1150, wait_frame_spacing_time
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_skip: ; \
+
+		// The work of a bit happens while the lines are low, before
+		// its start pulse, or under the start pulse before the zeros
+		// fall, so that nothing but the wait comes between the zeros
+		// and the ones falling.  Work that runs long stretches the
+		// low time, which the strips tolerate, not the high times.
+
+		// Load 16 registers of data from the row cache, starting at r10
+		MOV temp_reg, ROW_CACHE
+		LBBO r10, temp_reg, 0, 16*4
+		MOV a_zeros, 0
+		MOV b_zeros, 0
+		TEST_BITS_EARLY
+
+		// Before the start of the last bit, load and test the last 8
+		// strips now and prefetch the next row into the cache, since
+		// that needs their registers.  Reading one row past the end
+		// of the frame is harmless, as ledscape_layout() pads the
+		// frame for it.
+		QBNE prefetch_done, bit_num, 0
+		LBBO r10, temp_reg, 16*4, 8*4
+		#undef TEST_BIT
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_last_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_last_skip: ; \
+
+		TEST_BITS_LATE
+		ADD temp_reg, data_addr, row_stride
+		FETCH_ROW temp_reg
+	prefetch_done:
+
+		// Load the address(es) of the GPIO devices
+		MOV r20, a_mask
+		MOV r21, b_mask
+		MOV r22, GPIO_A | GPIO_SETDATAOUT
+		MOV r23, GPIO_B | GPIO_SETDATAOUT
+
+		// Wait until the end of the previous bit (including the time it takes to reset the counter)
+		WAITTIMING TIMING_PERIOD, wait_frame_spacing_time
 		RESET_COUNTER
 
 		// Send all the start bits
-		SBBO r23, r25, 0, 4
-		SBBO r22, r24, 0, 4
-
-		// Reconfigure r10-13 for clearing the bits
-		MOV r24, GPIO2 | GPIO_CLEARDATAOUT
-		MOV r25, GPIO3 | GPIO_CLEARDATAOUT
-
-		// Test some more bits to pass the time
-		TEST_BIT(r10, gpio2, bit16)
-		TEST_BIT(r11, gpio2, bit17)
-		TEST_BIT(r12, gpio2, bit18)
-		TEST_BIT(r13, gpio2, bit19)
-		MOV gpio3_zeros, 0
-		TEST_BIT(r14, gpio3, bit0)
-		TEST_BIT(r15, gpio3, bit1)
-		TEST_BIT(r16, gpio3, bit2)
-		TEST_BIT(r17, gpio3, bit3)
-
-		// wait for the length of the zero bits (250ns)
-		WAITNS 240, wait_zero_time
+		SBBO r20, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r21, r23, 0, 4
+#endif
+
+		// Reconfigure r22-23 for clearing the bits
+		MOV r22, GPIO_A | GPIO_CLEARDATAOUT
+		MOV r23, GPIO_B | GPIO_CLEARDATAOUT
+
+		// Load and test the last 8 strips, unless the last bit
+		// already has; this fits within the shortest T0H that
+		// ws281x_timing_cycles() accepts.
+		QBEQ late_tests_done, bit_num, 0
+		MOV temp_reg, ROW_CACHE
+		LBBO r10, temp_reg, 16*4, 8*4
+		#undef TEST_BIT
+		#define TEST_BIT(regN,bank,pin,n) \
+			QBBS strip##n##_skip, regN, bit_num; \
+			SET bank##_zeros, bank##_zeros, pin ; \
+			strip##n##_skip: ; \
+
+		TEST_BITS_LATE
+	late_tests_done:
+
+		WAITTIMING TIMING_T0H, wait_zero_time
 
 		// turn off all the zero bits
-		SBBO gpio2_zeros, r24, 0, 4
-		SBBO gpio3_zeros, r25, 0, 4
+		SBBO a_zeros, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO b_zeros, r23, 0, 4
+#endif
+
+		// and then all of the ones
+		WAITTIMING TIMING_T1H, wait_one_time
+		SBBO r20, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r21, r23, 0, 4
+#endif
 
 		QBNE BIT_LOOP, bit_num, 0
+	QBA ROW_DONE
+
+	PLANE_BIT_LOOP:
+		SUB bit_num, bit_num, 1
+
+		// Load the zero masks of the bit from the cached planes
+		LSL temp_reg, bit_num, 3
+		MOV addr_reg, ROW_CACHE
+		ADD temp_reg, temp_reg, addr_reg
+		LBBO a_zeros, temp_reg, 0, 8
+
+		// Prefetch the planes of the next row, as for the pixels
+		QBNE plane_prefetch_done, bit_num, 0
+		ADD temp_reg, data_addr, row_stride
+		FETCH_PLANES temp_reg
+	plane_prefetch_done:
+
+		MOV r20, a_mask
+		MOV r21, b_mask
+		MOV r22, GPIO_A | GPIO_SETDATAOUT
+		MOV r23, GPIO_B | GPIO_SETDATAOUT
+
+		WAITTIMING TIMING_PERIOD, plane_wait_frame_spacing_time
+		RESET_COUNTER
+
+		// Send all the start bits
+		SBBO r20, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r21, r23, 0, 4
+#endif
 
+		MOV r22, GPIO_A | GPIO_CLEARDATAOUT
+		MOV r23, GPIO_B | GPIO_CLEARDATAOUT
+
+		WAITTIMING TIMING_T0H, plane_wait_zero_time
+
+		// turn off all the zero bits
+		SBBO a_zeros, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO b_zeros, r23, 0, 4
+#endif
+
+		WAITTIMING TIMING_T1H, plane_wait_one_time
+		SBBO r20, r22, 0, 4
+#if GPIO_BANKS > 1
+		SBBO r21, r23, 0, 4
+#endif
+
+		QBNE PLANE_BIT_LOOP, bit_num, 0
+
+ROW_DONE:
 	// The 32 RGB streams have been clocked out
 	// Move to the next pixel on each row
-	ADD data_addr, data_addr, 48 * 4
+	ADD data_addr, data_addr, row_stride
+	MOV r10, HEARTBEAT
+	LBBO r11, r10, 0, 4
+	ADD r11, r11, 1
+	SBBO r11, r10, 0, 4
 	SUB data_len, data_len, 1
 	QBNE WORD_LOOP, data_len, #0
 
-	// Clear the 1 bits from the final frame 
-	MOV r22, GPIO2_LED_MASK
-	MOV r23, GPIO3_LED_MASK
-	MOV r12, GPIO2 | GPIO_CLEARDATAOUT
-	MOV r13, GPIO3 | GPIO_CLEARDATAOUT
-
-	WAITNS 1000, end_of_frame_clear_wait
-	SBBO r23, r13, 0, 4
-	SBBO r22, r12, 0, 4
-
-    // Delay at least 50 usec; this is the required reset
-    // time for the LED strip to update with the new pixels.
-    SLEEPNS 50000, 1, reset_time
+	QBEQ FRAME_DONE, rows_left, #0
+	SUB seg_left, seg_left, 1
+	QBNE SEG_LOOP, seg_left, #0
+
+FRAME_DONE:
+    // Finish the telemetry with the end time stamp and the cycles
+    // stalled on the DDR during the frame, then count the frame.
+    MOV r10, IEP | IEP_COUNT
+    LBBO r12, r10, 0, 4
+    MOV r10, 0x24000 // control register
+    LBBO r13, r10, 0x10, 4
+    MOV r10, TELEMETRY
+    SBBO r12, r10, 8, 8
+    LBBO r11, r10, 0, 4
+    ADD r11, r11, 1
+    SBBO r11, r10, 0, 4
+
+    // Hold the lines low for the reset time of the strips, which
+    // latches the new pixels; it is in cycles and the loop takes two.
+    LBCO sleep_counter, CONST_PRUDRAM, TIMING_RESET, 4
+    LSR sleep_counter, sleep_counter, 1
+reset_time:
+    SUB sleep_counter, sleep_counter, 1
+    QBNE reset_time, sleep_counter, 0
 
     // Write out that we are done!
     // Store a non-zero response in the buffer so that they know that we are done
@@ -385,6 +512,15 @@ WORD_LOOP:
     LBBO r2, r8, 0xC, 4
     SBCO r2, CONST_PRUDRAM, 12, 4
 
+    // Wake up the ARM, which sleeps on this event rather than polling
+    // the response.  Both PRUs raise the same event so that the ARM
+    // only has to watch one uio device; it checks both responses.
+#ifdef AM33XX
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
+#else
+    MOV R31.b0, PRU0_ARM_INTERRUPT
+#endif
+
     // Go back to waiting for the next frame buffer
     QBA _LOOP
 
@@ -395,9 +531,9 @@ EXIT:
 
 #ifdef AM33XX
     // Send notification to Host for program completion
-    MOV R31.b0, PRU1_ARM_INTERRUPT+16
+    MOV R31.b0, PRU0_ARM_INTERRUPT+16
 #else
-    MOV R31.b0, PRU1_ARM_INTERRUPT
+    MOV R31.b0, PRU0_ARM_INTERRUPT
 #endif
 
     HALT